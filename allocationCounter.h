@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// Heap traffic of the calling thread. Loads read it before and after to see what they cost.
+struct AllocationCounter {
+	size_t allocations = 0;
+	size_t allocatedBytes = 0;
+	size_t copiedBytes = 0; // Bulk geometry copies, counted by hand where they happen
+
+	AllocationCounter &operator+=(const AllocationCounter &other) {
+		allocations += other.allocations;
+		allocatedBytes += other.allocatedBytes;
+		copiedBytes += other.copiedBytes;
+		return *this;
+	}
+
+	AllocationCounter operator-(const AllocationCounter &start) const {
+		AllocationCounter delta;
+		delta.allocations = allocations - start.allocations;
+		delta.allocatedBytes = allocatedBytes - start.allocatedBytes;
+		delta.copiedBytes = copiedBytes - start.copiedBytes;
+		return delta;
+	}
+};
+
+// Per thread so concurrent loads don't see each other
+thread_local AllocationCounter threadAllocations;
+
+// Define COUNT_ALLOCATIONS before the first include to replace the global operator new and feed threadAllocations with
+// every C++ allocation. Off by default, the replacement applies to the whole program. Like every header here, included
+// from one translation unit only.
+#ifdef COUNT_ALLOCATIONS
+const bool ALLOCATION_COUNTING = true;
+
+void *operator new(size_t size) {
+	threadAllocations.allocations++;
+	threadAllocations.allocatedBytes += size;
+
+	void *memory = malloc(size ? size : 1);
+	if (!memory) {
+		throw std::bad_alloc();
+	}
+	return memory;
+}
+
+// Out of line, GCC takes an inlined free() of memory from operator new for a mismatched pair
+#ifdef _MSC_VER
+#define COUNTED_DELETE __declspec(noinline)
+#else
+#define COUNTED_DELETE __attribute__((noinline))
+#endif
+
+COUNTED_DELETE void operator delete(void *memory) noexcept {
+	free(memory);
+}
+
+COUNTED_DELETE void operator delete(void *memory, size_t) noexcept {
+	free(memory);
+}
+#else
+const bool ALLOCATION_COUNTING = false;
+#endif
+
+// malloc-style hooks counted the same way, for C libraries that take an allocator (stb_image's STBI_MALLOC and friends)
+void *countedMalloc(size_t size) {
+	threadAllocations.allocations++;
+	threadAllocations.allocatedBytes += size;
+	return malloc(size);
+}
+
+void *countedRealloc(void *memory, size_t size) {
+	threadAllocations.allocations++;
+	threadAllocations.allocatedBytes += size;
+	return realloc(memory, size);
+}
+
+void countedFree(void *memory) {
+	free(memory);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Pass/fail checks of one benchmark. Failures are logged as they happen, report() logs the verdict.
+class BenchmarkChecks {
+	public:
+		BenchmarkChecks(const std::string &name) : name(name) {}
+
+		bool check(const char *what, bool result) {
+			if (!result) {
+				std::cout << "  FAILED: " << what << std::endl;
+				failed = true;
+			}
+			return result;
+		}
+
+		bool passed() const {
+			return !failed;
+		}
+
+		// "<name> passed" or "<name> FAILED", returns passed()
+		bool report() const {
+			std::cout << name << " " << (failed ? "FAILED" : "passed") << std::endl;
+			return !failed;
+		}
+
+	private:
+		std::string name;
+		bool failed = false;
+};
+
+// Entry in main.cpp's benchmark table, run() returns false when a check failed
+struct Benchmark {
+	const char *name;
+	const char *description;
+	std::function<bool()> run;
+};
+
+// Run the benchmarks named in a comma separated list, "all" runs every one in table order. Returns false if one
+// failed or a name isn't in the table, which lists the table.
+bool runBenchmarks(const std::vector<Benchmark> &benchmarks, const std::string &selection) {
+	std::vector<const Benchmark *> selected;
+	bool known = true;
+	std::stringstream names(selection);
+	std::string name;
+	while (std::getline(names, name, ',')) {
+		bool found = false;
+		for (const Benchmark &benchmark : benchmarks) {
+			if (name == "all" || name == benchmark.name) {
+				selected.push_back(&benchmark);
+				found = true;
+			}
+		}
+		if (!found) {
+			std::cout << "Unknown benchmark " << name << std::endl;
+			known = false;
+		}
+	}
+	if (!known || selected.empty()) {
+		std::cout << "Benchmarks:" << std::endl;
+		for (const Benchmark &benchmark : benchmarks) {
+			std::cout << "  " << benchmark.name << ": " << benchmark.description << std::endl;
+		}
+		return false;
+	}
+
+	bool passed = true;
+	for (const Benchmark *benchmark : selected) {
+		passed = benchmark->run() && passed;
+	}
+	return passed;
+}
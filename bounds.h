@@ -0,0 +1,88 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+struct BoundingSphere {
+	glm::vec3 center = glm::vec3(0.0f);
+	float radius = 0.0f;
+};
+
+// Axis aligned box, kept as center and half extents since that's what plane tests want
+struct BoundingBox {
+	glm::vec3 center = glm::vec3(0.0f);
+	glm::vec3 extents = glm::vec3(0.0f);
+};
+
+BoundingBox computeBoundingBox(const glm::vec3 *points, size_t count, size_t stride = sizeof(glm::vec3)) {
+	BoundingBox box;
+	if (count == 0) {
+		return box;
+	}
+
+	glm::vec3 minimum = *points;
+	glm::vec3 maximum = *points;
+	for (size_t i = 1; i < count; i++) {
+		const glm::vec3 &point = *(const glm::vec3 *)((const char *)points + i * stride);
+		minimum = glm::min(minimum, point);
+		maximum = glm::max(maximum, point);
+	}
+	box.center = (minimum + maximum) * 0.5f;
+	box.extents = (maximum - minimum) * 0.5f;
+	return box;
+}
+
+// Box around a transformed box (Arvo): the new extents are the absolute matrix applied to the old ones
+BoundingBox transformBox(const BoundingBox &box, const glm::mat4 &transform) {
+	BoundingBox result;
+	result.center = glm::vec3(transform * glm::vec4(box.center, 1.0f));
+	for (int row = 0; row < 3; row++) {
+		result.extents[row] = fabs(transform[0][row]) * box.extents.x + fabs(transform[1][row]) * box.extents.y + fabs(transform[2][row]) * box.extents.z;
+	}
+	return result;
+}
+
+// Ritter's approximate bounding sphere, within a few percent of the minimal one. Points may be interleaved with other data.
+BoundingSphere computeBoundingSphere(const glm::vec3 *points, size_t count, size_t stride = sizeof(glm::vec3)) {
+	BoundingSphere sphere;
+	if (count == 0) {
+		return sphere;
+	}
+
+	auto point = [&](size_t i) -> const glm::vec3 & {
+		return *(const glm::vec3 *)((const char *)points + i * stride);
+	};
+	auto farthestFrom = [&](const glm::vec3 &from) {
+		size_t farthest = 0;
+		float farthestDistance = -1.0f;
+		for (size_t i = 0; i < count; i++) {
+			glm::vec3 offset = point(i) - from;
+			float distance = glm::dot(offset, offset);
+			if (distance > farthestDistance) {
+				farthestDistance = distance;
+				farthest = i;
+			}
+		}
+		return point(farthest);
+	};
+
+	// Start from a roughly diametral pair
+	glm::vec3 a = farthestFrom(point(0));
+	glm::vec3 b = farthestFrom(a);
+	sphere.center = (a + b) * 0.5f;
+	sphere.radius = glm::length(b - a) * 0.5f;
+
+	// Grow to take in anything left outside
+	for (size_t i = 0; i < count; i++) {
+		float distance = glm::length(point(i) - sphere.center);
+		if (distance > sphere.radius) {
+			float radius = (sphere.radius + distance) * 0.5f;
+			sphere.center += (point(i) - sphere.center) * ((radius - sphere.radius) / distance);
+			sphere.radius = radius;
+		}
+	}
+	return sphere;
+}
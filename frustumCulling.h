@@ -0,0 +1,227 @@
+#pragma once
+
+#include "bounds.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <vector>
+
+// AVX when the compiler targets it (/arch:AVX, -mavx), otherwise SSE which every x64 target has
+#if defined(__AVX__)
+#include <immintrin.h>
+#define FRUSTUM_CULLING_AVX
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define FRUSTUM_CULLING_SSE
+#endif
+
+using namespace std;
+
+// Six inward facing planes as (normal, distance), a point p is inside one when dot(normal, p) + distance >= 0
+struct Frustum {
+	glm::vec4 planes[6];
+};
+
+// Gribb/Hartmann: the clip space tests -w <= x, y, z <= w are sums of the matrix rows.
+// projection * view gives world space planes, projection * view * model gives the model's own space.
+Frustum extractFrustum(const glm::mat4 &matrix) {
+	auto row = [&](int i) {
+		return glm::vec4(matrix[0][i], matrix[1][i], matrix[2][i], matrix[3][i]);
+	};
+
+	Frustum frustum;
+	frustum.planes[0] = row(3) + row(0); // Left
+	frustum.planes[1] = row(3) - row(0); // Right
+	frustum.planes[2] = row(3) + row(1); // Bottom
+	frustum.planes[3] = row(3) - row(1); // Top
+	frustum.planes[4] = row(3) + row(2); // Near
+	frustum.planes[5] = row(3) - row(2); // Far
+	for (glm::vec4 &plane : frustum.planes) {
+		plane /= glm::length(glm::vec3(plane));
+	}
+	return frustum;
+}
+
+// A box is outside once it's entirely behind any plane. Its farthest corner along the normal is center + |normal| . extents.
+bool isVisible(const Frustum &frustum, const BoundingBox &box) {
+	for (const glm::vec4 &plane : frustum.planes) {
+		glm::vec3 normal = glm::vec3(plane);
+		if (glm::dot(normal, box.center) + plane.w + glm::dot(glm::abs(normal), box.extents) < 0.0f) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Boxes in structure of arrays form, so the kernel loads one component of several boxes per instruction
+class CullingBatch {
+	public:
+		vector<float> centerX, centerY, centerZ;
+		vector<float> extentX, extentY, extentZ;
+
+		void clear() {
+			centerX.clear();
+			centerY.clear();
+			centerZ.clear();
+			extentX.clear();
+			extentY.clear();
+			extentZ.clear();
+		}
+
+		void add(const BoundingBox &box) {
+			centerX.push_back(box.center.x);
+			centerY.push_back(box.center.y);
+			centerZ.push_back(box.center.z);
+			extentX.push_back(box.extents.x);
+			extentY.push_back(box.extents.y);
+			extentZ.push_back(box.extents.z);
+		}
+
+		size_t size() const {
+			return centerX.size();
+		}
+
+		// Test every box, visible[i] is 1 for boxes at least partly inside. Returns how many were.
+		size_t cull(const Frustum &frustum, uint8_t *visible) const {
+			// Plane components and their absolute values, laid out for broadcasting
+			float plane[6][7];
+			for (int p = 0; p < 6; p++) {
+				const glm::vec4 &source = frustum.planes[p];
+				plane[p][0] = source.x;
+				plane[p][1] = source.y;
+				plane[p][2] = source.z;
+				plane[p][3] = source.w;
+				plane[p][4] = fabs(source.x);
+				plane[p][5] = fabs(source.y);
+				plane[p][6] = fabs(source.z);
+			}
+
+			size_t count = size();
+			size_t numVisible = 0;
+			size_t i = 0;
+
+#if defined(FRUSTUM_CULLING_AVX)
+			// Eight boxes per iteration, keep the smallest signed distance over all planes
+			for (; i + 8 <= count; i += 8) {
+				__m256 cx = _mm256_loadu_ps(&centerX[i]), cy = _mm256_loadu_ps(&centerY[i]), cz = _mm256_loadu_ps(&centerZ[i]);
+				__m256 ex = _mm256_loadu_ps(&extentX[i]), ey = _mm256_loadu_ps(&extentY[i]), ez = _mm256_loadu_ps(&extentZ[i]);
+
+				__m256 nearest = _mm256_set1_ps(INFINITY);
+				for (int p = 0; p < 6; p++) {
+					__m256 distance = _mm256_add_ps(_mm256_mul_ps(cx, _mm256_set1_ps(plane[p][0])), _mm256_set1_ps(plane[p][3]));
+					distance = _mm256_add_ps(distance, _mm256_mul_ps(cy, _mm256_set1_ps(plane[p][1])));
+					distance = _mm256_add_ps(distance, _mm256_mul_ps(cz, _mm256_set1_ps(plane[p][2])));
+					distance = _mm256_add_ps(distance, _mm256_mul_ps(ex, _mm256_set1_ps(plane[p][4])));
+					distance = _mm256_add_ps(distance, _mm256_mul_ps(ey, _mm256_set1_ps(plane[p][5])));
+					distance = _mm256_add_ps(distance, _mm256_mul_ps(ez, _mm256_set1_ps(plane[p][6])));
+					nearest = _mm256_min_ps(nearest, distance);
+				}
+
+				int mask = _mm256_movemask_ps(_mm256_cmp_ps(nearest, _mm256_setzero_ps(), _CMP_GE_OQ));
+				for (int lane = 0; lane < 8; lane++) {
+					visible[i + lane] = (mask >> lane) & 1;
+					numVisible += (mask >> lane) & 1;
+				}
+			}
+#elif defined(FRUSTUM_CULLING_SSE)
+			// Four boxes per iteration, keep the smallest signed distance over all planes
+			for (; i + 4 <= count; i += 4) {
+				__m128 cx = _mm_loadu_ps(&centerX[i]), cy = _mm_loadu_ps(&centerY[i]), cz = _mm_loadu_ps(&centerZ[i]);
+				__m128 ex = _mm_loadu_ps(&extentX[i]), ey = _mm_loadu_ps(&extentY[i]), ez = _mm_loadu_ps(&extentZ[i]);
+
+				__m128 nearest = _mm_set1_ps(INFINITY);
+				for (int p = 0; p < 6; p++) {
+					__m128 distance = _mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane[p][0])), _mm_set1_ps(plane[p][3]));
+					distance = _mm_add_ps(distance, _mm_mul_ps(cy, _mm_set1_ps(plane[p][1])));
+					distance = _mm_add_ps(distance, _mm_mul_ps(cz, _mm_set1_ps(plane[p][2])));
+					distance = _mm_add_ps(distance, _mm_mul_ps(ex, _mm_set1_ps(plane[p][4])));
+					distance = _mm_add_ps(distance, _mm_mul_ps(ey, _mm_set1_ps(plane[p][5])));
+					distance = _mm_add_ps(distance, _mm_mul_ps(ez, _mm_set1_ps(plane[p][6])));
+					nearest = _mm_min_ps(nearest, distance);
+				}
+
+				int mask = _mm_movemask_ps(_mm_cmpge_ps(nearest, _mm_setzero_ps()));
+				for (int lane = 0; lane < 4; lane++) {
+					visible[i + lane] = (mask >> lane) & 1;
+					numVisible += (mask >> lane) & 1;
+				}
+			}
+#endif
+
+			// Remainder, or everything without SIMD
+			for (; i < count; i++) {
+				float nearest = INFINITY;
+				for (int p = 0; p < 6; p++) {
+					float distance = centerX[i] * plane[p][0] + centerY[i] * plane[p][1] + centerZ[i] * plane[p][2] + plane[p][3]
+						+ extentX[i] * plane[p][4] + extentY[i] * plane[p][5] + extentZ[i] * plane[p][6];
+					nearest = fmin(nearest, distance);
+				}
+				visible[i] = nearest >= 0.0f;
+				numVisible += visible[i];
+			}
+			return numVisible;
+		}
+};
+
+const char *frustumCullingPath() {
+#if defined(FRUSTUM_CULLING_AVX)
+	return "AVX";
+#elif defined(FRUSTUM_CULLING_SSE)
+	return "SSE";
+#else
+	return "scalar";
+#endif
+}
+
+// Time the batched kernel against one isVisible call per box over a random field, and log bounds tested per second
+void benchmarkFrustumCulling(size_t numBoxes = 16384, int iterations = 200) {
+	mt19937 random(1234);
+	uniform_real_distribution<float> position(-100.0f, 100.0f);
+	uniform_real_distribution<float> extent(0.1f, 2.0f);
+
+	vector<BoundingBox> boxes(numBoxes);
+	CullingBatch batch;
+	for (BoundingBox &box : boxes) {
+		box.center = glm::vec3(position(random), position(random), position(random));
+		box.extents = glm::vec3(extent(random), extent(random), extent(random));
+		batch.add(box);
+	}
+
+	// Looking down -z from the middle of the field
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 100.0f);
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	Frustum frustum = extractFrustum(projection * view);
+
+	vector<uint8_t> visible(numBoxes);
+	size_t batchVisible = 0, scalarVisible = 0;
+
+	auto start = chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++) {
+		batchVisible = batch.cull(frustum, visible.data());
+	}
+	auto middle = chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++) {
+		scalarVisible = 0;
+		for (const BoundingBox &box : boxes) {
+			scalarVisible += isVisible(frustum, box);
+		}
+	}
+	auto end = chrono::steady_clock::now();
+
+	double tested = (double)numBoxes * iterations;
+	double batchSeconds = chrono::duration<double>(middle - start).count();
+	double scalarSeconds = chrono::duration<double>(end - middle).count();
+	cout << "Frustum culling: " << numBoxes << " boxes x " << iterations << ", " << batchVisible << " visible" << endl;
+	cout << "  batched (" << frustumCullingPath() << "): " << tested / batchSeconds / 1e6 << " M bounds/s" << endl;
+	cout << "  per box: " << tested / scalarSeconds / 1e6 << " M bounds/s" << endl;
+	if (batchVisible != scalarVisible) {
+		cout << "  MISMATCH: per box path found " << scalarVisible << " visible" << endl;
+	}
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include "glResource.h"
+#include "mesh.h"
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+
+// One vertex buffer, index buffer and vertex array shared by every mesh of a model.
+// Meshes address their slice with a base vertex and first index.
+class GeometryArena {
+	public:
+		GLVertexArray vertexArrayObj;
+		GLBuffer vertexBufferObj, elementBufferObj;
+		GLBuffer instanceBufferObj;
+
+		GeometryArena() {}
+
+		// Owns GL objects, so moves only
+		GeometryArena(const GeometryArena &) = delete;
+		GeometryArena &operator=(const GeometryArena &) = delete;
+		GeometryArena(GeometryArena &&) = default;
+		GeometryArena &operator=(GeometryArena &&) = default;
+
+		// Size both buffers and configure the vertex layout for Vertex or PackedVertex, indices are 16 or 32-bit.
+		// Filled in later with uploadVertices/uploadIndices.
+		void allocate(size_t numVertices, size_t numIndices, bool packedVertices = false, size_t indexSize = sizeof(unsigned int)) {
+			vertexStride = packedVertices ? sizeof(PackedVertex) : sizeof(Vertex);
+			indexStride = indexSize;
+
+			// Create objects
+			vertexArrayObj = GLVertexArray::create();
+			vertexBufferObj = GLBuffer::create();
+			elementBufferObj = GLBuffer::create();
+
+			// Bind first to store state
+			glBindVertexArray(vertexArrayObj);
+
+			// Initialize vertex buffer
+			glBindBuffer(GL_ARRAY_BUFFER, vertexBufferObj);
+			glBufferData(GL_ARRAY_BUFFER, numVertices * vertexStride, NULL, GL_STATIC_DRAW);
+
+			// Initialize index buffer
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBufferObj);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, numIndices * indexStride, NULL, GL_STATIC_DRAW);
+
+			// Configure vertex attributes
+			if (packedVertices) {
+				// Postion, unorm16 scaled by the mesh's bounds in the shader
+				glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (void *)offsetof(PackedVertex, position));
+				glEnableVertexAttribArray(0);
+
+				// Normal, octahedral so only two components
+				glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex), (void *)offsetof(PackedVertex, normal));
+				glEnableVertexAttribArray(1);
+
+				// Texcoords
+				glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (void *)offsetof(PackedVertex, texCoords));
+				glEnableVertexAttribArray(2);
+			} else {
+				// Postion
+				glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)0);
+				glEnableVertexAttribArray(0);
+
+				// Normal
+				glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, normal));
+				glEnableVertexAttribArray(1);
+
+				// Texcoords
+				glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, texCoords));
+				glEnableVertexAttribArray(2);
+			}
+
+			// Unbind
+			glBindVertexArray(0);
+		}
+
+		// Fill part of an allocated arena, lets large models be uploaded over several frames
+		void uploadVertices(size_t firstVertex, const void *vertices, size_t count) {
+			glNamedBufferSubData(vertexBufferObj, firstVertex * vertexStride, count * vertexStride, vertices);
+		}
+
+		void uploadIndices(size_t firstIndex, const void *indices, size_t count) {
+			glNamedBufferSubData(elementBufferObj, firstIndex * indexStride, count * indexStride, indices);
+		}
+
+		// Stream per-instance model matrices into attribute locations 3-6
+		void uploadInstances(const glm::mat4 *transforms, size_t count) {
+			if (instanceBufferObj == 0) {
+				instanceBufferObj = GLBuffer::create();
+
+				glBindVertexArray(vertexArrayObj);
+				glBindBuffer(GL_ARRAY_BUFFER, instanceBufferObj);
+
+				// A mat4 attribute takes one location per column
+				for (unsigned int column = 0; column < 4; column++) {
+					glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void *)(column * sizeof(glm::vec4)));
+					glEnableVertexAttribArray(3 + column);
+					glVertexAttribDivisor(3 + column, 1); // Advance once per instance
+				}
+
+				glBindVertexArray(0);
+			}
+
+			// Orphan the old storage so the driver doesn't wait on draws still reading it
+			if (count > instanceCapacity) {
+				instanceCapacity = count;
+			}
+			glNamedBufferData(instanceBufferObj, instanceCapacity * sizeof(glm::mat4), NULL, GL_STREAM_DRAW);
+			glNamedBufferSubData(instanceBufferObj, 0, count * sizeof(glm::mat4), transforms);
+		}
+
+		void bind() const {
+			glBindVertexArray(vertexArrayObj);
+		}
+
+		// Bytes per vertex, depends on the format given to allocate()
+		size_t stride() const {
+			return vertexStride;
+		}
+
+	private:
+		size_t vertexStride = sizeof(Vertex);
+		size_t indexStride = sizeof(unsigned int);
+		size_t instanceCapacity = 0;
+};
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <glad/glad.h>
+
+// Move-only owner of one GL object name. Converts to the raw name so it drops into gl* calls.
+template <typename Traits>
+class GLObject {
+	public:
+		GLObject() {}
+
+		// Take ownership of an existing name
+		explicit GLObject(unsigned int id) : id(id) {}
+
+		~GLObject() {
+			reset();
+		}
+
+		GLObject(const GLObject &) = delete;
+		GLObject &operator=(const GLObject &) = delete;
+
+		GLObject(GLObject &&other) noexcept : id(other.release()) {}
+
+		GLObject &operator=(GLObject &&other) noexcept {
+			if (this != &other) {
+				reset(other.release());
+			}
+			return *this;
+		}
+
+		// Arguments go to Traits::create, e.g. a texture's target
+		template <typename... Args>
+		static GLObject create(Args... args) {
+			return GLObject(Traits::create(args...));
+		}
+
+		unsigned int get() const {
+			return id;
+		}
+
+		operator unsigned int() const {
+			return id;
+		}
+
+		// Give up ownership without deleting
+		unsigned int release() {
+			unsigned int released = id;
+			id = 0;
+			return released;
+		}
+
+		// Delete the current object and optionally adopt another
+		void reset(unsigned int newID = 0) {
+			if (id != 0) {
+				Traits::destroy(id);
+			}
+			id = newID;
+		}
+
+	private:
+		unsigned int id = 0;
+};
+
+struct GLBufferTraits {
+	static unsigned int create() {
+		unsigned int id;
+		glCreateBuffers(1, &id);
+		return id;
+	}
+
+	static void destroy(unsigned int id) {
+		glDeleteBuffers(1, &id);
+	}
+};
+
+struct GLVertexArrayTraits {
+	static unsigned int create() {
+		unsigned int id;
+		glCreateVertexArrays(1, &id);
+		return id;
+	}
+
+	static void destroy(unsigned int id) {
+		glDeleteVertexArrays(1, &id);
+	}
+};
+
+struct GLTextureTraits {
+	static unsigned int create(GLenum target = GL_TEXTURE_2D) {
+		unsigned int id;
+		glCreateTextures(target, 1, &id);
+		return id;
+	}
+
+	static void destroy(unsigned int id) {
+		glDeleteTextures(1, &id);
+	}
+};
+
+struct GLProgramTraits {
+	static unsigned int create() {
+		return glCreateProgram();
+	}
+
+	static void destroy(unsigned int id) {
+		glDeleteProgram(id);
+	}
+};
+
+typedef GLObject<GLBufferTraits> GLBuffer;
+typedef GLObject<GLVertexArrayTraits> GLVertexArray;
+typedef GLObject<GLTextureTraits> GLTexture;
+typedef GLObject<GLProgramTraits> GLProgram;
@@ -0,0 +1,249 @@
+#pragma once
+
+#include "geometryArena.h"
+#include "glResource.h"
+#include "mesh.h"
+#include "renderStats.h"
+#include "shader.h"
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Storage buffer binding point for per-draw materials (see modelIndirectShader.vs)
+const unsigned int MATERIAL_STORAGE_BINDING = 5;
+
+// Storage buffer binding point for scene graph world matrices, indexed by DrawMaterial.node
+const unsigned int NODE_STORAGE_BINDING = 6;
+
+// Must match MAX_TEXTURES in modelIndirectShader.fs. Every texture of the model is bound at once, so models using more
+// can't take the multi-draw path, Model::canDrawIndirect() is false for them and the caller draws them per mesh.
+const unsigned int MAX_INDIRECT_TEXTURES = 16;
+
+// Layout defined by glMultiDrawElementsIndirect
+struct DrawElementsIndirectCommand {
+	unsigned int count;
+	unsigned int instanceCount;
+	unsigned int firstIndex;
+	int baseVertex;
+	unsigned int baseInstance;
+};
+
+// std430 per-draw material (DrawMaterial in the shader)
+struct IndirectMaterial {
+	// Indices into the modelTextures sampler array (-1 for none)
+	int diffuse;
+	int specular;
+	int node; // Scene graph node placing the mesh
+	int pad0;
+
+	// Mesh's PackedVertex dequantization, identity for float vertices. w of the offset flags packed normals.
+	glm::vec4 positionOffset;
+	glm::vec4 positionScale;
+};
+
+static_assert(offsetof(IndirectMaterial, positionOffset) == 16, "DrawMaterial layout mismatch");
+static_assert(sizeof(IndirectMaterial) == 48, "DrawMaterial layout mismatch");
+
+// Whole-model submission with one glMultiDrawElementsIndirect, materials looked up by gl_DrawID
+class IndirectDrawList {
+	public:
+		GLBuffer commandBufferID, materialBufferID, nodeBufferID;
+
+		IndirectDrawList() {}
+
+		// Returns false for no meshes, and logs why if the meshes use more textures than the sampler table holds
+		bool build(const vector<Mesh> &meshes) {
+			if (meshes.empty()) {
+				return false;
+			}
+			commands.clear();
+			materials.clear();
+			textureIDs.clear();
+			numTriangles = 0;
+			indexType = !meshes.empty() && meshes[0].shortIndices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+
+			for (const Mesh &mesh : meshes) {
+				DrawElementsIndirectCommand command;
+				command.count = mesh.indexCount;
+				command.instanceCount = 1;
+				command.firstIndex = mesh.firstIndex;
+				command.baseVertex = (int)mesh.baseVertex;
+				command.baseInstance = 0;
+				commands.push_back(command);
+				numTriangles += mesh.indexCount / 3;
+
+				// First diffuse and specular map, matching texture_diffuse1 / texture_specular1
+				IndirectMaterial material = { -1, -1, (int)mesh.node, 0, glm::vec4(mesh.positionOffset, mesh.packedVertices ? 1.0f : 0.0f), glm::vec4(mesh.positionScale, 1.0f) };
+				for (const Texture &texture : mesh.textures) {
+					if (texture.type == "texture_diffuse" && material.diffuse < 0) {
+						material.diffuse = textureSlot(texture.id);
+					} else if (texture.type == "texture_specular" && material.specular < 0) {
+						material.specular = textureSlot(texture.id);
+					}
+				}
+				materials.push_back(material);
+			}
+
+			if (textureIDs.size() > MAX_INDIRECT_TEXTURES) {
+				cout << "Indirect drawing takes at most " << MAX_INDIRECT_TEXTURES << " textures per model, this one has " << textureIDs.size() << ", drawing it per mesh" << endl;
+				return false;
+			}
+
+			// Upload commands and materials once, they only change when the model does
+			commandBufferID = GLBuffer::create();
+			glNamedBufferStorage(commandBufferID, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data(), 0);
+			materialBufferID = GLBuffer::create();
+			glNamedBufferStorage(materialBufferID, materials.size() * sizeof(IndirectMaterial), materials.data(), 0);
+			return true;
+		}
+
+		// Node world matrices, re-uploaded whenever the scene graph moves
+		void updateNodes(const vector<glm::mat4> &world) {
+			if (nodeBufferID == 0) {
+				nodeBufferID = GLBuffer::create();
+			}
+			glNamedBufferData(nodeBufferID, world.size() * sizeof(glm::mat4), world.data(), GL_DYNAMIC_DRAW);
+		}
+
+		bool empty() const {
+			return commands.empty();
+		}
+
+		// Expects the model's geometry arena to be bound
+		void submit(Shader &shader) {
+			// Sampler table, one unit per unique texture
+			if (samplerShaderID != shader.ID) {
+				for (unsigned int i = 0; i < MAX_INDIRECT_TEXTURES; i++) {
+					shader.setInt("modelTextures[" + to_string(i) + "]", i);
+				}
+				samplerShaderID = shader.ID;
+			}
+			for (unsigned int i = 0; i < textureIDs.size(); i++) {
+				glActiveTexture(GL_TEXTURE0 + i);
+				glBindTexture(GL_TEXTURE_2D, textureIDs[i]);
+			}
+			renderStats().textureBinds += (unsigned int)textureIDs.size();
+			glActiveTexture(GL_TEXTURE0);
+
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MATERIAL_STORAGE_BINDING, materialBufferID);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, NODE_STORAGE_BINDING, nodeBufferID);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBufferID);
+			glMultiDrawElementsIndirect(GL_TRIANGLES, indexType, (void *)0, (int)commands.size(), 0);
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+			RenderStats &stats = renderStats();
+			stats.drawCalls++;
+			stats.drawCommands += (unsigned int)commands.size();
+			stats.triangles += numTriangles;
+			stats.fullDetailTriangles += numTriangles;
+		}
+
+	private:
+		vector<DrawElementsIndirectCommand> commands;
+		vector<IndirectMaterial> materials;
+		vector<unsigned int> textureIDs;
+		unsigned long long numTriangles = 0;
+		unsigned int samplerShaderID = 0;
+		unsigned int indexType = GL_UNSIGNED_INT; // The whole arena uses one index size
+
+		int textureSlot(unsigned int id) {
+			for (unsigned int i = 0; i < textureIDs.size(); i++) {
+				if (textureIDs[i] == id) {
+					return (int)i;
+				}
+			}
+			textureIDs.push_back(id);
+			return (int)textureIDs.size() - 1;
+		}
+};
+
+// Draw a synthetic scene of numMeshes quads, each sampling one of 8 textures, once per mesh and as one multi-draw, and
+// log CPU submission time, time to GPU completion, draw calls and texture binds per frame for both. Needs a current
+// context, the per-mesh shader (modelShader) and the multi-draw one (modelIndirectShader).
+void benchmarkIndirectDrawing(Shader &meshShader, Shader &indirectShader, unsigned int numMeshes = 10000, int frames = 100) {
+	// 1x1 textures, enough to make the per-mesh path rebind
+	const unsigned int numTextures = 8;
+	vector<GLTexture> textures;
+	for (unsigned int i = 0; i < numTextures; i++) {
+		textures.push_back(GLTexture::create());
+		unsigned char color[4] = { (unsigned char)(i * 32), 128, (unsigned char)(255 - i * 32), 255 };
+		glTextureStorage2D(textures[i], 1, GL_RGBA8, 1, 1);
+		glTextureSubImage2D(textures[i], 0, 0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, color);
+	}
+
+	// Grid of quads covering [-1, 1] in x and y, all placed by node 0
+	vector<Vertex> vertices;
+	vector<unsigned int> indices;
+	vector<Mesh> meshes;
+	unsigned int columns = (unsigned int)ceil(sqrt((float)numMeshes));
+	float size = 2.0f / columns;
+	for (unsigned int i = 0; i < numMeshes; i++) {
+		glm::vec3 corner(-1.0f + (i % columns) * size, -1.0f + (i / columns) * size, 0.0f);
+		Mesh mesh((unsigned int)vertices.size(), (unsigned int)indices.size(), 6, { { textures[i % numTextures], "texture_diffuse", "" } });
+		mesh.vertexCount = 4;
+		for (unsigned int v = 0; v < 4; v++) {
+			glm::vec2 uv((float)(v & 1), (float)(v >> 1));
+			vertices.push_back({ corner + glm::vec3(uv * size * 0.9f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f), uv });
+		}
+		for (unsigned int index : { 0u, 1u, 3u, 0u, 3u, 2u }) {
+			indices.push_back(index);
+		}
+		meshes.push_back(move(mesh));
+	}
+
+	GeometryArena arena;
+	arena.allocate(vertices.size(), indices.size());
+	arena.uploadVertices(0, vertices.data(), vertices.size());
+	arena.uploadIndices(0, indices.data(), indices.size());
+
+	IndirectDrawList indirect;
+	if (!indirect.build(meshes)) {
+		return;
+	}
+	indirect.updateNodes(vector<glm::mat4>(1, glm::mat4(1.0f)));
+
+	cout << "Indirect drawing benchmark: " << numMeshes << " meshes, " << numTextures << " textures, " << frames << " frames" << endl;
+	for (int multiDraw = 0; multiDraw < 2; multiDraw++) {
+		Shader &shader = multiDraw ? indirectShader : meshShader;
+		int modelLocation = shader.getLocation("model");
+		shader.use();
+		shader.setMat4(modelLocation, glm::mat4(1.0f));
+
+		double submitMs = 0.0;
+		glFinish();
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (int frame = 0; frame < frames; frame++) {
+			renderStats().reset();
+			chrono::steady_clock::time_point submitStart = chrono::steady_clock::now();
+			arena.bind();
+			if (multiDraw) {
+				indirect.submit(shader);
+			} else {
+				// As Model::draw, which places each mesh by its node
+				for (Mesh &mesh : meshes) {
+					shader.setMat4(modelLocation, glm::mat4(1.0f));
+					mesh.draw(shader);
+				}
+			}
+			glBindVertexArray(0);
+			submitMs += chrono::duration<double, milli>(chrono::steady_clock::now() - submitStart).count();
+		}
+		glFinish();
+		double frameMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / frames;
+
+		const RenderStats &stats = renderStats();
+		cout << "  " << (multiDraw ? "multi-draw:" : "per mesh:  ") << " " << submitMs / frames << " ms submitting, " << frameMs << " ms per frame to GPU completion, "
+			<< stats.drawCalls << " draw calls and " << stats.textureBinds << " texture binds per frame" << endl;
+	}
+	renderStats().reset();
+}
@@ -0,0 +1,302 @@
+#pragma once
+
+#include "benchmark.h"
+#include "glResource.h"
+#include "lightSet.h"
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <utility>
+#include <vector>
+
+// Storage buffer binding points for cluster light lists (see lightingShader.fs)
+const unsigned int CLUSTER_RANGE_STORAGE_BINDING = 3;
+const unsigned int CLUSTER_INDEX_STORAGE_BINDING = 4;
+
+// Slice of the light index list belonging to one cluster
+struct ClusterRange {
+	unsigned int offset;
+	unsigned int count;
+};
+
+// Bins point lights into view-space froxels: screen tiles split into exponential depth slices.
+// Binning runs on the CPU and the result is uploaded as two storage buffers.
+class LightClusters {
+	public:
+		unsigned int tilesX, tilesY, slices;
+
+		LightClusters(unsigned int tilesX = 16, unsigned int tilesY = 9, unsigned int slices = 24) : tilesX(tilesX), tilesY(tilesY), slices(slices) {
+			ranges.resize(numClusters());
+		}
+
+		unsigned int numClusters() const {
+			return tilesX * tilesY * slices;
+		}
+
+		// Matches the cluster lookup in lightingShader.fs
+		unsigned int clusterIndex(unsigned int x, unsigned int y, unsigned int z) const {
+			return x + tilesX * (y + tilesY * z);
+		}
+
+		unsigned int depthSlice(float depth) const {
+			float slice = std::log(depth / zNear) / std::log(zFar / zNear) * slices;
+			return (unsigned int)std::clamp(slice, 0.0f, (float)slices - 1.0f);
+		}
+
+		// Rebuild cluster bounds for a symmetric perspective projection
+		void setProjection(float fovY, float aspect, float zNear, float zFar) {
+			this->zNear = zNear;
+			this->zFar = zFar;
+			tanHalfY = std::tan(fovY * 0.5f);
+			tanHalfX = tanHalfY * aspect;
+
+			clusterMin.resize(numClusters());
+			clusterMax.resize(numClusters());
+			for (unsigned int z = 0; z < slices; z++) {
+				float nearDepth = zNear * std::pow(zFar / zNear, (float)z / slices);
+				float farDepth  = zNear * std::pow(zFar / zNear, (float)(z + 1) / slices);
+
+				for (unsigned int y = 0; y < tilesY; y++) {
+					float ndcY0 = -1.0f + 2.0f * y / tilesY;
+					float ndcY1 = -1.0f + 2.0f * (y + 1) / tilesY;
+
+					for (unsigned int x = 0; x < tilesX; x++) {
+						float ndcX0 = -1.0f + 2.0f * x / tilesX;
+						float ndcX1 = -1.0f + 2.0f * (x + 1) / tilesX;
+
+						// Frustum-shaped cluster, so the extremes sit on either its near or far face
+						glm::vec3 corners[4] = {
+							glm::vec3(ndcX0 * tanHalfX * nearDepth, ndcY0 * tanHalfY * nearDepth, -nearDepth),
+							glm::vec3(ndcX1 * tanHalfX * nearDepth, ndcY1 * tanHalfY * nearDepth, -nearDepth),
+							glm::vec3(ndcX0 * tanHalfX * farDepth,  ndcY0 * tanHalfY * farDepth,  -farDepth),
+							glm::vec3(ndcX1 * tanHalfX * farDepth,  ndcY1 * tanHalfY * farDepth,  -farDepth)
+						};
+
+						unsigned int cluster = clusterIndex(x, y, z);
+						clusterMin[cluster] = glm::min(glm::min(corners[0], corners[1]), glm::min(corners[2], corners[3]));
+						clusterMax[cluster] = glm::max(glm::max(corners[0], corners[1]), glm::max(corners[2], corners[3]));
+					}
+				}
+			}
+		}
+
+		// CPU reference binner, fills ranges() and indices()
+		void build(const PointLight *lights, unsigned int numLights, const glm::mat4 &view) {
+			pairs.clear();
+			for (unsigned int i = 0; i < numLights; i++) {
+				glm::vec3 center = glm::vec3(view * glm::vec4(lights[i].position, 1.0f));
+				float radius = lights[i].radius;
+				float depth = -center.z;
+
+				if (depth + radius < zNear || depth - radius > zFar) {
+					continue;
+				}
+
+				// Lights without falloff touch every cluster
+				unsigned int x0 = 0, x1 = tilesX - 1;
+				unsigned int y0 = 0, y1 = tilesY - 1;
+				unsigned int z0 = 0, z1 = slices - 1;
+				if (std::isfinite(radius)) {
+					float nearDepth = std::max(depth - radius, zNear);
+					float farDepth  = std::min(depth + radius, zFar);
+					z0 = depthSlice(nearDepth);
+					z1 = depthSlice(farDepth);
+
+					// Screen-space extent of the sphere's view-space box, x / depth is monotonic so the endpoints bound it
+					tileRange(center.x, radius, nearDepth, farDepth, tanHalfX, tilesX, x0, x1);
+					tileRange(center.y, radius, nearDepth, farDepth, tanHalfY, tilesY, y0, y1);
+				}
+
+				for (unsigned int z = z0; z <= z1; z++) {
+					for (unsigned int y = y0; y <= y1; y++) {
+						for (unsigned int x = x0; x <= x1; x++) {
+							unsigned int cluster = clusterIndex(x, y, z);
+							if (sphereTouchesCluster(center, radius, cluster)) {
+								pairs.push_back(std::make_pair(cluster, i));
+							}
+						}
+					}
+				}
+			}
+
+			// Counting sort the (cluster, light) pairs into per-cluster lists
+			for (ClusterRange &range : ranges) {
+				range.count = 0;
+			}
+			for (const std::pair<unsigned int, unsigned int> &pair : pairs) {
+				ranges[pair.first].count++;
+			}
+
+			unsigned int offset = 0;
+			for (ClusterRange &range : ranges) {
+				range.offset = offset;
+				offset += range.count;
+				range.count = 0;
+			}
+
+			lightIndices.resize(pairs.size());
+			for (const std::pair<unsigned int, unsigned int> &pair : pairs) {
+				ClusterRange &range = ranges[pair.first];
+				lightIndices[range.offset + range.count++] = pair.second;
+			}
+		}
+
+		const std::vector<ClusterRange> &clusterRanges() const {
+			return ranges;
+		}
+
+		const std::vector<unsigned int> &indices() const {
+			return lightIndices;
+		}
+
+		// Send the latest binning to the storage buffers, must run on the context thread
+		void upload() {
+			if (rangeBufferID == 0) {
+				rangeBufferID = GLBuffer::create();
+				glNamedBufferData(rangeBufferID, ranges.size() * sizeof(ClusterRange), NULL, GL_DYNAMIC_DRAW);
+				glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_RANGE_STORAGE_BINDING, rangeBufferID);
+				indexBufferID = GLBuffer::create();
+			}
+			glNamedBufferSubData(rangeBufferID, 0, ranges.size() * sizeof(ClusterRange), ranges.data());
+
+			// Index list size varies per frame, grow only
+			if (lightIndices.size() > indexCapacity || indexCapacity == 0) {
+				indexCapacity = std::max<size_t>(lightIndices.size() * 2, 1024);
+				glNamedBufferData(indexBufferID, indexCapacity * sizeof(unsigned int), NULL, GL_DYNAMIC_DRAW);
+				glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_INDEX_STORAGE_BINDING, indexBufferID);
+			}
+			glNamedBufferSubData(indexBufferID, 0, lightIndices.size() * sizeof(unsigned int), lightIndices.data());
+		}
+
+	private:
+		float zNear = 0.1f, zFar = 100.0f;
+		float tanHalfX = 1.0f, tanHalfY = 1.0f;
+
+		// View-space bounds per cluster
+		std::vector<glm::vec3> clusterMin, clusterMax;
+
+		std::vector<ClusterRange> ranges;
+		std::vector<unsigned int> lightIndices;
+		std::vector<std::pair<unsigned int, unsigned int>> pairs;
+
+		GLBuffer rangeBufferID, indexBufferID;
+		size_t indexCapacity = 0;
+
+		static void tileRange(float center, float radius, float nearDepth, float farDepth, float tanHalf, unsigned int numTiles, unsigned int &first, unsigned int &last) {
+			float ndc[4] = {
+				(center - radius) / (nearDepth * tanHalf),
+				(center - radius) / (farDepth * tanHalf),
+				(center + radius) / (nearDepth * tanHalf),
+				(center + radius) / (farDepth * tanHalf)
+			};
+			float ndcMin = std::min(std::min(ndc[0], ndc[1]), std::min(ndc[2], ndc[3]));
+			float ndcMax = std::max(std::max(ndc[0], ndc[1]), std::max(ndc[2], ndc[3]));
+
+			first = (unsigned int)std::clamp((ndcMin + 1.0f) * 0.5f * numTiles, 0.0f, numTiles - 1.0f);
+			last  = (unsigned int)std::clamp((ndcMax + 1.0f) * 0.5f * numTiles, 0.0f, numTiles - 1.0f);
+		}
+
+		bool sphereTouchesCluster(const glm::vec3 &center, float radius, unsigned int cluster) const {
+			if (!std::isfinite(radius)) {
+				return true;
+			}
+			glm::vec3 closest = glm::clamp(center, clusterMin[cluster], clusterMax[cluster]);
+			glm::vec3 offset = center - closest;
+			return glm::dot(offset, offset) <= radius * radius;
+		}
+};
+
+// Time build() on 1k to 100k lights in front of the camera and check it against the lookup lightingShader.fs does:
+// points sampled inside each light's sphere must find the light in the cluster clusterIndex() picks for them there, and
+// the shader's depth slice formula must agree with depthSlice().
+bool benchmarkLightClusters(unsigned int maxLights = 100000, int iterations = 10) {
+	BenchmarkChecks checks("Light cluster benchmark");
+	const float fovY = glm::radians(45.0f), aspect = 16.0f / 9.0f, zNear = 0.1f, zFar = 100.0f;
+	LightClusters clusters;
+	clusters.setProjection(fovY, aspect, zNear, zFar);
+	float tanHalfY = std::tan(fovY * 0.5f), tanHalfX = tanHalfY * aspect;
+
+	// CPU copy of clusterIndex() in lightingShader.fs for a view-space point, false when it's off screen
+	auto shaderCluster = [&](const glm::vec3 &point, unsigned int &cluster) {
+		float depth = -point.z;
+		glm::vec2 ndc = glm::vec2(point.x / (depth * tanHalfX), point.y / (depth * tanHalfY));
+		if (depth < zNear || depth > zFar || std::abs(ndc.x) >= 1.0f || std::abs(ndc.y) >= 1.0f) {
+			return false;
+		}
+		unsigned int tileX = std::min((unsigned int)((ndc.x + 1.0f) * 0.5f * clusters.tilesX), clusters.tilesX - 1);
+		unsigned int tileY = std::min((unsigned int)((ndc.y + 1.0f) * 0.5f * clusters.tilesY), clusters.tilesY - 1);
+		float slice = std::log(depth / zNear) / std::log(zFar / zNear) * (float)clusters.slices;
+		unsigned int z = (unsigned int)std::clamp(slice, 0.0f, (float)(clusters.slices - 1));
+		cluster = tileX + clusters.tilesX * (tileY + clusters.tilesY * z);
+		return true;
+	};
+
+	// Slice lookups agree over the whole range, including just past either end
+	bool slicesMatch = true;
+	for (int i = 0; i <= 10000; i++) {
+		float depth = zNear * 0.5f * std::pow(zFar * 2.0f / (zNear * 0.5f), i / 10000.0f);
+		unsigned int cluster;
+		glm::vec3 point(0.0f, 0.0f, -depth);
+		if (shaderCluster(point, cluster)) {
+			unsigned int x = clusters.tilesX / 2, y = clusters.tilesY / 2;
+			slicesMatch = slicesMatch && cluster == clusters.clusterIndex(x, y, clusters.depthSlice(depth));
+		}
+	}
+	checks.check("depthSlice matches the shader's slice", slicesMatch);
+
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	std::cout << "Light cluster benchmark: " << clusters.tilesX << "x" << clusters.tilesY << "x" << clusters.slices << " clusters" << std::endl;
+	for (unsigned int numLights = 1000; numLights <= maxLights; numLights *= 10) {
+		// Spread evenly through the view frustum past the first unit, radii of 0.5 to 2 units set through the quadratic term
+		std::vector<PointLight> lights(numLights);
+		for (PointLight &light : lights) {
+			float depth = 1.0f + (zFar - 1.0f) * unit(random);
+			light.position = glm::vec3((unit(random) * 2.4f - 1.2f) * tanHalfX * depth, (unit(random) * 2.4f - 1.2f) * tanHalfY * depth, -depth);
+			light.ambient = glm::vec3(0.0f);
+			light.diffuse = light.specular = glm::vec3(1.0f);
+			float radius = 0.5f + 1.5f * unit(random);
+			light.constant = 1.0f;
+			light.linear = 0.0f;
+			light.quadratic = (256.0f / 5.0f - 1.0f) / (radius * radius);
+			light.radius = pointLightRadius(light);
+		}
+
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int i = 0; i < iterations; i++) {
+			clusters.build(lights.data(), numLights, glm::mat4(1.0f));
+		}
+		double buildMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / iterations;
+
+		// Sample up to 500 lights, 64 points inside each, denser towards the surface
+		const std::vector<ClusterRange> &ranges = clusters.clusterRanges();
+		const std::vector<unsigned int> &indices = clusters.indices();
+		unsigned int stride = std::max(numLights / 500, 1u);
+		size_t samples = 0, missing = 0;
+		for (unsigned int i = 0; i < numLights; i += stride) {
+			for (int s = 0; s < 64; s++) {
+				glm::vec3 direction = glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) * 2.0f - 1.0f + 1e-4f);
+				glm::vec3 point = lights[i].position + direction * lights[i].radius * 0.999f * std::cbrt(unit(random));
+				unsigned int cluster;
+				if (!shaderCluster(point, cluster)) {
+					continue;
+				}
+				const ClusterRange &range = ranges[cluster];
+				samples++;
+				missing += std::find(indices.begin() + range.offset, indices.begin() + range.offset + range.count, i) == indices.begin() + range.offset + range.count;
+			}
+		}
+		checks.check("every light reaching a cluster is listed in it", missing == 0);
+
+		std::cout << "  " << numLights << " lights: build " << buildMs << " ms, " << indices.size() << " light entries, "
+			<< (double)indices.size() / clusters.numClusters() << " per cluster, " << missing << " of " << samples << " sampled points missed their light" << std::endl;
+	}
+	return checks.report();
+}
@@ -1,9 +1,14 @@
 #version 460 core
 layout (location = 0) in vec3 aPos;
 
+// Per-frame camera data shared by all shaders
+layout (std140, binding = 0) uniform FrameData {
+	mat4 projection;
+	mat4 view;
+	vec3 viewPos;
+};
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 
 void main() {
     gl_Position = projection * view * model * vec4(aPos, 1.0f);
@@ -0,0 +1,300 @@
+#pragma once
+
+#include "benchmark.h"
+#include "glResource.h"
+#include "shader.h"
+#include "uniformBuffers.h"
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// Storage buffer binding point for point lights (see "layout (std430, binding = 2)")
+const unsigned int POINT_LIGHT_STORAGE_BINDING = 2;
+
+// std430 mirror of PointLight in lightingShader.fs, scalars fill the vec3 tails so each light is 64 bytes
+struct PointLight {
+	glm::vec3 position;
+	float constant;
+	glm::vec3 ambient;
+	float linear;
+	glm::vec3 diffuse;
+	float quadratic;
+	glm::vec3 specular;
+	float radius; // Filled in by LightSet from the attenuation coeffs
+};
+
+static_assert(offsetof(PointLight, constant) == 12, "PointLight layout mismatch");
+static_assert(offsetof(PointLight, ambient) == 16, "PointLight layout mismatch");
+static_assert(offsetof(PointLight, linear) == 28, "PointLight layout mismatch");
+static_assert(offsetof(PointLight, diffuse) == 32, "PointLight layout mismatch");
+static_assert(offsetof(PointLight, quadratic) == 44, "PointLight layout mismatch");
+static_assert(offsetof(PointLight, specular) == 48, "PointLight layout mismatch");
+static_assert(offsetof(PointLight, radius) == 60, "PointLight layout mismatch");
+static_assert(sizeof(PointLight) == 64, "PointLight layout mismatch");
+
+// Distance at which the brightest channel falls below 5/256 intensity
+float pointLightRadius(const PointLight &light) {
+	glm::vec3 peak = glm::max(glm::max(light.ambient, light.diffuse), light.specular);
+	float maxChannel = std::max(std::max(peak.r, peak.g), peak.b);
+
+	// Solve constant + linear * d + quadratic * d^2 = maxChannel * 256 / 5
+	float target = maxChannel * 256.0f / 5.0f;
+	if (light.quadratic > 0.0f) {
+		float discriminant = light.linear * light.linear - 4.0f * light.quadratic * (light.constant - target);
+		return (-light.linear + std::sqrt(std::max(discriminant, 0.0f))) / (2.0f * light.quadratic);
+	}
+	if (light.linear > 0.0f) {
+		return std::max((target - light.constant) / light.linear, 0.0f);
+	}
+	return INFINITY; // No falloff
+}
+
+// Tightly packed point lights mirrored into a storage buffer, only modified ranges are re-uploaded
+class LightSet {
+	public:
+		GLBuffer ID;
+
+		unsigned int add(const PointLight &light) {
+			lights.push_back(light);
+			lights.back().radius = pointLightRadius(light);
+			markDirty((unsigned int)lights.size() - 1);
+			return (unsigned int)lights.size() - 1;
+		}
+
+		void set(unsigned int index, const PointLight &light) {
+			lights[index] = light;
+			lights[index].radius = pointLightRadius(light);
+			markDirty(index);
+		}
+
+		// Swap-remove keeps the array packed, the last light takes the removed index
+		void remove(unsigned int index) {
+			if (index >= lights.size()) {
+				return;
+			}
+			lights[index] = lights.back();
+			lights.pop_back();
+			if (index < lights.size()) {
+				markDirty(index);
+			}
+		}
+
+		const PointLight &get(unsigned int index) const {
+			return lights[index];
+		}
+
+		unsigned int size() const {
+			return (unsigned int)lights.size();
+		}
+
+		const PointLight *data() const {
+			return lights.data();
+		}
+
+		// Sync the storage buffer with the CPU copy, must run on the context thread
+		void upload() {
+			// Grow geometrically and resend everything when the buffer is too small
+			if (lights.size() > capacity || ID == 0) {
+				capacity = std::max<size_t>(std::max<size_t>(capacity * 2, lights.size()), 16);
+
+				ID = GLBuffer::create();
+				glNamedBufferStorage(ID, capacity * sizeof(PointLight), NULL, GL_DYNAMIC_STORAGE_BIT);
+				glBindBufferBase(GL_SHADER_STORAGE_BUFFER, POINT_LIGHT_STORAGE_BINDING, ID);
+
+				dirtyBegin = 0;
+				dirtyEnd = lights.size();
+			}
+
+			dirtyEnd = std::min(dirtyEnd, lights.size());
+			if (dirtyBegin < dirtyEnd) {
+				glNamedBufferSubData(ID, dirtyBegin * sizeof(PointLight), (dirtyEnd - dirtyBegin) * sizeof(PointLight), &lights[dirtyBegin]);
+				uploadedBytes += (dirtyEnd - dirtyBegin) * sizeof(PointLight);
+			}
+
+			dirtyBegin = dirtyEnd = 0;
+		}
+
+		// Sent by every upload() so far
+		size_t bytesUploaded() const {
+			return uploadedBytes;
+		}
+
+	private:
+		std::vector<PointLight> lights;
+		size_t capacity = 0;
+		size_t uploadedBytes = 0;
+
+		// Single [begin, end) range covering every modified light
+		size_t dirtyBegin = 0;
+		size_t dirtyEnd = 0;
+
+		void markDirty(size_t index) {
+			if (dirtyBegin == dirtyEnd) {
+				dirtyBegin = index;
+				dirtyEnd = index + 1;
+			} else {
+				dirtyBegin = std::min(dirtyBegin, index);
+				dirtyEnd = std::max(dirtyEnd, index + 1);
+			}
+		}
+};
+
+// Sweep light counts in the current context: time adding the lights and their first upload, moving the first 1% of
+// them and re-uploading every frame, and a lightingShader pass lighting a 64x64 quad with every light. Logs the bytes
+// the dirty range re-sends against resending the whole set. Checks each radius is where the attenuation hits the cutoff,
+// that the storage buffer holds the CPU copy and that swap-remove keeps the set packed.
+bool benchmarkLightSet(Shader &lightingShader, unsigned int maxLights = 65536, int frames = 100, int shadingPasses = 5) {
+	BenchmarkChecks checks("Light set benchmark");
+
+	// Attenuation presets from 7 to 100 units of range
+	const float attenuation[4][2] = { { 0.7f, 1.8f }, { 0.22f, 0.2f }, { 0.09f, 0.032f }, { 0.045f, 0.0075f } };
+	auto makeLight = [&attenuation](unsigned int i, float time) {
+		PointLight light;
+		float angle = i * 2.399963f + time; // Golden angle spiral
+		float distance = std::sqrt((float)i) * 0.5f;
+		light.position = glm::vec3(std::cos(angle) * distance, 1.0f + (i % 7) * 0.5f, std::sin(angle) * distance);
+		light.constant = 1.0f;
+		light.linear = attenuation[i % 4][0];
+		light.quadratic = attenuation[i % 4][1];
+		light.ambient = glm::vec3(0.05f);
+		light.diffuse = glm::vec3(0.8f, 0.7f, 0.6f);
+		light.specular = glm::vec3(1.0f);
+		return light;
+	};
+
+	// Identity camera, so the quad fills the viewport facing +z
+	UniformBuffer<FrameUniforms> frameUniforms(FRAME_UNIFORM_BINDING);
+	FrameUniforms frame = {};
+	frame.projection = frame.view = glm::mat4(1.0f);
+	frame.viewPos = glm::vec3(0.0f, 0.0f, 1.0f);
+	frameUniforms.update(frame);
+
+	UniformBuffer<LightUniforms> lightUniforms(LIGHT_UNIFORM_BINDING);
+	LightUniforms lights = {};
+	lights.dirLight.direction = glm::vec3(-0.2f, -1.0f, -0.3f);
+	lights.spotlight.direction = glm::vec3(0.0f, 0.0f, -1.0f);
+	lights.spotlight.cutoff = std::cos(glm::radians(12.5f));
+	lights.spotlight.outerCutoff = std::cos(glm::radians(15.0f));
+	lights.spotlight.constant = 1.0f;
+
+	// Quad in the Vertex layout lightingShader.vs reads: position, normal, texcoords
+	const float quad[] = {
+		-1.0f, -1.0f, 0.0f,  0.0f, 0.0f, 1.0f,  0.0f, 0.0f,
+		 1.0f, -1.0f, 0.0f,  0.0f, 0.0f, 1.0f,  1.0f, 0.0f,
+		 1.0f,  1.0f, 0.0f,  0.0f, 0.0f, 1.0f,  1.0f, 1.0f,
+		-1.0f,  1.0f, 0.0f,  0.0f, 0.0f, 1.0f,  0.0f, 1.0f
+	};
+	GLVertexArray quadArray = GLVertexArray::create();
+	GLBuffer quadBuffer = GLBuffer::create();
+	glBindVertexArray(quadArray);
+	glBindBuffer(GL_ARRAY_BUFFER, quadBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+	const unsigned int offsets[3] = { 0, 3, 6 };
+	for (unsigned int attribute = 0; attribute < 3; attribute++) {
+		glVertexAttribPointer(attribute, attribute == 2 ? 2 : 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void *)(offsets[attribute] * sizeof(float)));
+		glEnableVertexAttribArray(attribute);
+	}
+	glBindVertexArray(0);
+
+	// 1x1 white diffuse and specular maps
+	GLTexture white = GLTexture::create();
+	unsigned char color[4] = { 255, 255, 255, 255 };
+	glTextureStorage2D(white, 1, GL_RGBA8, 1, 1);
+	glTextureSubImage2D(white, 0, 0, 0, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, color);
+
+	lightingShader.use();
+	lightingShader.setMat4("model", glm::mat4(1.0f));
+	lightingShader.setInt("material.diffuse", 0);
+	lightingShader.setInt("material.specular", 1);
+	lightingShader.setFloat("material.shininess", 32.0f);
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+
+	std::cout << "Light set benchmark: " << frames << " frames, 1% of lights moving, " << shadingPasses << " shading passes over 64x64" << std::endl;
+	for (unsigned int numLights = 1024; numLights <= maxLights; numLights *= 4) {
+		LightSet set;
+		glFinish();
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (unsigned int i = 0; i < numLights; i++) {
+			set.add(makeLight(i, 0.0f));
+		}
+		set.upload();
+		glFinish();
+		double addMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		checks.check("first upload sends every light", set.bytesUploaded() == (size_t)numLights * sizeof(PointLight));
+
+		// Attenuated brightest channel lands on the 5/256 cutoff at the radius
+		bool radiiMatch = true;
+		for (unsigned int i = 0; i < 4; i++) {
+			const PointLight &light = set.get(i);
+			float attenuated = 1.0f / (light.constant + light.linear * light.radius + light.quadratic * light.radius * light.radius);
+			radiiMatch = radiiMatch && std::abs(attenuated - 5.0f / 256.0f) < 1e-4f;
+		}
+		checks.check("radius at the attenuation cutoff", radiiMatch);
+
+		// Submission cost on the CPU, and per frame once the GPU has the data
+		unsigned int numMoving = std::max(numLights / 100, 1u);
+		size_t uploadedBefore = set.bytesUploaded();
+		double submitMs = 0.0;
+		start = std::chrono::steady_clock::now();
+		for (int frame = 1; frame <= frames; frame++) {
+			std::chrono::steady_clock::time_point submitStart = std::chrono::steady_clock::now();
+			for (unsigned int i = 0; i < numMoving; i++) {
+				set.set(i, makeLight(i, frame * 0.01f));
+			}
+			set.upload();
+			submitMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - submitStart).count();
+		}
+		glFinish();
+		double frameMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / frames;
+		size_t frameBytes = (set.bytesUploaded() - uploadedBefore) / frames;
+		checks.check("updates send only the moved lights", frameBytes == numMoving * sizeof(PointLight));
+
+		std::vector<PointLight> stored(numLights);
+		glGetNamedBufferSubData(set.ID, 0, numLights * sizeof(PointLight), stored.data());
+		checks.check("storage buffer holds the lights", std::memcmp(stored.data(), set.data(), numLights * sizeof(PointLight)) == 0);
+
+		// Every fragment loops over every light
+		lights.numPointLights = set.size();
+		lightUniforms.update(lights);
+		glViewport(0, 0, 64, 64);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, white);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, white);
+		glActiveTexture(GL_TEXTURE0);
+		glBindVertexArray(quadArray);
+		glDrawArrays(GL_TRIANGLE_FAN, 0, 4); // Untimed, the first draw also finishes compiling the program
+		glFinish();
+		start = std::chrono::steady_clock::now();
+		for (int pass = 0; pass < shadingPasses; pass++) {
+			glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+		}
+		glFinish();
+		double shadeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / shadingPasses;
+		glBindVertexArray(0);
+		glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+		PointLight last = set.get(numLights - 1);
+		set.remove(0);
+		set.remove(numLights); // Out of range, ignored
+		uploadedBefore = set.bytesUploaded();
+		set.upload();
+		checks.check("swap-remove keeps the set packed", set.size() == numLights - 1 && set.get(0).position == last.position);
+		checks.check("swap-remove re-sends only the moved light", set.bytesUploaded() - uploadedBefore == sizeof(PointLight));
+
+		std::cout << "  " << numLights << " lights: add and upload " << addMs << " ms, update " << submitMs / frames << " ms submitting and "
+			<< frameMs << " ms to GPU completion per frame, " << frameBytes / 1024.0 << " KB uploaded per frame against "
+			<< numLights * sizeof(PointLight) / 1024 << " KB for the whole set, shading " << shadeMs << " ms per pass" << std::endl;
+	}
+	return checks.report();
+}
@@ -1,7 +1,5 @@
 #version 460 core
 
-#define NUM_POINT_LIGHTS 4
-
 struct Material {
 	sampler2D diffuse; // This is an opaque data type (i.e. a handle)
 	sampler2D specular;
@@ -18,17 +16,16 @@ struct DirLight {
 };
 
 // An omnidirectional light with attenuation
+// Attenuation coeffs fill the vec3 tails so the std430 array stays 64 bytes per light
 struct PointLight {
 	vec3 position;
-
-	// Attenuation function coeffs
 	float constant;
-	float linear;
-	float quadratic;
-
 	vec3 ambient;
+	float linear;
 	vec3 diffuse;
+	float quadratic;
 	vec3 specular;
+	float radius; // Range derived from attenuation, used for clustering
 };
 
 // A directional cone light with attenuation
@@ -55,16 +52,46 @@ in vec3 normal;
 in vec2 texCoords;
 
 uniform Material material;
-uniform vec3 viewPos;
 
-// Lights
-uniform DirLight dirLight;
-uniform PointLight pointLights[NUM_POINT_LIGHTS];
-uniform Spotlight spotlight;
+// Per-frame camera data shared by all shaders
+layout (std140, binding = 0) uniform FrameData {
+	mat4 projection;
+	mat4 view;
+	vec3 viewPos;
+};
+
+// Lights, laid out to match LightUniforms in uniformBuffers.h
+layout (std140, binding = 1) uniform LightData {
+	DirLight dirLight;
+	Spotlight spotlight;
+	uint numPointLights;
+
+	// Clustered shading, see LightClusters in lightClusters.h
+	bool clusteredShading;
+	vec2 screenSize;
+	uvec3 clusterGrid; // Tiles x, tiles y, depth slices
+	float clusterNear;
+	float clusterFar;
+};
+
+// Any number of point lights, packed by LightSet in lightSet.h
+layout (std430, binding = 2) readonly buffer PointLightData {
+	PointLight pointLights[];
+};
+
+// Per-cluster slices of the light index list
+layout (std430, binding = 3) readonly buffer ClusterRangeData {
+	uvec2 clusterRanges[]; // Offset, count
+};
+
+layout (std430, binding = 4) readonly buffer ClusterIndexData {
+	uint clusterLightIndices[];
+};
 
 vec3 calcDirLight(DirLight light, vec3 normal, vec3 viewDir);
 vec3 calcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
 vec3 calcSpotlight(Spotlight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+uint clusterIndex();
 
 void main() {
 	// Fragment properties
@@ -75,8 +102,16 @@ void main() {
 	vec3 result = calcDirLight(dirLight, norm, viewDir);
 
 	// Calculate point lights
-	for (int i = 0; i < NUM_POINT_LIGHTS; i++) {
-		result += calcPointLight(pointLights[i], norm, fragPos, viewDir);
+	if (clusteredShading) {
+		// Only the lights binned into this fragment's cluster can reach it
+		uvec2 range = clusterRanges[clusterIndex()];
+		for (uint i = 0; i < range.y; i++) {
+			result += calcPointLight(pointLights[clusterLightIndices[range.x + i]], norm, fragPos, viewDir);
+		}
+	} else {
+		for (uint i = 0; i < numPointLights; i++) {
+			result += calcPointLight(pointLights[i], norm, fragPos, viewDir);
+		}
 	}
 
 	// Calculate spotlight
@@ -153,4 +188,17 @@ vec3 calcSpotlight(Spotlight light, vec3 normal, vec3 fragPos, vec3 viewDir) {
 	diffuse  *= attenuation * intensity;
 	specular *= attenuation * intensity;
 	return ambient + diffuse + specular;
+}
+
+uint clusterIndex() {
+	// Screen tile
+	uvec2 tile = uvec2(gl_FragCoord.xy / screenSize * vec2(clusterGrid.xy));
+	tile = min(tile, clusterGrid.xy - 1);
+
+	// Exponential depth slice, must match LightClusters::depthSlice
+	float depth = -(view * vec4(fragPos, 1.0)).z;
+	float slice = log(depth / clusterNear) / log(clusterFar / clusterNear) * float(clusterGrid.z);
+	uint z = uint(clamp(slice, 0.0, float(clusterGrid.z - 1)));
+
+	return tile.x + clusterGrid.x * (tile.y + clusterGrid.y * z);
 }
\ No newline at end of file
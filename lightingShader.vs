@@ -3,19 +3,40 @@ layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
 
+// Per-frame camera data shared by all shaders
+layout (std140, binding = 0) uniform FrameData {
+	mat4 projection;
+	mat4 view;
+	vec3 viewPos;
+};
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+// PackedVertex decoding (see Mesh), identity for float vertices
+uniform bool packedVertices;
+uniform vec3 positionOffset = vec3(0.0);
+uniform vec3 positionScale = vec3(1.0);
 
 out vec3 fragPos;
 out vec3 normal;
 out vec2 texCoords;
 
+// Octahedral normal back onto the unit sphere, same as octDecode in vertexQuantization.h
+vec3 octDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
+
 void main() {
+    vec3 position = positionOffset + positionScale * aPos;
+    vec3 objectNormal = packedVertices ? octDecode(aNormal.xy) : aNormal;
+
     // Clip space vertex position
-    gl_Position = projection * view * model * vec4(aPos, 1.0f);
+    gl_Position = projection * view * model * vec4(position, 1.0f);
 
-    fragPos = vec3(model * vec4(aPos, 1.0)); // World space fragment position
-    normal = mat3(transpose(inverse(model))) * aNormal; // World space normal (multiply by "normal matrix")
+    fragPos = vec3(model * vec4(position, 1.0)); // World space fragment position
+    normal = mat3(transpose(inverse(model))) * objectNormal; // World space normal (multiply by "normal matrix")
     texCoords = aTexCoords;
 }
\ No newline at end of file
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <utility>
+#include <vector>
+
+// Multi-producer, single-consumer hand-off. Producers push without locking, the consumer takes everything at once.
+template <typename T>
+class LockFreeQueue {
+	public:
+		LockFreeQueue() {}
+
+		~LockFreeQueue() {
+			Node *node = head.exchange(nullptr);
+			while (node) {
+				Node *next = node->next;
+				delete node;
+				node = next;
+			}
+		}
+
+		LockFreeQueue(const LockFreeQueue &) = delete;
+		LockFreeQueue &operator=(const LockFreeQueue &) = delete;
+
+		// Safe from any thread
+		void push(T value) {
+			Node *node = new Node{ std::move(value), head.load(std::memory_order_relaxed) };
+			while (!head.compare_exchange_weak(node->next, node, std::memory_order_release, std::memory_order_relaxed)) {
+			}
+		}
+
+		// Consumer only, appends everything pushed so far in push order
+		void popAll(std::vector<T> &out) {
+			Node *node = head.exchange(nullptr, std::memory_order_acquire);
+
+			// The stack is newest first
+			size_t first = out.size();
+			while (node) {
+				Node *next = node->next;
+				out.push_back(std::move(node->value));
+				delete node;
+				node = next;
+			}
+			std::reverse(out.begin() + first, out.end());
+		}
+
+	private:
+		struct Node {
+			T value;
+			Node *next;
+		};
+
+		std::atomic<Node *> head = { nullptr };
+};
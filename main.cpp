@@ -1,6 +1,14 @@
+// Count every heap allocation for the import logs, replaces the global operator new (see allocationCounter.h)
+//#define COUNT_ALLOCATIONS
+
 #include "shader.h"
+#include "benchmark.h"
 #include "camera.h"
+#include "lightClusters.h"
+#include "lightSet.h"
 #include "model.h"
+#include "modelLoader.h"
+#include "uniformBuffers.h"
 
 #include <glad/glad.h> // OpenGL function loader
 #include <GLFW/glfw3.h>
@@ -9,7 +17,10 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
-// Image loading library
+// Image loading library, its heap traffic shows up in threadAllocations
+#define STBI_MALLOC countedMalloc
+#define STBI_REALLOC countedRealloc
+#define STBI_FREE countedFree
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
@@ -18,6 +29,8 @@
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
 void mouse_callback(GLFWwindow *window, double xPos, double yPos);
 void scroll_callback(GLFWwindow *window, double xOffset, double yOffset);
+void render(GLFWwindow *window);
+std::vector<Benchmark> benchmarks();
 void processInput(GLFWwindow *window);
 unsigned int loadTexture(char const *path);
 
@@ -25,6 +38,38 @@ unsigned int loadTexture(char const *path);
 const unsigned int SCREEN_WIDTH  = 800;
 const unsigned int SCREEN_HEIGHT = 600;
 
+// Submit the model with one multi-draw instead of one draw per mesh. Models with more than MAX_INDIRECT_TEXTURES textures
+// (indirectDraw.h) or with texture array pages still draw per mesh.
+const bool INDIRECT_DRAWING = false;
+
+// Store model vertices as 16-byte PackedVertex instead of 32-byte float Vertex
+const bool PACKED_VERTICES = false;
+
+// Upload 16-bit indices for models whose meshes all have fewer than 65536 vertices
+const bool SHORT_INDICES = false;
+
+// Block compress textures with precomputed mips, cached next to each image after the first run
+const bool COMPRESSED_TEXTURES = false;
+
+// Upload only the small mips of compressed textures and stream finer ones in as meshes come closer, within a VRAM budget
+const bool STREAMED_TEXTURES = false;
+
+// Pack same size and format diffuse maps into array pages so a model binds them once per draw, not per mesh.
+// Packed textures aren't streamed.
+const bool TEXTURE_ARRAYS = false;
+
+// Pick mesh detail from projected size, the window title shows triangles with and without it
+const bool LOD_SELECTION = false;
+
+// Skip meshes whose bounding box is outside the view frustum
+const bool FRUSTUM_CULLING = true;
+
+// Also skip meshes hidden behind occluders in a CPU depth buffer, needs FRUSTUM_CULLING
+const bool OCCLUSION_CULLING = false;
+
+// Also skip back facing and off-screen meshlets of full detail meshes, on the CPU or in a compute shader. Needs FRUSTUM_CULLING.
+const MeshletCulling MESHLET_CULLING = MeshletCulling::Off;
+
 // Camera
 Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
 
@@ -35,18 +80,29 @@ glm::vec3 lightPos(1.2f, 1.0f, 2.0f);
 // Also compensate for slower or faster frames.
 float deltaTime = 0.0f; // Time between current frame and last frame
 float lastFrame = 0.0f; // Time of last frame
+float lastStatsTime = 0.0f; // Time the render stats were last shown
 
 // Mouse position
 float lastX = SCREEN_WIDTH / 2.0, lastY = SCREEN_HEIGHT / 2.0; // Screen center
 bool firstMouse = true; // First time mouse enters window
 
-int main() {
+// "--benchmark <names>" runs the comma separated benchmarks from benchmarks() in a hidden window instead of the scene,
+// "--benchmark all" runs every one. Exits with 1 if a check failed.
+int main(int argc, char *argv[]) {
+    const char *benchmarkSelection = NULL;
+    if (argc == 3 && std::string(argv[1]) == "--benchmark") {
+        benchmarkSelection = argv[2];
+    }
+
     glfwInit();
 
     // Configure GLFW
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 6);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    if (benchmarkSelection) {
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    }
 
     // Create window object
     GLFWwindow *window = glfwCreateWindow(SCREEN_WIDTH, SCREEN_HEIGHT, "LearnOpenGL", NULL, NULL);
@@ -70,8 +126,81 @@ int main() {
     }
 
     // Flip textures
-    stbi_set_flip_vertically_on_load(true);
+    setFlipTexturesOnLoad(true);
+
+    bool passed = true;
+    if (benchmarkSelection) {
+        passed = runBenchmarks(benchmarks(), benchmarkSelection);
+    } else {
+        render(window);
+    }
+
+    // Shared GL objects go before the context, the scene's own went when render() returned
+    shutdownTextureStreamer();
+    TextureRegistry::instance().shutdown();
+    shutdownPixelUnpackBuffer();
+    shutdownMeshletCullShader();
+
+    glfwTerminate();
+    return passed ? 0 : 1;
+}
+
+// Everything --benchmark can run, each one logs its own timings and checks
+std::vector<Benchmark> benchmarks() {
+    return {
+        { "meshCache", "Time importing the backpack with Assimp against loading it from its mesh cache",
+            [] { return Model::benchmarkMeshCache("resources/models/backpack/backpack.obj"); } },
+        { "parallelDecoding", "Decode the backpack textures on 1 to hardware thread count workers",
+            [] { benchmarkParallelDecoding("resources/models/backpack"); return true; } },
+        { "uniformSetters", "Time uniform setters looking the location up per call against the cached locations",
+            [] {
+                Shader shader("modelShader.vs", "modelShader.fs");
+                benchmarkUniformSetters(shader, "model");
+                return true;
+            } },
+        { "lightSet", "Sweep 1k to 64k point lights through a LightSet, timing uploads and a lighting pass and logging bytes re-uploaded",
+            [] {
+                Shader lightingShader("lightingShader.vs", "lightingShader.fs");
+                return benchmarkLightSet(lightingShader);
+            } },
+        { "indirectDrawing", "Draw a synthetic 10k mesh scene once per mesh and as one multi-draw, logging CPU and GPU time of each",
+            [] {
+                Shader meshShader("modelShader.vs", "modelShader.fs");
+                Shader indirectShader("modelIndirectShader.vs", "modelIndirectShader.fs");
+                benchmarkIndirectDrawing(meshShader, indirectShader);
+                return true;
+            } },
+        { "lightClusters", "Bin 1k to 100k lights into clusters, timing the binner and checking it against the shader's cluster lookup",
+            [] { return benchmarkLightClusters(); } },
+        { "frustumCulling", "Time the culling kernel and log bounds tested per second",
+            [] { benchmarkFrustumCulling(); return true; } },
+        { "sceneGraph", "Time 100k node scene graph updates, single threaded and on a pool",
+            [] {
+                ThreadPool pool;
+                benchmarkSceneGraph(pool);
+                return true;
+            } },
+        { "occlusionCulling", "Run the occlusion buffer checks and time rasterizing and testing a random scene",
+            [] {
+                ThreadPool pool;
+                return benchmarkOcclusionCulling(pool);
+            } },
+        { "import", "Time serial against parallel mesh import on a synthetic 1M triangle, 500 mesh scene",
+            [] { Model::benchmarkImport(); return true; } },
+        { "meshletCulling", "Split a dense sphere into meshlets, checking the cone and sphere tests against every triangle and timing build and cull",
+            [] { return benchmarkMeshletCulling(); } },
+        { "textureCompression", "Time the block compressor on synthetic 2K images, serially and on the loader pool, logging quality and size",
+            [] { benchmarkTextureCompression(loaderThreadPool()); return true; } },
+        { "imageLoading", "Compare stdio and memory mapped image decoding on the backpack textures",
+            [] { benchmarkImageLoading("resources/models/backpack"); return true; } },
+        { "textureStreaming", "Fly a headless camera over streamed textures and check the streaming budget holds",
+            [] { return benchmarkTextureStreaming(); } },
+    };
+}
 
+// Scene setup and render loop, returns when the window closes. Everything GL it creates is destroyed on the way out,
+// while the context is still alive.
+void render(GLFWwindow *window) {
     // Enable depth testing
     glEnable(GL_DEPTH_TEST);
 
@@ -80,8 +209,35 @@ int main() {
     //Shader lightCubeShader("lightCubeShader.vs", "lightCubeShader.fs");
     Shader shader("modelShader.vs", "modelShader.fs");
 
-    // Load model
-    Model ourModel("resources/models/backpack/backpack.obj");
+    // Multi-draw program, models that can't take that path still draw through shader
+    std::unique_ptr<Shader> indirectShader;
+    if (INDIRECT_DRAWING) {
+        indirectShader = std::make_unique<Shader>("modelIndirectShader.vs", "modelIndirectShader.fs");
+    }
+
+    // Resolve per-object uniform handles once
+    int modelLocation = shader.getLocation("model");
+    int indirectModelLocation = indirectShader ? indirectShader->getLocation("model") : -1;
+
+    // Uniform blocks shared by every shader
+    UniformBuffer<FrameUniforms> frameUniforms(FRAME_UNIFORM_BINDING);
+    //UniformBuffer<LightUniforms> lightUniforms(LIGHT_UNIFORM_BINDING);
+
+    // Load model in the background, it shows up once its uploads finish
+    AsyncModelLoader modelLoader;
+    ModelLoadOptions loadOptions;
+    loadOptions.packVertices = PACKED_VERTICES;
+    loadOptions.shortIndices = SHORT_INDICES;
+    loadOptions.compressTextures = COMPRESSED_TEXTURES;
+    loadOptions.streamTextures = STREAMED_TEXTURES;
+    loadOptions.textureArrays = TEXTURE_ARRAYS;
+    shared_ptr<Model> ourModel = modelLoader.load("resources/models/backpack/backpack.obj", loadOptions);
+    //Model ourModel("resources/models/backpack/backpack.obj", loadOptions);
+    ourModel->setMeshletCulling(MESHLET_CULLING);
+
+    // Occluders are rasterized in bands on their own workers
+    OcclusionBuffer occlusionBuffer;
+    ThreadPool occlusionPool;
 
     //// Position, normals, and texcoords
     //float vertices[] = {
@@ -187,6 +343,23 @@ int main() {
     //unsigned int diffuseMap  = loadTexture("textures/container2.png");
     //unsigned int specularMap = loadTexture("textures/container2_specular.png");
 
+    //// Point lights
+    //LightSet pointLights;
+    //for (unsigned int i = 0; i < 4; i++) {
+    //    PointLight light = {};
+    //    light.position  = pointLightPositions[i];
+    //    light.ambient   = glm::vec3(0.05f, 0.05f, 0.05f);
+    //    light.diffuse   = glm::vec3(0.8f, 0.8f, 0.8f);
+    //    light.specular  = glm::vec3(1.0f, 1.0f, 1.0f);
+    //    light.constant  = 1.0f;
+    //    light.linear    = 0.09f;
+    //    light.quadratic = 0.032f;
+    //    pointLights.add(light);
+    //}
+
+    //// Bin point lights into view-space clusters
+    //LightClusters lightClusters;
+
     // Render loop
     while (!glfwWindowShouldClose(window)) {
         // Update times
@@ -197,100 +370,101 @@ int main() {
         // Input
         processInput(window);
 
+        // Start counting this frame's submissions
+        renderStats().reset();
+
+        // Spend this frame's upload budget on pending models
+        modelLoader.update();
+
         // Clear color and depth buffers
         glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        shader.use();
-
-        // Set projection transform
-        glm::mat4 projection = glm::perspective(glm::radians(camera.zoom), (float)SCREEN_WIDTH / (float)SCREEN_HEIGHT, 0.1f, 100.0f);
-        shader.setMat4("projection", projection);
-
-        // Set view transform
-        glm::mat4 view = camera.getViewMatrix();
-        shader.setMat4("view", view);
+        // Upload per-frame camera data once for all shaders
+        FrameUniforms frame;
+        frame.projection = glm::perspective(glm::radians(camera.zoom), (float)SCREEN_WIDTH / (float)SCREEN_HEIGHT, 0.1f, 100.0f);
+        frame.view = camera.getViewMatrix();
+        frame.viewPos = camera.position;
+        frameUniforms.update(frame);
 
         // Set model transform
         glm::mat4 model = glm::mat4(1.0f);
         model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f));
         model = glm::scale(model, glm::vec3(1.0f, 1.0f, 1.0f));
-        shader.setMat4("model", model);
 
-        ourModel.draw(shader);
+        if (INDIRECT_DRAWING && ourModel->canDrawIndirect()) {
+            indirectShader->use();
+            indirectShader->setMat4(indirectModelLocation, model);
+            ourModel->drawIndirect(*indirectShader);
+        } else {
+            shader.use();
+            shader.setMat4(modelLocation, model);
+
+            // Coarser levels once their error projects under a pixel
+            LodView lodView = makeLodView(camera, SCREEN_HEIGHT);
+            if (!LOD_SELECTION) {
+                lodView.pixelsPerUnit = 0.0f;
+            }
+            if (FRUSTUM_CULLING) {
+                glm::mat4 viewProjection = frame.projection * frame.view;
+                if (OCCLUSION_CULLING) {
+                    occlusionBuffer.clear();
+                    ourModel->addOccluders(occlusionBuffer, model, viewProjection);
+                    occlusionBuffer.rasterize(&occlusionPool);
+                }
+                ourModel->draw(shader, model, viewProjection, lodView, OCCLUSION_CULLING ? &occlusionBuffer : nullptr);
+            } else {
+                ourModel->draw(shader, model, lodView);
+            }
+        }
 
         ////  Activate lighting shader
         //lightingShader.use();
 
-        //// Directional light parameters
-        //lightingShader.setVec3("dirLight.direction", -0.2f, -1.0f, -0.3f);
-        //lightingShader.setVec3("dirLight.ambient",    0.05f, 0.05f, 0.05f);
-        //lightingShader.setVec3("dirLight.diffuse",    0.4f,  0.4f,  0.4f);
-        //lightingShader.setVec3("dirLight.specular",   0.5f,  0.5f,  0.5f);
-
-        //// Point light parameters
-        //lightingShader.setVec3("pointLights[0].position", pointLightPositions[0]);
-        //lightingShader.setVec3("pointLights[0].ambient",  0.05f, 0.05f, 0.05f);
-        //lightingShader.setVec3("pointLights[0].diffuse",  0.8f, 0.8f, 0.8f);
-        //lightingShader.setVec3("pointLights[0].specular", 1.0f, 1.0f, 1.0f);
-        //lightingShader.setFloat("pointLights[0].constant",  1.0f);
-        //lightingShader.setFloat("pointLights[0].linear",    0.09f);
-        //lightingShader.setFloat("pointLights[0].quadratic", 0.032f);
-
-        //lightingShader.setVec3("pointLights[1].position", pointLightPositions[1]);
-        //lightingShader.setVec3("pointLights[1].ambient",  0.05f, 0.05f, 0.05f);
-        //lightingShader.setVec3("pointLights[1].diffuse",  0.8f, 0.8f, 0.8f);
-        //lightingShader.setVec3("pointLights[1].specular", 1.0f, 1.0f, 1.0f);
-        //lightingShader.setFloat("pointLights[1].constant",  1.0f);
-        //lightingShader.setFloat("pointLights[1].linear",    0.09f);
-        //lightingShader.setFloat("pointLights[1].quadratic", 0.032f);
-
-        //lightingShader.setVec3("pointLights[2].position", pointLightPositions[2]);
-        //lightingShader.setVec3("pointLights[2].ambient",  0.05f, 0.05f, 0.05f);
-        //lightingShader.setVec3("pointLights[2].diffuse",  0.8f, 0.8f, 0.8f);
-        //lightingShader.setVec3("pointLights[2].specular", 1.0f, 1.0f, 1.0f);
-        //lightingShader.setFloat("pointLights[2].constant",  1.0f);
-        //lightingShader.setFloat("pointLights[2].linear",    0.09f);
-        //lightingShader.setFloat("pointLights[2].quadratic", 0.032f);
-
-        //lightingShader.setVec3("pointLights[3].position", pointLightPositions[3]);
-        //lightingShader.setVec3("pointLights[3].ambient",  0.05f, 0.05f, 0.05f);
-        //lightingShader.setVec3("pointLights[3].diffuse",  0.8f, 0.8f, 0.8f);
-        //lightingShader.setVec3("pointLights[3].specular", 1.0f, 1.0f, 1.0f);
-        //lightingShader.setFloat("pointLights[3].constant",  1.0f);
-        //lightingShader.setFloat("pointLights[3].linear",    0.09f);
-        //lightingShader.setFloat("pointLights[3].quadratic", 0.032f);
-
-        //// Spotlight parameters
-        //lightingShader.setVec3("spotlight.position",  camera.position);
-        //lightingShader.setVec3("spotlight.direction", camera.front);
-        //lightingShader.setFloat("spotlight.cutoff",      glm::cos(glm::radians(12.5f)));
-        //lightingShader.setFloat("spotlight.outerCutoff", glm::cos(glm::radians(15.0f)));
-        //lightingShader.setVec3("spotlight.ambient",  0.0f, 0.0f, 0.0f);
-        //lightingShader.setVec3("spotlight.diffuse",  1.0f, 1.0f, 1.0f);
-        //lightingShader.setVec3("spotlight.specular", 1.0f, 1.0f, 1.0f);
-        //lightingShader.setFloat("spotlight.constant",  1.0f);
-        //lightingShader.setFloat("spotlight.linear",    0.09f);
-        //lightingShader.setFloat("spotlight.quadratic", 0.032f);
+        //// Light parameters, uploaded as one block
+        //LightUniforms lights = {};
+
+        //// Directional light
+        //lights.dirLight.direction = glm::vec3(-0.2f, -1.0f, -0.3f);
+        //lights.dirLight.ambient   = glm::vec3(0.05f, 0.05f, 0.05f);
+        //lights.dirLight.diffuse   = glm::vec3(0.4f,  0.4f,  0.4f);
+        //lights.dirLight.specular  = glm::vec3(0.5f,  0.5f,  0.5f);
+
+        //// Point lights, only changed lights are re-uploaded
+        //pointLights.upload();
+        //lights.numPointLights = pointLights.size();
+
+        //// Clustered shading
+        //lightClusters.setProjection(glm::radians(camera.zoom), (float)SCREEN_WIDTH / (float)SCREEN_HEIGHT, 0.1f, 100.0f);
+        //lightClusters.build(pointLights.data(), pointLights.size(), frame.view);
+        //lightClusters.upload();
+        //lights.clusteredShading = 1;
+        //lights.screenSize  = glm::vec2(SCREEN_WIDTH, SCREEN_HEIGHT);
+        //lights.clusterGrid = glm::uvec3(lightClusters.tilesX, lightClusters.tilesY, lightClusters.slices);
+        //lights.clusterNear = 0.1f;
+        //lights.clusterFar  = 100.0f;
+
+        //// Spotlight
+        //lights.spotlight.position    = camera.position;
+        //lights.spotlight.direction   = camera.front;
+        //lights.spotlight.cutoff      = glm::cos(glm::radians(12.5f));
+        //lights.spotlight.outerCutoff = glm::cos(glm::radians(15.0f));
+        //lights.spotlight.ambient     = glm::vec3(0.0f, 0.0f, 0.0f);
+        //lights.spotlight.diffuse     = glm::vec3(1.0f, 1.0f, 1.0f);
+        //lights.spotlight.specular    = glm::vec3(1.0f, 1.0f, 1.0f);
+        //lights.spotlight.constant    = 1.0f;
+        //lights.spotlight.linear      = 0.09f;
+        //lights.spotlight.quadratic   = 0.032f;
+
+        //lightUniforms.update(lights);
 
         //// Set material parameters
         //lightingShader.setInt("material.diffuse", 0);
         //lightingShader.setInt("material.specular", 1);
         //lightingShader.setFloat("material.shininess", 32.0f);
 
-        //// Set camera position
-        //lightingShader.setVec3("viewPos", camera.position);
-
-        //// Pass projection transform to shader
-        //glm::mat4 projection = glm::perspective(glm::radians(camera.zoom), (float)SCREEN_WIDTH / (float)SCREEN_HEIGHT, 0.1f, 100.0f);
-        //lightingShader.setMat4("projection", projection);
-        //
-        //// Pass view transform to shader
-        //glm::mat4 view = camera.getViewMatrix();
-        //lightingShader.setMat4("view", view);
-
         //// Pass model transform to shader
-        //glm::mat4 model = glm::mat4(1.0f);
+        //model = glm::mat4(1.0f);
         //lightingShader.setMat4("model", model);
 
         //// Bind textures
@@ -320,9 +494,6 @@ int main() {
         //// Activate light source shader
         //lightCubeShader.use();
 
-        //lightCubeShader.setMat4("projection", projection);
-        //lightCubeShader.setMat4("view", view);
-
         //// Bind point light vertices
         //glBindVertexArray(lightVertexArrayObject);
 
@@ -336,6 +507,28 @@ int main() {
         //    glDrawArrays(GL_TRIANGLES, 0, 36);
         //}
 
+        // Fetch and upload the finer mips this frame's draws asked for
+        if (STREAMED_TEXTURES) {
+            textureStreamer().update();
+        }
+
+        // Show submission counts once a second
+        if (currentFrame - lastStatsTime >= 1.0f) {
+            std::string title = "LearnOpenGL - " + std::to_string(renderStats().drawCalls) + " draw calls, "
+                + std::to_string(renderStats().drawCommands) + " draws, " + std::to_string(renderStats().textureBinds) + " texture binds, "
+                + std::to_string(renderStats().triangles) + " triangles ("
+                + std::to_string(renderStats().fullDetailTriangles) + " without LOD), " + std::to_string(renderStats().visibleMeshes) + " meshes visible, "
+                + std::to_string(renderStats().culledMeshes) + " culled, " + std::to_string(renderStats().occludedMeshes) + " occluded, "
+                + std::to_string(renderStats().culledMeshlets) + " meshlets (" + std::to_string(renderStats().culledMeshletTriangles) + " triangles) culled";
+            if (STREAMED_TEXTURES) {
+                const TextureResidency &residency = textureStreamer().residency();
+                title += ", textures " + std::to_string(residency.residentBytes >> 20) + "/" + std::to_string(residency.budgetBytes >> 20) + " MB ("
+                    + std::to_string(residency.missingLevels) + " levels streaming)";
+            }
+            glfwSetWindowTitle(window, title.c_str());
+            lastStatsTime = currentFrame;
+        }
+
         // Swap buffers and poll I/O events
         glfwSwapBuffers(window);
         glfwPollEvents();
@@ -344,9 +537,6 @@ int main() {
     //glDeleteBuffers(1, &vertexBufferObject);
     //glDeleteVertexArrays(1, &vertexArrayObject);
     //glDeleteVertexArrays(1, &lightVertexArrayObject);
-
-    glfwTerminate();
-    return 0;
 }
 
 void framebuffer_size_callback(GLFWwindow *window, int width, int height) {
@@ -396,36 +586,7 @@ void processInput(GLFWwindow *window) {
 }
 
 unsigned int loadTexture(char const *path) {
-    // Create texture
-    unsigned int textureID;
-    glGenTextures(1, &textureID);
-
-    // Load texture and generate mipmaps
-    int width, height, numComponents;
-    unsigned char *data = stbi_load(path, &width, &height, &numComponents, 0);
-    if (data) {
-        GLenum format;
-        if (numComponents == 1) {
-            format = GL_RED;
-        } else if (numComponents == 3) {
-            format = GL_RGB;
-        } else if (numComponents == 4) {
-            format = GL_RGBA;
-        }
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        // Set wrap and filter options
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR); // Magnification doesn't use mipmaps
-    } else {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-    }
-    stbi_image_free(data);
-
-    return textureID;
+    // Decode (or read the compressed chain from the texture cache) and upload with mipmaps
+    DecodedImage image = decodeImage(path, COMPRESSED_TEXTURES);
+    return uploadTexture(image);
 }
\ No newline at end of file
@@ -0,0 +1,155 @@
+#pragma once
+
+#ifdef _WIN32
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#ifndef WIN32_LEAN_AND_MEAN
+		#define WIN32_LEAN_AND_MEAN
+	#endif
+	// glad defines this too, windows.h redefines it to the same calling convention
+	#ifdef APIENTRY
+		#undef APIENTRY
+	#endif
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+// Read-only memory mapping of an entire file
+class MappedFile {
+	public:
+		MappedFile() {}
+
+		MappedFile(const std::string &path) {
+			open(path);
+		}
+
+		~MappedFile() {
+			close();
+		}
+
+		// Mappings own OS handles, so they can't be copied
+		MappedFile(const MappedFile &) = delete;
+		MappedFile &operator=(const MappedFile &) = delete;
+
+		bool open(const std::string &path) {
+			close();
+
+#ifdef _WIN32
+			fileHandle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+			if (fileHandle == INVALID_HANDLE_VALUE) {
+				return false;
+			}
+
+			LARGE_INTEGER fileSize;
+			if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+				close();
+				return false;
+			}
+			length = (size_t)fileSize.QuadPart;
+
+			mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (mappingHandle == NULL) {
+				close();
+				return false;
+			}
+
+			bytes = (const unsigned char *)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+#else
+			fileHandle = ::open(path.c_str(), O_RDONLY);
+			if (fileHandle < 0) {
+				return false;
+			}
+
+			struct stat fileStat;
+			if (fstat(fileHandle, &fileStat) != 0 || fileStat.st_size == 0) {
+				close();
+				return false;
+			}
+			length = (size_t)fileStat.st_size;
+
+			void *view = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fileHandle, 0);
+			bytes = (view == MAP_FAILED) ? nullptr : (const unsigned char *)view;
+#endif
+
+			if (!bytes) {
+				close();
+				return false;
+			}
+			return true;
+		}
+
+		void close() {
+#ifdef _WIN32
+			if (bytes) {
+				UnmapViewOfFile(bytes);
+			}
+			if (mappingHandle != NULL) {
+				CloseHandle(mappingHandle);
+			}
+			if (fileHandle != INVALID_HANDLE_VALUE) {
+				CloseHandle(fileHandle);
+			}
+			mappingHandle = NULL;
+			fileHandle = INVALID_HANDLE_VALUE;
+#else
+			if (bytes) {
+				munmap((void *)bytes, length);
+			}
+			if (fileHandle >= 0) {
+				::close(fileHandle);
+			}
+			fileHandle = -1;
+#endif
+			bytes = nullptr;
+			length = 0;
+		}
+
+		bool isOpen() const {
+			return bytes != nullptr;
+		}
+
+		const unsigned char *data() const {
+			return bytes;
+		}
+
+		size_t size() const {
+			return length;
+		}
+
+	private:
+		const unsigned char *bytes = nullptr;
+		size_t length = 0;
+
+#ifdef _WIN32
+		HANDLE fileHandle = INVALID_HANDLE_VALUE;
+		HANDLE mappingHandle = NULL;
+#else
+		int fileHandle = -1;
+#endif
+};
+
+// Size and write time of a file, caches built from it store these to notice edits
+bool getSourceStamp(const std::string &path, uint64_t &size, int64_t &time) {
+	std::error_code error;
+	size = std::filesystem::file_size(path, error);
+	if (error) {
+		return false;
+	}
+
+	std::filesystem::file_time_type writeTime = std::filesystem::last_write_time(path, error);
+	if (error) {
+		return false;
+	}
+	time = (int64_t)writeTime.time_since_epoch().count();
+	return true;
+}
@@ -1,9 +1,13 @@
 #pragma once
 
+#include "bounds.h"
+#include "renderStats.h"
 #include "shader.h"
 
 #include <glm/glm.hpp>
 
+#include <algorithm>
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -15,6 +19,32 @@ struct Vertex {
 	glm::vec2 texCoords;
 };
 
+// Compact alternative to Vertex, 16 bytes instead of 32. Decoded in the vertex shader (see modelShader.vs).
+struct PackedVertex {
+	uint16_t position[4];  // unorm16 within the mesh bounds, w is padding
+	int16_t normal[2];     // Octahedral snorm16
+	uint16_t texCoords[2]; // Half floats
+};
+
+// One level of detail, indices are a range of the mesh's index block and reuse the mesh's vertices
+struct MeshLod {
+	unsigned int firstIndex; // Relative to Mesh::firstIndex
+	unsigned int indexCount;
+	float error;             // Simplification error in model units, 0 for full detail
+};
+
+// Cluster of at most 64 vertices / 124 triangles of the full detail level, culled on its own (see meshlets.h).
+// Laid out for std430 so the same array feeds the culling compute shader.
+struct Meshlet {
+	glm::vec4 sphere;   // Bounding sphere center, radius in w
+	glm::vec4 coneApex; // Normal cone apex, w unused
+	glm::vec4 coneAxis; // Normal cone axis, cutoff in w (1 when every view direction may see a front face)
+	unsigned int firstIndex; // Relative to Mesh::firstIndex, absolute once uploaded
+	unsigned int indexCount;
+	unsigned int baseVertex; // Filled in at upload
+	unsigned int mesh;       // Filled in at upload
+};
+
 struct Texture {
 	unsigned int id;
 	string type;
@@ -27,80 +57,166 @@ class Mesh {
 		vector<unsigned int> indices;
 		vector<Texture> textures;
 
+		// Location inside the owning model's geometry arena
+		unsigned int baseVertex = 0;
+		unsigned int firstIndex = 0;
+		unsigned int indexCount = 0;
+		unsigned int vertexCount = 0;
+		bool shortIndices = false; // Arena holds 16-bit indices
+
+		// Maps stored positions back to model space, identity unless the arena holds PackedVertex
+		bool packedVertices = false;
+		glm::vec3 positionOffset = glm::vec3(0.0f);
+		glm::vec3 positionScale = glm::vec3(1.0f);
+
+		// Model space bounds and levels of detail, lods[0] is the full mesh
+		BoundingSphere bounds;
+		BoundingBox box;
+
+		// Layer of the model's texture array pages holding the diffuse map, page -1 binds textures instead (see textureArray.h)
+		int diffusePage = -1;
+		int diffuseLayer = 0;
+
+		// Scene graph node whose world matrix places this mesh in the model
+		unsigned int node = 0;
+		vector<MeshLod> lods;
+		vector<Meshlet> meshlets; // Split of lods[0], empty if not built
+
+		// Takes the arrays by value so callers can move them in without a copy
 		Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures) {
-			this->vertices = vertices;
-			this->indices  = indices;
-			this->textures = textures;
+			this->vertices = move(vertices);
+			this->indices  = move(indices);
+			this->textures = move(textures);
 
-			setupMesh();
+			indexCount = (unsigned int)this->indices.size();
+			vertexCount = (unsigned int)this->vertices.size();
+			lods.push_back({ 0, indexCount, 0.0f });
 		}
 
-		void draw(Shader &shader) {
-			unsigned int diffuseNum  = 1;
-			unsigned int specularNum = 1;
+		// Geometry already resident in an arena (e.g. uploaded straight from a mapped mesh cache), no CPU copy
+		Mesh(unsigned int baseVertex, unsigned int firstIndex, unsigned int indexCount, vector<Texture> textures) {
+			this->textures = move(textures);
+			this->baseVertex = baseVertex;
+			this->firstIndex = firstIndex;
+			this->indexCount = indexCount;
+			lods.push_back({ 0, indexCount, 0.0f });
+		}
+
+		// Geometry arrays can be large, so meshes are moved around and never copied
+		Mesh(const Mesh &) = delete;
+		Mesh &operator=(const Mesh &) = delete;
+		Mesh(Mesh &&) = default;
+		Mesh &operator=(Mesh &&) = default;
+
+		// Expects the owning model's geometry arena to be bound
+		void draw(Shader &shader, unsigned int lod = 0) {
+			bindTextures(shader);
+			setVertexDecoding(shader);
+
+			// Draw mesh
+			const MeshLod &level = lods[min<size_t>(lod, lods.size() - 1)];
+			glDrawElementsBaseVertex(GL_TRIANGLES, level.indexCount, indexType(), (void *)((firstIndex + level.firstIndex) * indexSize()), baseVertex);
+
+			RenderStats &stats = renderStats();
+			stats.drawCalls++;
+			stats.drawCommands++;
+			stats.triangles += level.indexCount / 3;
+			stats.fullDetailTriangles += indexCount / 3;
+		}
+
+		// Textures and vertex decoding for draws issued outside the mesh, e.g. a multi-draw of its meshlets
+		void bind(Shader &shader) {
+			bindTextures(shader);
+			setVertexDecoding(shader);
+		}
+
+		unsigned int indexType() const {
+			return shortIndices ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+		}
+
+		size_t indexSize() const {
+			return shortIndices ? sizeof(uint16_t) : sizeof(unsigned int);
+		}
+
+		// Draw many copies, per-instance transforms come from the arena's instance buffer
+		void drawInstanced(Shader &shader, unsigned int numInstances) {
+			bindTextures(shader);
+			setVertexDecoding(shader);
+
+			glDrawElementsInstancedBaseVertex(GL_TRIANGLES, indexCount, indexType(), (void *)(firstIndex * indexSize()), numInstances, baseVertex);
+
+			RenderStats &stats = renderStats();
+			stats.drawCalls++;
+			stats.drawCommands++;
+			stats.triangles += (unsigned long long)indexCount / 3 * numInstances;
+			stats.fullDetailTriangles += (unsigned long long)indexCount / 3 * numInstances;
+		}
+
+	private:
+		// Per-texture sampler and vertex decoding uniform handles for the last shader used
+		unsigned int uniformShaderID = 0;
+		vector<int> samplerLocations;
+		int packedVerticesLocation = -1, positionOffsetLocation = -1, positionScaleLocation = -1;
+		int diffusePageLocation = -1, diffuseLayerLocation = -1;
+
+		void bindTextures(Shader &shader) {
+			// Uniform locations only change when a different program draws this mesh
+			if (uniformShaderID != shader.ID) {
+				resolveUniformLocations(shader);
+			}
 
+			// Packed textures have no id of their own, the model bound their pages already. Nothing is bound for
+			// samplers the shader doesn't use.
 			for (unsigned int i = 0; i < textures.size(); i++) {
-				// Assign texture name
-				string number;
-				string name = textures[i].type;
-				if (name == "texture_diffuse") {
-					number = to_string(diffuseNum++);
-				} else if (name == "texture_specular") {
-					number = to_string(specularNum++);
+				if (textures[i].id == 0 || samplerLocations[i] < 0) {
+					continue;
 				}
 
 				// Bind texture to sampler location
 				glActiveTexture(GL_TEXTURE0 + i);
 				glBindTexture(GL_TEXTURE_2D, textures[i].id);
+				renderStats().textureBinds++;
 
 				// Set as shader param
-				shader.setInt(("" + name + number).c_str(), i);
+				shader.setInt(samplerLocations[i], i);
 			}
 			// Reset to default
 			glActiveTexture(GL_TEXTURE0);
-			
-			// Draw mesh
-			glBindVertexArray(vertexArrayObj);
-			glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-			glBindVertexArray(0);
+
+			// Always set, the previous mesh may have sampled a page
+			shader.setInt(diffusePageLocation, diffusePage);
+			shader.setInt(diffuseLayerLocation, diffuseLayer);
 		}
 
-	private:
-		unsigned int vertexArrayObj, vertexBufferObj, elementBufferObj;
-
-		void setupMesh() {
-			// Create objects
-			glGenVertexArrays(1, &vertexArrayObj);
-			glGenBuffers(1, &vertexBufferObj);
-			glGenBuffers(1, &elementBufferObj);
-
-			// Bind first to store state
-			glBindVertexArray(vertexArrayObj);
-
-			// Initialize vertex buffer
-			glBindBuffer(GL_ARRAY_BUFFER, vertexBufferObj);
-			glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
-		
-			// Initialize index buffer
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBufferObj);
-			glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-
-			// Configure vertex attributes
-			{
-				// Postion
-				glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)0);
-				glEnableVertexAttribArray(0);
-
-				// Normal
-				glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, normal));
-				glEnableVertexAttribArray(1);
-
-				// Texcoords
-				glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)offsetof(Vertex, texCoords));
-				glEnableVertexAttribArray(2);
+		// Always set, the previous mesh drawn with this shader may have used the other format
+		void setVertexDecoding(Shader &shader) {
+			shader.setBool(packedVerticesLocation, packedVertices);
+			shader.setVec3(positionOffsetLocation, positionOffset);
+			shader.setVec3(positionScaleLocation, positionScale);
+		}
+
+		void resolveUniformLocations(Shader &shader) {
+			unsigned int diffuseNum  = 1;
+			unsigned int specularNum = 1;
+
+			samplerLocations.clear();
+			for (unsigned int i = 0; i < textures.size(); i++) {
+				// Assign texture name
+				string number;
+				string name = textures[i].type;
+				if (name == "texture_diffuse") {
+					number = to_string(diffuseNum++);
+				} else if (name == "texture_specular") {
+					number = to_string(specularNum++);
+				}
+				samplerLocations.push_back(shader.getLocation(name + number));
 			}
 
-			// Unbind
-			glBindVertexArray(0);
+			packedVerticesLocation = shader.getLocation("packedVertices");
+			positionOffsetLocation = shader.getLocation("positionOffset");
+			positionScaleLocation = shader.getLocation("positionScale");
+			diffusePageLocation = shader.getLocation("diffusePage");
+			diffuseLayerLocation = shader.getLocation("diffuseLayer");
+			uniformShaderID = shader.ID;
 		}
 };
\ No newline at end of file
@@ -0,0 +1,450 @@
+#pragma once
+
+#include "mesh.h"
+#include "sceneGraph.h"
+#include "mappedFile.h"
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Binary mesh cache layout (all offsets are from the start of the file):
+//   MeshCacheHeader
+//   MeshCacheEntry[numMeshes]             per-mesh ranges into the blobs below
+//   MeshCacheLod[numLods]                 per-mesh level of detail ranges
+//   MeshCacheNode[numNodes]               scene graph, breadth first like SceneGraph
+//   Meshlet[numMeshlets]                  per-mesh meshlets of the full detail level
+//   uint32_t[numMaterialTextures]         per-mesh material table, indices into the texture table
+//   MeshCacheTexture[numTextures]         texture path table
+//   char[stringSize]                      texture types and paths, node names
+//   Vertex[numVertices]                   vertex blob, uploaded as-is
+//   uint32_t[numIndices]                  index blob, uploaded as-is
+const uint32_t MESH_CACHE_MAGIC   = 0x48534D4C; // "LMSH"
+const uint32_t MESH_CACHE_VERSION = 7; // 2: meshes are cache/overdraw/fetch optimized, 3: bounds and LODs, 4: boxes, 5: node hierarchy, 6: welded vertices, 7: meshlets
+
+struct MeshCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t vertexSize;  // sizeof(Vertex) when written
+	uint32_t importFlags; // Assimp post-processing flags used to build the cache
+
+	// Source file stamp
+	uint64_t sourceSize;
+	int64_t sourceTime;
+
+	uint32_t numMeshes;
+	uint32_t numMaterialTextures;
+	uint32_t numTextures;
+	uint32_t stringSize;
+	uint32_t numLods;
+	uint32_t numNodes;
+	uint32_t numMeshlets;
+	uint32_t pad0;
+	uint64_t numVertices;
+	uint64_t numIndices;
+
+	uint64_t meshOffset;
+	uint64_t lodOffset;
+	uint64_t nodeOffset;
+	uint64_t meshletOffset;
+	uint64_t materialOffset;
+	uint64_t textureOffset;
+	uint64_t stringOffset;
+	uint64_t vertexOffset;
+	uint64_t indexOffset;
+};
+
+struct MeshCacheEntry {
+	uint32_t baseVertex;
+	uint32_t numVertices;
+	uint32_t firstIndex;
+	uint32_t numIndices;
+	uint32_t firstMaterialTexture;
+	uint32_t numMaterialTextures;
+	uint32_t firstLod;
+	uint32_t numLods;
+	float boundsCenter[3];
+	float boundsRadius;
+	float boxCenter[3];
+	float boxExtents[3];
+	uint32_t node;
+	uint32_t firstMeshlet;
+	uint32_t numMeshlets;
+};
+
+// Same as MeshLod, index ranges are inside the mesh's numIndices
+struct MeshCacheLod {
+	uint32_t firstIndex;
+	uint32_t indexCount;
+	float error;
+	uint32_t pad0;
+};
+
+struct MeshCacheNode {
+	int32_t parent;
+	uint32_t nameOffset;
+	uint32_t nameLength;
+	uint32_t pad0;
+	float transform[16]; // Local, column major like glm
+};
+
+struct MeshCacheTexture {
+	uint32_t typeOffset;
+	uint32_t typeLength;
+	uint32_t pathOffset;
+	uint32_t pathLength;
+};
+
+// Read-only view over a mapped cache file
+class MeshCache {
+	public:
+		// Map the cache and check it was built from the current source with the same import flags, and that every range
+		// in it stays inside the file
+		bool open(const string &cachePath, const string &sourcePath, unsigned int importFlags) {
+			uint64_t sourceSize;
+			int64_t sourceTime;
+			if (!getSourceStamp(sourcePath, sourceSize, sourceTime) || !file.open(cachePath)) {
+				return false;
+			}
+
+			if (file.size() < sizeof(MeshCacheHeader)) {
+				file.close();
+				return false;
+			}
+			header = (const MeshCacheHeader *)file.data();
+
+			bool valid = header->magic == MESH_CACHE_MAGIC
+				&& header->version == MESH_CACHE_VERSION
+				&& header->vertexSize == sizeof(Vertex)
+				&& header->importFlags == importFlags
+				&& header->sourceSize == sourceSize
+				&& header->sourceTime == sourceTime
+				&& validRanges();
+			if (!valid) {
+				file.close();
+				header = nullptr;
+			}
+			return valid;
+		}
+
+		unsigned int numMeshes() const {
+			return header->numMeshes;
+		}
+
+		unsigned int numTextures() const {
+			return header->numTextures;
+		}
+
+		unsigned int numNodes() const {
+			return header->numNodes;
+		}
+
+		const MeshCacheNode &node(unsigned int i) const {
+			return ((const MeshCacheNode *)(file.data() + header->nodeOffset))[i];
+		}
+
+		string nodeName(unsigned int i) const {
+			const MeshCacheNode &entry = node(i);
+			return string(strings() + entry.nameOffset, entry.nameLength);
+		}
+
+		const MeshCacheEntry &mesh(unsigned int i) const {
+			return ((const MeshCacheEntry *)(file.data() + header->meshOffset))[i];
+		}
+
+		const MeshCacheLod *lods(const MeshCacheEntry &entry) const {
+			return (const MeshCacheLod *)(file.data() + header->lodOffset) + entry.firstLod;
+		}
+
+		// Index ranges relative to the mesh like Mesh::meshlets
+		const Meshlet *meshlets(const MeshCacheEntry &entry) const {
+			return (const Meshlet *)(file.data() + header->meshletOffset) + entry.firstMeshlet;
+		}
+
+		const uint32_t *materialTextures(const MeshCacheEntry &entry) const {
+			return (const uint32_t *)(file.data() + header->materialOffset) + entry.firstMaterialTexture;
+		}
+
+		string textureType(uint32_t texture) const {
+			const MeshCacheTexture &entry = ((const MeshCacheTexture *)(file.data() + header->textureOffset))[texture];
+			return string(strings() + entry.typeOffset, entry.typeLength);
+		}
+
+		string texturePath(uint32_t texture) const {
+			const MeshCacheTexture &entry = ((const MeshCacheTexture *)(file.data() + header->textureOffset))[texture];
+			return string(strings() + entry.pathOffset, entry.pathLength);
+		}
+
+		uint64_t numVertices() const {
+			return header->numVertices;
+		}
+
+		uint64_t numIndices() const {
+			return header->numIndices;
+		}
+
+		// Whole vertex blob, meshes are addressed by MeshCacheEntry::baseVertex
+		const Vertex *vertices() const {
+			return (const Vertex *)(file.data() + header->vertexOffset);
+		}
+
+		// Whole index blob, indices are relative to each mesh's base vertex
+		const unsigned int *indices() const {
+			return (const unsigned int *)(file.data() + header->indexOffset);
+		}
+
+		const Vertex *vertices(const MeshCacheEntry &entry) const {
+			return vertices() + entry.baseVertex;
+		}
+
+		const unsigned int *indices(const MeshCacheEntry &entry) const {
+			return indices() + entry.firstIndex;
+		}
+
+	private:
+		MappedFile file;
+		const MeshCacheHeader *header = nullptr;
+
+		// count elements of elementSize at offset fit in the file, without overflowing on garbage counts
+		bool validSection(uint64_t offset, uint64_t count, uint64_t elementSize) const {
+			return offset <= file.size() && count <= (file.size() - offset) / elementSize;
+		}
+
+		// [first, first + count) inside [0, total)
+		static bool validRange(uint64_t first, uint64_t count, uint64_t total) {
+			return first <= total && count <= total - first;
+		}
+
+		// A truncated or corrupt cache with a current stamp must not send loads out of the mapping
+		bool validRanges() const {
+			if (!validSection(header->meshOffset, header->numMeshes, sizeof(MeshCacheEntry))
+				|| !validSection(header->lodOffset, header->numLods, sizeof(MeshCacheLod))
+				|| !validSection(header->nodeOffset, header->numNodes, sizeof(MeshCacheNode))
+				|| !validSection(header->meshletOffset, header->numMeshlets, sizeof(Meshlet))
+				|| !validSection(header->materialOffset, header->numMaterialTextures, sizeof(uint32_t))
+				|| !validSection(header->textureOffset, header->numTextures, sizeof(MeshCacheTexture))
+				|| !validSection(header->stringOffset, header->stringSize, 1)
+				|| !validSection(header->vertexOffset, header->numVertices, sizeof(Vertex))
+				|| !validSection(header->indexOffset, header->numIndices, sizeof(uint32_t))) {
+				return false;
+			}
+
+			// Parents come before their children
+			for (unsigned int i = 0; i < numNodes(); i++) {
+				const MeshCacheNode &entry = node(i);
+				if (entry.parent < -1 || entry.parent >= (int32_t)i || !validRange(entry.nameOffset, entry.nameLength, header->stringSize)) {
+					return false;
+				}
+			}
+
+			const MeshCacheTexture *textures = (const MeshCacheTexture *)(file.data() + header->textureOffset);
+			for (unsigned int i = 0; i < numTextures(); i++) {
+				if (!validRange(textures[i].typeOffset, textures[i].typeLength, header->stringSize)
+					|| !validRange(textures[i].pathOffset, textures[i].pathLength, header->stringSize)) {
+					return false;
+				}
+			}
+
+			for (unsigned int i = 0; i < numMeshes(); i++) {
+				const MeshCacheEntry &entry = mesh(i);
+				if (entry.node >= header->numNodes
+					|| !validRange(entry.baseVertex, entry.numVertices, header->numVertices)
+					|| !validRange(entry.firstIndex, entry.numIndices, header->numIndices)
+					|| !validRange(entry.firstLod, entry.numLods, header->numLods)
+					|| !validRange(entry.firstMeshlet, entry.numMeshlets, header->numMeshlets)
+					|| !validRange(entry.firstMaterialTexture, entry.numMaterialTextures, header->numMaterialTextures)) {
+					return false;
+				}
+
+				// Level and meshlet index ranges are inside the mesh's own indices
+				const MeshCacheLod *meshLods = lods(entry);
+				for (unsigned int j = 0; j < entry.numLods; j++) {
+					if (!validRange(meshLods[j].firstIndex, meshLods[j].indexCount, entry.numIndices)) {
+						return false;
+					}
+				}
+				const Meshlet *meshMeshlets = meshlets(entry);
+				for (unsigned int j = 0; j < entry.numMeshlets; j++) {
+					if (!validRange(meshMeshlets[j].firstIndex, meshMeshlets[j].indexCount, entry.numIndices)) {
+						return false;
+					}
+				}
+				const uint32_t *textureIndices = materialTextures(entry);
+				for (unsigned int j = 0; j < entry.numMaterialTextures; j++) {
+					if (textureIndices[j] >= header->numTextures) {
+						return false;
+					}
+				}
+
+				// Occluders and 16-bit narrowing read vertices through the indices on the CPU
+				const unsigned int *meshIndices = indices(entry);
+				for (unsigned int j = 0; j < entry.numIndices; j++) {
+					if (meshIndices[j] >= entry.numVertices) {
+						return false;
+					}
+				}
+			}
+			return true;
+		}
+
+		const char *strings() const {
+			return (const char *)(file.data() + header->stringOffset);
+		}
+};
+
+// Round blob offsets up so every section stays naturally aligned in the mapping
+uint64_t alignCacheOffset(uint64_t offset) {
+	return (offset + 15) & ~(uint64_t)15;
+}
+
+bool writeMeshCache(const string &cachePath, const string &sourcePath, unsigned int importFlags, const vector<Mesh> &meshes, const SceneGraph &scene) {
+	MeshCacheHeader header = {};
+	header.magic = MESH_CACHE_MAGIC;
+	header.version = MESH_CACHE_VERSION;
+	header.vertexSize = sizeof(Vertex);
+	header.importFlags = importFlags;
+	if (!getSourceStamp(sourcePath, header.sourceSize, header.sourceTime)) {
+		return false;
+	}
+
+	// Build mesh ranges, the deduplicated texture table and the per-mesh material table
+	vector<MeshCacheEntry> entries;
+	vector<MeshCacheLod> lods;
+	vector<Meshlet> meshlets;
+	vector<uint32_t> materialTextures;
+	vector<MeshCacheTexture> textures;
+	vector<string> texturePaths;
+	string strings;
+	for (const Mesh &mesh : meshes) {
+		MeshCacheEntry entry;
+		entry.baseVertex = (uint32_t)header.numVertices;
+		entry.numVertices = (uint32_t)mesh.vertices.size();
+		entry.firstIndex = (uint32_t)header.numIndices;
+		entry.numIndices = (uint32_t)mesh.indices.size();
+		entry.firstMaterialTexture = (uint32_t)materialTextures.size();
+		entry.numMaterialTextures = (uint32_t)mesh.textures.size();
+		entry.firstLod = (uint32_t)lods.size();
+		entry.numLods = (uint32_t)mesh.lods.size();
+		entry.firstMeshlet = (uint32_t)meshlets.size();
+		entry.numMeshlets = (uint32_t)mesh.meshlets.size();
+		entry.node = mesh.node;
+		entry.boundsCenter[0] = mesh.bounds.center.x;
+		entry.boundsCenter[1] = mesh.bounds.center.y;
+		entry.boundsCenter[2] = mesh.bounds.center.z;
+		entry.boundsRadius = mesh.bounds.radius;
+		for (int axis = 0; axis < 3; axis++) {
+			entry.boxCenter[axis] = mesh.box.center[axis];
+			entry.boxExtents[axis] = mesh.box.extents[axis];
+		}
+
+		for (const MeshLod &lod : mesh.lods) {
+			lods.push_back({ lod.firstIndex, lod.indexCount, lod.error, 0 });
+		}
+		meshlets.insert(meshlets.end(), mesh.meshlets.begin(), mesh.meshlets.end());
+
+		for (const Texture &texture : mesh.textures) {
+			uint32_t index = 0;
+			while (index < texturePaths.size() && texturePaths[index] != texture.type + '\n' + texture.path) {
+				index++;
+			}
+
+			if (index == texturePaths.size()) {
+				MeshCacheTexture cached;
+				cached.typeOffset = (uint32_t)strings.size();
+				cached.typeLength = (uint32_t)texture.type.size();
+				strings += texture.type;
+				cached.pathOffset = (uint32_t)strings.size();
+				cached.pathLength = (uint32_t)texture.path.size();
+				strings += texture.path;
+
+				textures.push_back(cached);
+				texturePaths.push_back(texture.type + '\n' + texture.path);
+			}
+			materialTextures.push_back(index);
+		}
+
+		header.numVertices += mesh.vertices.size();
+		header.numIndices += mesh.indices.size();
+		entries.push_back(entry);
+	}
+
+	// Nodes keep their order, names go in the shared string block
+	vector<MeshCacheNode> nodes;
+	for (size_t i = 0; i < scene.size(); i++) {
+		MeshCacheNode node = {};
+		node.parent = scene.parent[i];
+		node.nameOffset = (uint32_t)strings.size();
+		node.nameLength = (uint32_t)scene.names[i].size();
+		strings += scene.names[i];
+		memcpy(node.transform, &scene.local[i][0][0], sizeof(node.transform));
+		nodes.push_back(node);
+	}
+
+	header.numMeshes = (uint32_t)entries.size();
+	header.numNodes = (uint32_t)nodes.size();
+	header.numLods = (uint32_t)lods.size();
+	header.numMeshlets = (uint32_t)meshlets.size();
+	header.numMaterialTextures = (uint32_t)materialTextures.size();
+	header.numTextures = (uint32_t)textures.size();
+	header.stringSize = (uint32_t)strings.size();
+
+	// Lay out sections
+	header.meshOffset = alignCacheOffset(sizeof(MeshCacheHeader));
+	header.lodOffset = alignCacheOffset(header.meshOffset + entries.size() * sizeof(MeshCacheEntry));
+	header.nodeOffset = alignCacheOffset(header.lodOffset + lods.size() * sizeof(MeshCacheLod));
+	header.meshletOffset = alignCacheOffset(header.nodeOffset + nodes.size() * sizeof(MeshCacheNode));
+	header.materialOffset = alignCacheOffset(header.meshletOffset + meshlets.size() * sizeof(Meshlet));
+	header.textureOffset = alignCacheOffset(header.materialOffset + materialTextures.size() * sizeof(uint32_t));
+	header.stringOffset = alignCacheOffset(header.textureOffset + textures.size() * sizeof(MeshCacheTexture));
+	header.vertexOffset = alignCacheOffset(header.stringOffset + strings.size());
+	header.indexOffset = alignCacheOffset(header.vertexOffset + header.numVertices * sizeof(Vertex));
+
+	// Write to a temporary file first so a crash never leaves a half-written cache behind
+	string tempPath = cachePath + ".tmp";
+	ofstream out(tempPath, ios::binary | ios::trunc);
+	if (!out) {
+		return false;
+	}
+
+	auto writeSection = [&out](uint64_t offset, const void *data, size_t size) {
+		static const char padding[16] = {};
+		out.write(padding, offset - (uint64_t)out.tellp());
+		out.write((const char *)data, size);
+	};
+
+	out.write((const char *)&header, sizeof(header));
+	writeSection(header.meshOffset, entries.data(), entries.size() * sizeof(MeshCacheEntry));
+	writeSection(header.lodOffset, lods.data(), lods.size() * sizeof(MeshCacheLod));
+	writeSection(header.nodeOffset, nodes.data(), nodes.size() * sizeof(MeshCacheNode));
+	writeSection(header.meshletOffset, meshlets.data(), meshlets.size() * sizeof(Meshlet));
+	writeSection(header.materialOffset, materialTextures.data(), materialTextures.size() * sizeof(uint32_t));
+	writeSection(header.textureOffset, textures.data(), textures.size() * sizeof(MeshCacheTexture));
+	writeSection(header.stringOffset, strings.data(), strings.size());
+	writeSection(header.vertexOffset, nullptr, 0);
+	for (const Mesh &mesh : meshes) {
+		out.write((const char *)mesh.vertices.data(), mesh.vertices.size() * sizeof(Vertex));
+	}
+	writeSection(header.indexOffset, nullptr, 0);
+	for (const Mesh &mesh : meshes) {
+		out.write((const char *)mesh.indices.data(), mesh.indices.size() * sizeof(unsigned int));
+	}
+	out.close();
+
+	if (!out) {
+		filesystem::remove(tempPath);
+		return false;
+	}
+
+	error_code error;
+	filesystem::rename(tempPath, cachePath, error);
+	if (error) {
+		filesystem::remove(tempPath, error);
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,316 @@
+#pragma once
+
+#include "camera.h"
+#include "mesh.h"
+#include "meshOptimizer.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// How the LOD chain is built at import time
+struct LodSettings {
+	unsigned int maxLods = 4;          // Including full detail
+	float reduction = 0.5f;            // Target triangle fraction of each level relative to the previous one
+	unsigned int minTriangles = 64;    // Don't simplify below this
+	float maxRelativeError = 0.05f;    // Stop once the error exceeds this fraction of the mesh's bounding radius
+};
+
+// Symmetric 4x4 error quadric, sum of squared distances to a set of planes, weighted by triangle area
+struct Quadric {
+	double a00 = 0, a01 = 0, a02 = 0, a03 = 0;
+	double a11 = 0, a12 = 0, a13 = 0;
+	double a22 = 0, a23 = 0;
+	double a33 = 0;
+	double weight = 0;
+
+	static Quadric plane(const glm::dvec3 &normal, double distance, double weight) {
+		Quadric q;
+		q.a00 = normal.x * normal.x * weight; q.a01 = normal.x * normal.y * weight; q.a02 = normal.x * normal.z * weight; q.a03 = normal.x * distance * weight;
+		q.a11 = normal.y * normal.y * weight; q.a12 = normal.y * normal.z * weight; q.a13 = normal.y * distance * weight;
+		q.a22 = normal.z * normal.z * weight; q.a23 = normal.z * distance * weight;
+		q.a33 = distance * distance * weight;
+		q.weight = weight;
+		return q;
+	}
+
+	void operator+=(const Quadric &other) {
+		a00 += other.a00; a01 += other.a01; a02 += other.a02; a03 += other.a03;
+		a11 += other.a11; a12 += other.a12; a13 += other.a13;
+		a22 += other.a22; a23 += other.a23;
+		a33 += other.a33;
+		weight += other.weight;
+	}
+
+	// Weighted sum of squared plane distances at p
+	double evaluate(const glm::vec3 &p) const {
+		double x = p.x, y = p.y, z = p.z;
+		return a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x
+			+ a11 * y * y + 2 * a12 * y * z + 2 * a13 * y
+			+ a22 * z * z + 2 * a23 * z
+			+ a33;
+	}
+};
+
+// Quadric error edge-collapse simplification (Garland & Heckbert). Vertices only ever move onto a neighbour,
+// so the result is a new index list over the same vertices. Open borders and attribute seams are locked.
+// Returns the index list and the largest collapse error, an RMS distance in model units.
+vector<unsigned int> simplifyIndices(const vector<Vertex> &vertices, const vector<unsigned int> &indices, size_t targetIndexCount, float maxError, float &resultError) {
+	resultError = 0.0f;
+	size_t numVertices = vertices.size();
+
+	// Vertices sharing a position collapse as one point
+	vector<unsigned int> position(numVertices);
+	vector<unsigned int> wedges(numVertices, 0);
+	{
+		struct PositionHash {
+			size_t operator()(const glm::vec3 &p) const {
+				uint32_t bits[3];
+				memcpy(bits, &p, sizeof(bits));
+				return (size_t)(bits[0] * 73856093u ^ bits[1] * 19349663u ^ bits[2] * 83492791u);
+			}
+		};
+		unordered_map<glm::vec3, unsigned int, PositionHash> firstAt;
+		firstAt.reserve(numVertices);
+		for (unsigned int v = 0; v < numVertices; v++) {
+			position[v] = firstAt.emplace(vertices[v].position, v).first->second;
+			wedges[position[v]]++;
+		}
+	}
+
+	// Lock seams, open borders and non-manifold edges so the silhouette and UV layout hold
+	vector<bool> locked(numVertices, false);
+	{
+		unordered_map<uint64_t, unsigned int> edgeUses;
+		edgeUses.reserve(indices.size());
+		for (size_t i = 0; i < indices.size(); i += 3) {
+			for (int k = 0; k < 3; k++) {
+				unsigned int a = position[indices[i + k]], b = position[indices[i + (k + 1) % 3]];
+				edgeUses[((uint64_t)min(a, b) << 32) | max(a, b)]++;
+			}
+		}
+		for (const pair<const uint64_t, unsigned int> &edge : edgeUses) {
+			if (edge.second != 2) {
+				locked[(unsigned int)(edge.first >> 32)] = true;
+				locked[(unsigned int)(edge.first & 0xFFFFFFFF)] = true;
+			}
+		}
+		for (unsigned int v = 0; v < numVertices; v++) {
+			if (wedges[position[v]] > 1 || locked[position[v]]) {
+				locked[v] = true;
+			}
+		}
+	}
+
+	// Plane quadrics accumulated per position
+	vector<Quadric> quadrics(numVertices);
+	for (size_t i = 0; i < indices.size(); i += 3) {
+		glm::dvec3 p0 = vertices[indices[i]].position, p1 = vertices[indices[i + 1]].position, p2 = vertices[indices[i + 2]].position;
+		glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+		double length = glm::length(normal);
+		if (length == 0.0) {
+			continue;
+		}
+		normal /= length;
+		Quadric q = Quadric::plane(normal, -glm::dot(normal, p0), length * 0.5);
+		for (int k = 0; k < 3; k++) {
+			quadrics[position[indices[i + k]]] += q;
+		}
+	}
+
+	auto collapseError = [&](unsigned int from, unsigned int to) {
+		Quadric q = quadrics[position[from]];
+		q += quadrics[position[to]];
+		return q.weight > 0.0 ? (float)sqrt(max(q.evaluate(vertices[to].position), 0.0) / q.weight) : 0.0f;
+	};
+
+	vector<unsigned int> result = indices;
+	vector<unsigned int> remap(numVertices);
+	vector<bool> touched(numVertices);
+	vector<unsigned int> adjacencyOffset(numVertices + 1), adjacency;
+
+	struct Collapse {
+		unsigned int from, to;
+		float error;
+	};
+	vector<Collapse> collapses;
+
+	while (result.size() > targetIndexCount) {
+		// Triangles around each vertex
+		fill(adjacencyOffset.begin(), adjacencyOffset.end(), 0);
+		for (unsigned int index : result) {
+			adjacencyOffset[index + 1]++;
+		}
+		for (size_t v = 0; v < numVertices; v++) {
+			adjacencyOffset[v + 1] += adjacencyOffset[v];
+		}
+		adjacency.resize(result.size());
+		vector<unsigned int> cursor(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+		for (size_t i = 0; i < result.size(); i++) {
+			adjacency[cursor[result[i]]++] = (unsigned int)(i / 3);
+		}
+
+		// Cheapest direction of every edge that may move
+		collapses.clear();
+		for (size_t i = 0; i < result.size(); i += 3) {
+			for (int k = 0; k < 3; k++) {
+				unsigned int a = result[i + k], b = result[i + (k + 1) % 3];
+				if (locked[a] && locked[b]) {
+					continue;
+				}
+
+				float errorAB = locked[a] ? INFINITY : collapseError(a, b);
+				float errorBA = locked[b] ? INFINITY : collapseError(b, a);
+				if (errorAB <= errorBA) {
+					collapses.push_back({ a, b, errorAB });
+				} else {
+					collapses.push_back({ b, a, errorBA });
+				}
+			}
+		}
+		sort(collapses.begin(), collapses.end(), [](const Collapse &x, const Collapse &y) { return x.error < y.error; });
+
+		// Each collapse removes about two triangles, don't overshoot the target
+		size_t trianglesToRemove = (result.size() - targetIndexCount) / 3;
+		size_t collapseLimit = max<size_t>(trianglesToRemove / 2, 1);
+
+		for (unsigned int v = 0; v < numVertices; v++) {
+			remap[v] = v;
+		}
+		fill(touched.begin(), touched.end(), false);
+
+		size_t performed = 0;
+		for (const Collapse &collapse : collapses) {
+			if (performed >= collapseLimit || collapse.error > maxError) {
+				break;
+			}
+			if (touched[collapse.from] || touched[collapse.to]) {
+				continue;
+			}
+
+			// Reject collapses that flip a surviving triangle
+			glm::vec3 target = vertices[collapse.to].position;
+			bool flips = false;
+			for (unsigned int j = adjacencyOffset[collapse.from]; j < adjacencyOffset[collapse.from + 1] && !flips; j++) {
+				const unsigned int *triangle = &result[adjacency[j] * 3];
+				if (position[triangle[0]] == position[collapse.to] || position[triangle[1]] == position[collapse.to] || position[triangle[2]] == position[collapse.to]) {
+					continue;
+				}
+
+				glm::vec3 corners[3], moved[3];
+				for (int k = 0; k < 3; k++) {
+					corners[k] = vertices[triangle[k]].position;
+					moved[k] = triangle[k] == collapse.from ? target : corners[k];
+				}
+				glm::vec3 before = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+				glm::vec3 after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+				flips = glm::dot(before, after) <= 0.0f;
+			}
+			if (flips) {
+				continue;
+			}
+
+			// Neighbours of both ends stay fixed for the rest of the pass so the flip test above remains valid
+			for (unsigned int end : { collapse.from, collapse.to }) {
+				for (unsigned int j = adjacencyOffset[end]; j < adjacencyOffset[end + 1]; j++) {
+					const unsigned int *triangle = &result[adjacency[j] * 3];
+					touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = true;
+				}
+			}
+
+			remap[collapse.from] = collapse.to;
+			quadrics[position[collapse.to]] += quadrics[position[collapse.from]];
+			resultError = max(resultError, collapse.error);
+			performed++;
+		}
+
+		if (performed == 0) {
+			break;
+		}
+
+		// Apply and drop triangles that became degenerate
+		size_t write = 0;
+		for (size_t i = 0; i < result.size(); i += 3) {
+			unsigned int a = remap[result[i]], b = remap[result[i + 1]], c = remap[result[i + 2]];
+			if (position[a] != position[b] && position[b] != position[c] && position[a] != position[c]) {
+				result[write++] = a;
+				result[write++] = b;
+				result[write++] = c;
+			}
+		}
+		result.resize(write);
+	}
+
+	return result;
+}
+
+// Append simplified levels to a mesh's index list, each cache optimized, and record them in mesh.lods
+void buildLodChain(Mesh &mesh, const LodSettings &settings) {
+	mesh.lods.assign(1, { 0, (unsigned int)mesh.indices.size(), 0.0f });
+	mesh.indexCount = (unsigned int)mesh.indices.size();
+
+	vector<unsigned int> previous = mesh.indices;
+	float maxError = settings.maxRelativeError * mesh.bounds.radius;
+	while (mesh.lods.size() < settings.maxLods && previous.size() / 3 > settings.minTriangles) {
+		size_t target = max<size_t>((size_t)(previous.size() / 3 * settings.reduction), settings.minTriangles) * 3;
+
+		float error;
+		vector<unsigned int> simplified = simplifyIndices(mesh.vertices, previous, target, maxError, error);
+
+		// Not worth another level if it barely got smaller
+		if (simplified.empty() || simplified.size() > previous.size() * 0.9f) {
+			break;
+		}
+
+		optimizeVertexCache(simplified, mesh.vertices.size());
+		mesh.lods.push_back({ (unsigned int)mesh.indices.size(), (unsigned int)simplified.size(), max(error, mesh.lods.back().error) });
+		mesh.indices.insert(mesh.indices.end(), simplified.begin(), simplified.end());
+		previous = simplified;
+	}
+}
+
+// Per-frame inputs for screen-space LOD selection
+struct LodView {
+	glm::vec3 cameraPosition = glm::vec3(0.0f);
+	float pixelsPerUnit = 0.0f; // Pixels covered by one unit at distance one, 0 disables LOD
+	float maxPixelError = 1.0f;  // Coarsest level whose error projects to at most this many pixels
+};
+
+// Projection scale from the camera's vertical field of view (zoom) and the viewport height
+LodView makeLodView(const Camera &camera, unsigned int viewportHeight, float maxPixelError = 1.0f) {
+	LodView view;
+	view.cameraPosition = camera.position;
+	view.pixelsPerUnit = viewportHeight / (2.0f * tan(glm::radians(camera.zoom) * 0.5f));
+	view.maxPixelError = maxPixelError;
+	return view;
+}
+
+// Pick the coarsest level whose simplification error, projected at the bounding sphere's nearest point, stays under the limit
+unsigned int selectLod(const Mesh &mesh, const glm::mat4 &model, const LodView &view) {
+	if (view.pixelsPerUnit <= 0.0f || mesh.lods.size() < 2) {
+		return 0;
+	}
+
+	glm::vec3 center = glm::vec3(model * glm::vec4(mesh.bounds.center, 1.0f));
+	float scale = max(max(glm::length(glm::vec3(model[0])), glm::length(glm::vec3(model[1]))), glm::length(glm::vec3(model[2])));
+	float distance = glm::length(center - view.cameraPosition) - mesh.bounds.radius * scale;
+	if (distance <= 0.0f) {
+		return 0;
+	}
+
+	for (unsigned int lod = (unsigned int)mesh.lods.size() - 1; lod > 0; lod--) {
+		float pixels = mesh.lods[lod].error * scale * view.pixelsPerUnit / distance;
+		if (pixels <= view.maxPixelError) {
+			return lod;
+		}
+	}
+	return 0;
+}
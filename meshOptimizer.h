@@ -0,0 +1,421 @@
+#pragma once
+
+#include "mesh.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+// Post-transform cache size the metrics are simulated with, a conservative FIFO
+const unsigned int VERTEX_CACHE_SIZE = 16;
+
+struct VertexCacheStats {
+	float acmr = 0.0f; // Average cache miss ratio, transformed vertices per triangle (0.5 is ideal, 3 is worst)
+	float atvr = 0.0f; // Average transform to vertex ratio, transformed vertices per used vertex (1 is ideal)
+};
+
+struct OverdrawStats {
+	float overdraw = 0.0f; // Fragments passing the depth test per covered pixel (1 is ideal)
+};
+
+// Simulate a FIFO post-transform cache over the index buffer
+VertexCacheStats analyzeVertexCache(const vector<unsigned int> &indices, size_t numVertices, unsigned int cacheSize = VERTEX_CACHE_SIZE) {
+	VertexCacheStats stats;
+	if (indices.empty()) {
+		return stats;
+	}
+
+	// A vertex is in the cache while fewer than cacheSize misses happened since it was loaded
+	vector<unsigned int> loadedAt(numVertices, 0);
+	vector<bool> used(numVertices, false);
+	unsigned int misses = 0, usedVertices = 0;
+	for (unsigned int index : indices) {
+		if (loadedAt[index] == 0 || misses + 1 - loadedAt[index] >= cacheSize) {
+			misses++;
+			loadedAt[index] = misses;
+		}
+		if (!used[index]) {
+			used[index] = true;
+			usedVertices++;
+		}
+	}
+
+	stats.acmr = (float)misses / (float)(indices.size() / 3);
+	stats.atvr = (float)misses / (float)usedVertices;
+	return stats;
+}
+
+// Rasterize the mesh from the six axis directions into a small depth buffer, in submission order like the GPU
+OverdrawStats analyzeOverdraw(const vector<unsigned int> &indices, const vector<Vertex> &vertices) {
+	const int GRID = 256;
+
+	OverdrawStats stats;
+	if (indices.empty()) {
+		return stats;
+	}
+
+	// Normalize into the unit cube so every view uses the whole grid
+	glm::vec3 minPos(INFINITY), maxPos(-INFINITY);
+	for (const Vertex &vertex : vertices) {
+		minPos = glm::min(minPos, vertex.position);
+		maxPos = glm::max(maxPos, vertex.position);
+	}
+	glm::vec3 extent = maxPos - minPos;
+	float scale = 1.0f / max(max(max(extent.x, extent.y), extent.z), 1e-12f);
+
+	vector<float> depth(GRID * GRID);
+	unsigned long long covered = 0, shaded = 0;
+	for (int axis = 0; axis < 3; axis++) {
+		for (int sign = -1; sign <= 1; sign += 2) {
+			fill(depth.begin(), depth.end(), INFINITY);
+
+			for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+				// Project along the axis, x/y stay right handed so winding is preserved
+				glm::vec3 p[3];
+				for (int k = 0; k < 3; k++) {
+					glm::vec3 pos = (vertices[indices[i + k]].position - minPos) * scale;
+					glm::vec3 rotated = axis == 0 ? glm::vec3(pos.y, pos.z, pos.x) : axis == 1 ? glm::vec3(pos.z, pos.x, pos.y) : pos;
+					if (sign < 0) {
+						rotated = glm::vec3(1.0f - rotated.x, rotated.y, 1.0f - rotated.z);
+					}
+					p[k] = glm::vec3(rotated.x * (GRID - 1), rotated.y * (GRID - 1), 1.0f - rotated.z);
+				}
+
+				// Back faces are culled
+				float area = (p[1].x - p[0].x) * (p[2].y - p[0].y) - (p[2].x - p[0].x) * (p[1].y - p[0].y);
+				if (area <= 0.0f) {
+					continue;
+				}
+
+				int x0 = max((int)ceil(min(min(p[0].x, p[1].x), p[2].x)), 0);
+				int x1 = min((int)floor(max(max(p[0].x, p[1].x), p[2].x)), GRID - 1);
+				int y0 = max((int)ceil(min(min(p[0].y, p[1].y), p[2].y)), 0);
+				int y1 = min((int)floor(max(max(p[0].y, p[1].y), p[2].y)), GRID - 1);
+				for (int y = y0; y <= y1; y++) {
+					for (int x = x0; x <= x1; x++) {
+						// Barycentrics from edge functions
+						float w0 = (p[2].x - p[1].x) * (y - p[1].y) - (p[2].y - p[1].y) * (x - p[1].x);
+						float w1 = (p[0].x - p[2].x) * (y - p[2].y) - (p[0].y - p[2].y) * (x - p[2].x);
+						float w2 = area - w0 - w1;
+						if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f) {
+							continue;
+						}
+
+						float z = (w0 * p[0].z + w1 * p[1].z + w2 * p[2].z) / area;
+						float &stored = depth[y * GRID + x];
+						if (z < stored) {
+							covered += stored == INFINITY;
+							shaded++;
+							stored = z;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	stats.overdraw = covered ? (float)shaded / (float)covered : 0.0f;
+	return stats;
+}
+
+// Linear-speed vertex cache optimization (Tom Forsyth). Greedily emits the triangle whose vertices score best
+// against an LRU cache model, favouring recently used vertices and ones with few triangles left.
+void optimizeVertexCache(vector<unsigned int> &indices, size_t numVertices) {
+	const unsigned int CACHE_SIZE = 32;
+	const float CACHE_DECAY_POWER = 1.5f;
+	const float LAST_TRIANGLE_SCORE = 0.75f;
+	const float VALENCE_BOOST_SCALE = 2.0f;
+	const float VALENCE_BOOST_POWER = 0.5f;
+
+	size_t numTriangles = indices.size() / 3;
+	if (numTriangles == 0) {
+		return;
+	}
+
+	// Triangles using each vertex, flattened
+	vector<unsigned int> valence(numVertices, 0);
+	for (unsigned int index : indices) {
+		valence[index]++;
+	}
+	vector<unsigned int> adjacencyOffset(numVertices + 1, 0);
+	for (size_t v = 0; v < numVertices; v++) {
+		adjacencyOffset[v + 1] = adjacencyOffset[v] + valence[v];
+	}
+	vector<unsigned int> adjacency(indices.size());
+	vector<unsigned int> cursor(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+	for (size_t i = 0; i < indices.size(); i++) {
+		adjacency[cursor[indices[i]]++] = (unsigned int)(i / 3);
+	}
+
+	// Score tables, indexed by cache position and remaining valence
+	float cacheScores[CACHE_SIZE];
+	for (unsigned int i = 0; i < CACHE_SIZE; i++) {
+		if (i < 3) {
+			cacheScores[i] = LAST_TRIANGLE_SCORE; // Fixed score so the order within the last triangle doesn't matter
+		} else {
+			cacheScores[i] = pow(1.0f - (float)(i - 3) / (CACHE_SIZE - 3), CACHE_DECAY_POWER);
+		}
+	}
+	auto vertexScore = [&](int cachePosition, unsigned int remaining) {
+		if (remaining == 0) {
+			return -1.0f;
+		}
+		float score = cachePosition < 0 ? 0.0f : cacheScores[cachePosition];
+		return score + VALENCE_BOOST_SCALE * pow((float)remaining, -VALENCE_BOOST_POWER);
+	};
+
+	vector<float> scores(numVertices);
+	for (size_t v = 0; v < numVertices; v++) {
+		scores[v] = vertexScore(-1, valence[v]);
+	}
+	vector<float> triangleScores(numTriangles);
+	for (size_t t = 0; t < numTriangles; t++) {
+		triangleScores[t] = scores[indices[t * 3]] + scores[indices[t * 3 + 1]] + scores[indices[t * 3 + 2]];
+	}
+
+	vector<bool> emitted(numTriangles, false);
+	vector<unsigned int> output;
+	output.reserve(indices.size());
+
+	// Cache holds CACHE_SIZE entries plus room for the three being pushed
+	vector<unsigned int> cache, nextCache;
+	cache.reserve(CACHE_SIZE + 3);
+	nextCache.reserve(CACHE_SIZE + 3);
+
+	size_t scanCursor = 0;
+	int best = 0;
+	while (best >= 0) {
+		emitted[best] = true;
+		unsigned int triangle[3] = { indices[best * 3], indices[best * 3 + 1], indices[best * 3 + 2] };
+		output.insert(output.end(), triangle, triangle + 3);
+
+		// Move the triangle's vertices to the front of the cache
+		nextCache.clear();
+		for (unsigned int vertex : triangle) {
+			if (std::find(nextCache.begin(), nextCache.end(), vertex) == nextCache.end()) {
+				nextCache.push_back(vertex);
+			}
+		}
+		for (unsigned int vertex : cache) {
+			if (vertex != triangle[0] && vertex != triangle[1] && vertex != triangle[2]) {
+				nextCache.push_back(vertex);
+			}
+		}
+
+		// Drop the triangle from its vertices' remaining lists
+		for (unsigned int vertex : triangle) {
+			unsigned int *begin = &adjacency[adjacencyOffset[vertex]];
+			unsigned int *end = begin + valence[vertex];
+			unsigned int *found = std::find(begin, end, (unsigned int)best);
+			if (found != end) {
+				*found = *(end - 1);
+				valence[vertex]--;
+			}
+		}
+
+		// Rescore everything that was in the cache, only their triangles can change score
+		for (size_t i = 0; i < nextCache.size(); i++) {
+			unsigned int vertex = nextCache[i];
+			float score = vertexScore(i < CACHE_SIZE ? (int)i : -1, valence[vertex]);
+			float delta = score - scores[vertex];
+			scores[vertex] = score;
+
+			for (unsigned int j = adjacencyOffset[vertex]; j < adjacencyOffset[vertex] + valence[vertex]; j++) {
+				triangleScores[adjacency[j]] += delta;
+			}
+		}
+		if (nextCache.size() > CACHE_SIZE) {
+			nextCache.resize(CACHE_SIZE);
+		}
+		swap(cache, nextCache);
+
+		// Best triangle touching the cache
+		best = -1;
+		float bestScore = -1.0f;
+		for (unsigned int vertex : cache) {
+			for (unsigned int j = adjacencyOffset[vertex]; j < adjacencyOffset[vertex] + valence[vertex]; j++) {
+				unsigned int t = adjacency[j];
+				if (triangleScores[t] > bestScore) {
+					bestScore = triangleScores[t];
+					best = (int)t;
+				}
+			}
+		}
+
+		// Nothing adjacent left in the cache, restart from the next triangle in input order
+		if (best < 0) {
+			while (scanCursor < numTriangles && emitted[scanCursor]) {
+				scanCursor++;
+			}
+			if (scanCursor < numTriangles) {
+				best = (int)scanCursor;
+			}
+		}
+	}
+
+	indices = output;
+}
+
+// Reorder clusters of a cache-optimized index buffer so outward-facing ones draw first (Sander et al. 2007).
+// Clusters are cut where the cache flushes anyway, and where splitting costs at most threshold x the cache efficiency.
+void optimizeOverdraw(vector<unsigned int> &indices, const vector<Vertex> &vertices, float threshold = 1.05f) {
+	size_t numTriangles = indices.size() / 3;
+	if (numTriangles == 0) {
+		return;
+	}
+
+	// Hard boundaries, triangles where all three vertices miss the cache
+	vector<size_t> hardClusters;
+	{
+		vector<unsigned int> loadedAt(vertices.size(), 0);
+		unsigned int misses = 0;
+		for (size_t t = 0; t < numTriangles; t++) {
+			unsigned int triangleMisses = 0;
+			for (int k = 0; k < 3; k++) {
+				unsigned int index = indices[t * 3 + k];
+				if (loadedAt[index] == 0 || misses + 1 - loadedAt[index] >= VERTEX_CACHE_SIZE) {
+					misses++;
+					triangleMisses++;
+					loadedAt[index] = misses;
+				}
+			}
+			if (t == 0 || triangleMisses == 3) {
+				hardClusters.push_back(t);
+			}
+		}
+		hardClusters.push_back(numTriangles);
+	}
+
+	// Soft boundaries, split a hard cluster whenever the part so far is already cache efficient enough
+	vector<size_t> clusters;
+	{
+		vector<unsigned int> loadedAt(vertices.size(), 0);
+		for (size_t c = 0; c + 1 < hardClusters.size(); c++) {
+			size_t begin = hardClusters[c], end = hardClusters[c + 1];
+
+			// Cache efficiency of the whole hard cluster
+			unsigned int misses = 0;
+			for (size_t i = begin * 3; i < end * 3; i++) {
+				if (loadedAt[indices[i]] == 0 || misses + 1 - loadedAt[indices[i]] >= VERTEX_CACHE_SIZE) {
+					misses++;
+					loadedAt[indices[i]] = misses;
+				}
+			}
+			float clusterAcmr = (float)misses / (float)(end - begin);
+			for (size_t i = begin * 3; i < end * 3; i++) {
+				loadedAt[indices[i]] = 0;
+			}
+
+			clusters.push_back(begin);
+			size_t start = begin;
+			misses = 0;
+			for (size_t t = begin; t < end; t++) {
+				for (int k = 0; k < 3; k++) {
+					unsigned int index = indices[t * 3 + k];
+					if (loadedAt[index] == 0 || misses + 1 - loadedAt[index] >= VERTEX_CACHE_SIZE) {
+						misses++;
+						loadedAt[index] = misses;
+					}
+				}
+
+				// Cut after this triangle and start a fresh cache
+				if (t + 1 < end && (float)misses / (float)(t + 1 - start) <= clusterAcmr * threshold && t + 1 - start >= 8) {
+					for (size_t i = start * 3; i <= t * 3 + 2; i++) {
+						loadedAt[indices[i]] = 0;
+					}
+					start = t + 1;
+					misses = 0;
+					clusters.push_back(start);
+				}
+			}
+			for (size_t i = start * 3; i < end * 3; i++) {
+				loadedAt[indices[i]] = 0;
+			}
+		}
+		clusters.push_back(numTriangles);
+	}
+
+	// Area-weighted centroid and normal per cluster
+	glm::vec3 meshCentroid(0.0f);
+	for (const Vertex &vertex : vertices) {
+		meshCentroid += vertex.position;
+	}
+	meshCentroid /= (float)max<size_t>(vertices.size(), 1);
+
+	size_t numClusters = clusters.size() - 1;
+	vector<float> sortKeys(numClusters);
+	for (size_t c = 0; c < numClusters; c++) {
+		glm::vec3 centroid(0.0f), normal(0.0f);
+		float totalArea = 0.0f;
+		for (size_t t = clusters[c]; t < clusters[c + 1]; t++) {
+			glm::vec3 p0 = vertices[indices[t * 3]].position;
+			glm::vec3 p1 = vertices[indices[t * 3 + 1]].position;
+			glm::vec3 p2 = vertices[indices[t * 3 + 2]].position;
+			glm::vec3 n = glm::cross(p1 - p0, p2 - p0); // Length is twice the area
+			float area = glm::length(n);
+
+			centroid += (p0 + p1 + p2) * (area / 3.0f);
+			normal += n;
+			totalArea += area;
+		}
+		centroid = totalArea > 0.0f ? centroid / totalArea : vertices[indices[clusters[c] * 3]].position;
+		float normalLength = glm::length(normal);
+		sortKeys[c] = normalLength > 0.0f ? glm::dot(centroid - meshCentroid, normal / normalLength) : 0.0f;
+	}
+
+	// Most outward-facing first, ties keep cache order
+	vector<unsigned int> order(numClusters);
+	for (size_t c = 0; c < numClusters; c++) {
+		order[c] = (unsigned int)c;
+	}
+	stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) { return sortKeys[a] > sortKeys[b]; });
+
+	vector<unsigned int> output;
+	output.reserve(indices.size());
+	for (unsigned int c : order) {
+		output.insert(output.end(), indices.begin() + clusters[c] * 3, indices.begin() + clusters[c + 1] * 3);
+	}
+	indices = output;
+}
+
+// Lay vertices out in first-use order so fetches walk the buffer linearly, unreferenced vertices are dropped
+void optimizeVertexFetch(vector<Vertex> &vertices, vector<unsigned int> &indices) {
+	const unsigned int UNUSED = 0xFFFFFFFF;
+
+	vector<unsigned int> remap(vertices.size(), UNUSED);
+	vector<Vertex> reordered;
+	reordered.reserve(vertices.size());
+	for (unsigned int &index : indices) {
+		if (remap[index] == UNUSED) {
+			remap[index] = (unsigned int)reordered.size();
+			reordered.push_back(vertices[index]);
+		}
+		index = remap[index];
+	}
+	vertices = reordered;
+}
+
+struct MeshOptimizationReport {
+	VertexCacheStats cacheBefore, cacheAfter;
+	OverdrawStats overdrawBefore, overdrawAfter;
+};
+
+// Full pass for one mesh: cache order, then overdraw order, then vertex fetch order
+MeshOptimizationReport optimizeMesh(Mesh &mesh, float overdrawThreshold = 1.05f) {
+	MeshOptimizationReport report;
+	report.cacheBefore = analyzeVertexCache(mesh.indices, mesh.vertices.size());
+	report.overdrawBefore = analyzeOverdraw(mesh.indices, mesh.vertices);
+
+	optimizeVertexCache(mesh.indices, mesh.vertices.size());
+	optimizeOverdraw(mesh.indices, mesh.vertices, overdrawThreshold);
+	optimizeVertexFetch(mesh.vertices, mesh.indices);
+
+	report.cacheAfter = analyzeVertexCache(mesh.indices, mesh.vertices.size());
+	report.overdrawAfter = analyzeOverdraw(mesh.indices, mesh.vertices);
+	return report;
+}
@@ -0,0 +1,486 @@
+#pragma once
+
+#include "benchmark.h"
+#include "bounds.h"
+#include "frustumCulling.h"
+#include "glResource.h"
+#include "indirectDraw.h"
+#include "mesh.h"
+#include "meshOptimizer.h"
+#include "renderStats.h"
+#include "shader.h"
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+// Limits of one meshlet, 124 keeps a meshlet's 8-bit local indices a multiple of 4 bytes like mesh shading pipelines expect
+const unsigned int MESHLET_MAX_VERTICES = 64;
+const unsigned int MESHLET_MAX_TRIANGLES = 124;
+
+// Storage buffer binding points used by meshletCull.comp
+const unsigned int MESHLET_STORAGE_BINDING = 7;
+const unsigned int MESHLET_MESH_STORAGE_BINDING = 8;
+const unsigned int MESHLET_COMMAND_STORAGE_BINDING = 9;
+const unsigned int MESHLET_COUNT_STORAGE_BINDING = 10;
+
+// Must match local_size_x in meshletCull.comp
+const unsigned int MESHLET_CULL_GROUP_SIZE = 64;
+
+// Frames of GPU culling totals that may be in flight, each read back once its fence has signalled
+const unsigned int MESHLET_STAT_FRAMES = 3;
+
+static_assert(sizeof(Meshlet) == 64, "Meshlet layout mismatch");
+
+// Normal cones narrower than this test are kept always visible, the cone would rarely cull and costs a test
+const float MESHLET_CONE_MIN_DOT = 0.1f;
+
+// Split the full detail level into meshlets in index order. The optimized vertex cache order already keeps neighbours
+// together, so each meshlet is a contiguous index range and the index buffer stays untouched. Returns the meshlet count.
+size_t buildMeshlets(Mesh &mesh) {
+	mesh.meshlets.clear();
+	if (mesh.lods.empty() || mesh.vertices.empty()) {
+		return 0;
+	}
+
+	const MeshLod &level = mesh.lods[0];
+	const unsigned int *indices = mesh.indices.data() + level.firstIndex;
+
+	// Meshlet that last used each vertex, so nothing needs clearing between meshlets
+	vector<unsigned int> lastMeshlet(mesh.vertices.size(), ~0u);
+	vector<glm::vec3> points;
+	unsigned int first = 0, numVertices = 0;
+
+	auto finish = [&](unsigned int end) {
+		Meshlet meshlet = {};
+		meshlet.firstIndex = level.firstIndex + first;
+		meshlet.indexCount = end - first;
+
+		BoundingSphere sphere = computeBoundingSphere(points.data(), points.size());
+		meshlet.sphere = glm::vec4(sphere.center, sphere.radius);
+
+		// Cone axis is the average facing, the cutoff comes from the triangle furthest from it
+		glm::vec3 axis(0.0f);
+		vector<glm::vec3> normals;
+		for (unsigned int i = first; i < end; i += 3) {
+			glm::vec3 a = mesh.vertices[indices[i]].position, b = mesh.vertices[indices[i + 1]].position, c = mesh.vertices[indices[i + 2]].position;
+			glm::vec3 normal = glm::cross(b - a, c - a);
+			float length = glm::length(normal);
+			normals.push_back(length > 0.0f ? normal / length : glm::vec3(0.0f));
+			axis += normals.back();
+		}
+
+		float axisLength = glm::length(axis);
+		float minDot = -1.0f;
+		if (axisLength > 0.0f) {
+			axis /= axisLength;
+			minDot = 1.0f;
+			for (const glm::vec3 &normal : normals) {
+				// Degenerate triangles never render, so they don't widen the cone
+				if (normal != glm::vec3(0.0f)) {
+					minDot = min(minDot, glm::dot(normal, axis));
+				}
+			}
+		}
+
+		if (minDot <= MESHLET_CONE_MIN_DOT) {
+			meshlet.coneApex = glm::vec4(sphere.center, 0.0f);
+			meshlet.coneAxis = glm::vec4(0.0f, 0.0f, 0.0f, 2.0f); // Cutoff above any dot product, never culled
+		} else {
+			// Apex behind every triangle plane along the axis, from there the cone covers every direction a face is seen from its front
+			float maxT = 0.0f;
+			for (unsigned int i = first, t = 0; i < end; i += 3, t++) {
+				if (normals[t] != glm::vec3(0.0f)) {
+					glm::vec3 a = mesh.vertices[indices[i]].position;
+					maxT = max(maxT, glm::dot(sphere.center - a, normals[t]) / glm::dot(axis, normals[t]));
+				}
+			}
+			meshlet.coneApex = glm::vec4(sphere.center - axis * maxT, 0.0f);
+			meshlet.coneAxis = glm::vec4(axis, sqrt(1.0f - minDot * minDot));
+		}
+
+		mesh.meshlets.push_back(meshlet);
+		points.clear();
+		first = end;
+		numVertices = 0;
+	};
+
+	for (unsigned int i = 0; i + 3 <= level.indexCount; i += 3) {
+		unsigned int newVertices = 0;
+		for (unsigned int j = 0; j < 3; j++) {
+			newVertices += lastMeshlet[indices[i + j]] != (unsigned int)mesh.meshlets.size();
+		}
+		if (numVertices + newVertices > MESHLET_MAX_VERTICES || (i - first) / 3 + 1 > MESHLET_MAX_TRIANGLES) {
+			finish(i);
+		}
+
+		for (unsigned int j = 0; j < 3; j++) {
+			unsigned int index = indices[i + j];
+			if (lastMeshlet[index] != (unsigned int)mesh.meshlets.size()) {
+				lastMeshlet[index] = (unsigned int)mesh.meshlets.size();
+				points.push_back(mesh.vertices[index].position);
+				numVertices++;
+			}
+		}
+	}
+	if (first < level.indexCount / 3 * 3) {
+		finish(level.indexCount / 3 * 3);
+	}
+	return mesh.meshlets.size();
+}
+
+// Frustum and camera in the meshlet's own space. Outside when the sphere is behind a plane, back facing when the camera
+// is inside the cone's negative side: every triangle then faces away.
+bool isMeshletVisible(const Meshlet &meshlet, const Frustum &frustum, const glm::vec3 &cameraPosition) {
+	glm::vec3 center = glm::vec3(meshlet.sphere);
+	for (const glm::vec4 &plane : frustum.planes) {
+		if (glm::dot(glm::vec3(plane), center) + plane.w < -meshlet.sphere.w) {
+			return false;
+		}
+	}
+
+	glm::vec3 toApex = glm::vec3(meshlet.coneApex) - cameraPosition;
+	float distance = glm::length(toApex);
+	return distance == 0.0f || glm::dot(toApex / distance, glm::vec3(meshlet.coneAxis)) < meshlet.coneAxis.w;
+}
+
+enum class MeshletCulling {
+	Off, // Whole meshes only
+	Cpu, // isMeshletVisible on the CPU, surviving meshlets uploaded as indirect commands
+	Gpu  // meshletCull.comp writes the commands and per-mesh counts, no CPU work per meshlet
+};
+
+// std430 per-mesh culling input (MeshCull in meshletCull.comp)
+struct MeshletMeshCull {
+	glm::vec4 planes[6];
+	glm::vec4 cameraPosition; // Mesh space, w is 1 when the mesh's meshlets are drawn this frame
+	unsigned int firstCommand;
+	unsigned int pad0[3];
+};
+
+static_assert(sizeof(MeshletMeshCull) == 128, "MeshCull layout mismatch");
+
+// Program shared by every model, compiled on first use with the context current
+unique_ptr<Shader> sharedMeshletCullShader;
+
+Shader &meshletCullShader() {
+	if (!sharedMeshletCullShader) {
+		sharedMeshletCullShader = make_unique<Shader>("meshletCull.comp");
+	}
+	return *sharedMeshletCullShader;
+}
+
+// Delete the program while the context is still current
+void shutdownMeshletCullShader() {
+	sharedMeshletCullShader.reset();
+}
+
+// Every meshlet of a model, drawn as one multi-draw per mesh with one command per visible meshlet.
+// Per frame: begin(), add() each full detail mesh, cull(), then draw() each added mesh.
+class MeshletDrawList {
+	public:
+		GLBuffer meshletBufferID, meshBufferID, commandBufferID, countBufferID, statBufferID;
+
+		MeshletDrawList() {}
+
+		~MeshletDrawList() {
+			releaseStatFences();
+		}
+
+		// Owns fences
+		MeshletDrawList(const MeshletDrawList &) = delete;
+		MeshletDrawList &operator=(const MeshletDrawList &) = delete;
+
+		// Meshlets with absolute index ranges, uploaded once
+		void build(const vector<Mesh> &meshes) {
+			releaseStatFences();
+			meshlets.clear();
+			firstMeshlet.clear();
+			numMeshlets.clear();
+			for (unsigned int i = 0; i < meshes.size(); i++) {
+				const Mesh &mesh = meshes[i];
+				firstMeshlet.push_back((unsigned int)meshlets.size());
+				numMeshlets.push_back((unsigned int)mesh.meshlets.size());
+				for (Meshlet meshlet : mesh.meshlets) {
+					meshlet.firstIndex += mesh.firstIndex;
+					meshlet.baseVertex = mesh.baseVertex;
+					meshlet.mesh = i;
+					meshlets.push_back(meshlet);
+				}
+			}
+
+			commandStart.assign(meshes.size(), 0);
+			commandCount.assign(meshes.size(), 0);
+			queued.assign(meshes.size(), 0);
+			meshCull.assign(meshes.size(), MeshletMeshCull());
+			if (meshlets.empty()) {
+				return;
+			}
+
+			meshletBufferID = GLBuffer::create();
+			glNamedBufferStorage(meshletBufferID, meshlets.size() * sizeof(Meshlet), meshlets.data(), 0);
+			commandBufferID = GLBuffer::create();
+			glNamedBufferStorage(commandBufferID, meshlets.size() * sizeof(DrawElementsIndirectCommand), NULL, GL_DYNAMIC_STORAGE_BIT);
+			meshBufferID = GLBuffer::create();
+			glNamedBufferStorage(meshBufferID, meshes.size() * sizeof(MeshletMeshCull), NULL, GL_DYNAMIC_STORAGE_BIT);
+
+			// Culled meshlet and triangle totals, then one draw count per mesh
+			countBufferID = GLBuffer::create();
+			glNamedBufferStorage(countBufferID, (2 + meshes.size()) * sizeof(unsigned int), NULL, GL_DYNAMIC_STORAGE_BIT);
+
+			// Totals copied out of the count buffer on the GPU, one pair per frame in flight, read through a persistent mapping
+			GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			statBufferID = GLBuffer::create();
+			glNamedBufferStorage(statBufferID, MESHLET_STAT_FRAMES * 2 * sizeof(unsigned int), NULL, flags);
+			statTotals = (const unsigned int *)glMapNamedBufferRange(statBufferID, 0, MESHLET_STAT_FRAMES * 2 * sizeof(unsigned int), flags);
+		}
+
+		bool empty() const {
+			return meshlets.empty();
+		}
+
+		bool isQueued(unsigned int mesh) const {
+			return queued[mesh] != 0;
+		}
+
+		void begin(MeshletCulling culling) {
+			mode = culling;
+			commands.clear();
+			fill(queued.begin(), queued.end(), 0);
+			if (mode != MeshletCulling::Gpu) {
+				return;
+			}
+
+			// Totals of earlier frames whose copies have landed, counted in this frame's stats. Unsignalled fences are left
+			// for a later frame, the CPU never waits on the GPU here.
+			RenderStats &stats = renderStats();
+			for (unsigned int i = 0; i < MESHLET_STAT_FRAMES; i++) {
+				if (!statFences[i]) {
+					continue;
+				}
+				GLenum result = glClientWaitSync(statFences[i], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+				if (result == GL_ALREADY_SIGNALED || result == GL_CONDITION_SATISFIED) {
+					stats.culledMeshlets += statTotals[i * 2];
+					stats.culledMeshletTriangles += statTotals[i * 2 + 1];
+					glDeleteSync(statFences[i]);
+					statFences[i] = nullptr;
+				}
+			}
+			glClearNamedBufferData(countBufferID, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+			for (MeshletMeshCull &entry : meshCull) {
+				entry.cameraPosition.w = 0.0f;
+			}
+		}
+
+		// Queue a mesh drawn at full detail, frustum and camera in the mesh's own space
+		void add(unsigned int mesh, const Frustum &frustum, const glm::vec3 &cameraPosition) {
+			queued[mesh] = 1;
+			if (mode == MeshletCulling::Gpu) {
+				MeshletMeshCull &entry = meshCull[mesh];
+				for (int i = 0; i < 6; i++) {
+					entry.planes[i] = frustum.planes[i];
+				}
+				entry.cameraPosition = glm::vec4(cameraPosition, 1.0f);
+				entry.firstCommand = firstMeshlet[mesh];
+				return;
+			}
+
+			RenderStats &stats = renderStats();
+			commandStart[mesh] = (unsigned int)commands.size();
+			for (unsigned int i = firstMeshlet[mesh]; i < firstMeshlet[mesh] + numMeshlets[mesh]; i++) {
+				const Meshlet &meshlet = meshlets[i];
+				if (isMeshletVisible(meshlet, frustum, cameraPosition)) {
+					commands.push_back({ meshlet.indexCount, 1, meshlet.firstIndex, (int)meshlet.baseVertex, 0 });
+				} else {
+					stats.culledMeshlets++;
+					stats.culledMeshletTriangles += meshlet.indexCount / 3;
+				}
+			}
+			commandCount[mesh] = (unsigned int)commands.size() - commandStart[mesh];
+		}
+
+		// Upload the CPU commands, or run the culling shader over every meshlet. Leaves the compute program bound on the GPU path.
+		void cull() {
+			if (mode == MeshletCulling::Cpu) {
+				if (!commands.empty()) {
+					glNamedBufferSubData(commandBufferID, 0, commands.size() * sizeof(DrawElementsIndirectCommand), commands.data());
+				}
+				return;
+			}
+
+			glNamedBufferSubData(meshBufferID, 0, meshCull.size() * sizeof(MeshletMeshCull), meshCull.data());
+			Shader &shader = meshletCullShader();
+			shader.use();
+			shader.setInt("numMeshlets", (int)meshlets.size());
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MESHLET_STORAGE_BINDING, meshletBufferID);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MESHLET_MESH_STORAGE_BINDING, meshBufferID);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MESHLET_COMMAND_STORAGE_BINDING, commandBufferID);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MESHLET_COUNT_STORAGE_BINDING, countBufferID);
+			glDispatchCompute(((unsigned int)meshlets.size() + MESHLET_CULL_GROUP_SIZE - 1) / MESHLET_CULL_GROUP_SIZE, 1, 1);
+
+			// Commands and counts are read by the draws that follow, the totals by the copy below
+			glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+			// Into the next readback slot, a frame that finds it still in flight goes uncounted
+			if (!statFences[statSlot]) {
+				glCopyNamedBufferSubData(countBufferID, statBufferID, 0, statSlot * 2 * sizeof(unsigned int), 2 * sizeof(unsigned int));
+				statFences[statSlot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+				statSlot = (statSlot + 1) % MESHLET_STAT_FRAMES;
+			}
+		}
+
+		// Surviving meshlets of one queued mesh. Expects the arena bound and the mesh's textures and uniforms set (Mesh::bind).
+		void draw(unsigned int meshIndex, const Mesh &mesh) {
+			RenderStats &stats = renderStats();
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBufferID);
+			if (mode == MeshletCulling::Gpu) {
+				// Count written by the shader, the triangle stat can only assume everything survived
+				glBindBuffer(GL_PARAMETER_BUFFER, countBufferID);
+				glMultiDrawElementsIndirectCount(GL_TRIANGLES, mesh.indexType(), (void *)(firstMeshlet[meshIndex] * sizeof(DrawElementsIndirectCommand)),
+					(GLintptr)((2 + meshIndex) * sizeof(unsigned int)), numMeshlets[meshIndex], 0);
+				glBindBuffer(GL_PARAMETER_BUFFER, 0);
+				stats.drawCommands += numMeshlets[meshIndex];
+				stats.triangles += mesh.indexCount / 3;
+			} else {
+				glMultiDrawElementsIndirect(GL_TRIANGLES, mesh.indexType(), (void *)(commandStart[meshIndex] * sizeof(DrawElementsIndirectCommand)),
+					commandCount[meshIndex], 0);
+				stats.drawCommands += commandCount[meshIndex];
+				for (unsigned int i = commandStart[meshIndex]; i < commandStart[meshIndex] + commandCount[meshIndex]; i++) {
+					stats.triangles += commands[i].count / 3;
+				}
+			}
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+			stats.drawCalls++;
+			stats.fullDetailTriangles += mesh.indexCount / 3;
+		}
+
+	private:
+		vector<Meshlet> meshlets;         // All meshes, uploaded ranges
+		vector<unsigned int> firstMeshlet; // Per mesh, also its first command slot on the GPU path
+		vector<unsigned int> numMeshlets;
+		MeshletCulling mode = MeshletCulling::Off;
+
+		// This frame's CPU commands, one run per queued mesh
+		vector<DrawElementsIndirectCommand> commands;
+		vector<unsigned int> commandStart, commandCount;
+		vector<uint8_t> queued;
+
+		vector<MeshletMeshCull> meshCull;
+
+		// Readback ring of culled totals, a fence per slot whose copy hasn't been read yet
+		const unsigned int *statTotals = nullptr;
+		GLsync statFences[MESHLET_STAT_FRAMES] = {};
+		unsigned int statSlot = 0;
+
+		void releaseStatFences() {
+			for (GLsync &fence : statFences) {
+				if (fence) {
+					glDeleteSync(fence);
+					fence = nullptr;
+				}
+			}
+			statSlot = 0;
+		}
+};
+
+// Split a dense sphere into meshlets and check the cone and sphere tests against every triangle:
+// a culled meshlet must have no front facing triangle inside the frustum. Logs build and cull rates.
+bool benchmarkMeshletCulling(unsigned int rings = 256, unsigned int segments = 512, int iterations = 100) {
+	vector<Vertex> vertices;
+	vector<unsigned int> indices;
+	for (unsigned int ring = 0; ring <= rings; ring++) {
+		float theta = glm::pi<float>() * ring / rings;
+		for (unsigned int segment = 0; segment <= segments; segment++) {
+			float phi = glm::two_pi<float>() * segment / segments;
+			glm::vec3 position(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+			vertices.push_back({ position, position, glm::vec2((float)segment / segments, (float)ring / rings) });
+		}
+	}
+	for (unsigned int ring = 0; ring < rings; ring++) {
+		for (unsigned int segment = 0; segment < segments; segment++) {
+			unsigned int v = ring * (segments + 1) + segment;
+			unsigned int quad[6] = { v, v + 1, v + segments + 2, v, v + segments + 2, v + segments + 1 };
+			for (unsigned int index : quad) {
+				indices.push_back(index);
+			}
+		}
+	}
+	Mesh mesh(move(vertices), move(indices), vector<Texture>());
+	optimizeMesh(mesh); // Vertex cache order, as import leaves it
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	size_t count = buildMeshlets(mesh);
+	double buildMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+	size_t maxVertices = 0, maxTriangles = 0, coveredIndices = 0, meshletTriangles = 0;
+	for (const Meshlet &meshlet : mesh.meshlets) {
+		vector<unsigned int> used(mesh.indices.begin() + meshlet.firstIndex, mesh.indices.begin() + meshlet.firstIndex + meshlet.indexCount);
+		sort(used.begin(), used.end());
+		maxVertices = max(maxVertices, (size_t)(unique(used.begin(), used.end()) - used.begin()));
+		maxTriangles = max(maxTriangles, (size_t)meshlet.indexCount / 3);
+		meshletTriangles += meshlet.indexCount / 3;
+		coveredIndices += meshlet.indexCount;
+	}
+
+	// Close up and to the side, so both tests have work
+	glm::vec3 cameraPosition(0.5f, 0.3f, 2.0f);
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 100.0f);
+	glm::mat4 view = glm::lookAt(cameraPosition, glm::vec3(0.6f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	Frustum frustum = extractFrustum(projection * view);
+
+	vector<uint8_t> visible(count);
+	size_t numVisible = 0, culledTriangles = 0;
+	start = chrono::steady_clock::now();
+	for (int iteration = 0; iteration < iterations; iteration++) {
+		numVisible = 0;
+		for (size_t i = 0; i < count; i++) {
+			visible[i] = isMeshletVisible(mesh.meshlets[i], frustum, cameraPosition);
+			numVisible += visible[i];
+		}
+	}
+	double cullSeconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+	// Brute force: a front facing triangle with a corner inside the frustum must never be in a culled meshlet
+	size_t wronglyCulled = 0;
+	for (size_t i = 0; i < count; i++) {
+		const Meshlet &meshlet = mesh.meshlets[i];
+		if (visible[i]) {
+			continue;
+		}
+		culledTriangles += meshlet.indexCount / 3;
+		for (unsigned int j = meshlet.firstIndex; j < meshlet.firstIndex + meshlet.indexCount; j += 3) {
+			glm::vec3 a = mesh.vertices[mesh.indices[j]].position, b = mesh.vertices[mesh.indices[j + 1]].position, c = mesh.vertices[mesh.indices[j + 2]].position;
+			glm::vec3 normal = glm::cross(b - a, c - a);
+			bool frontFacing = glm::dot(normal, cameraPosition - a) > 0.0f;
+			BoundingBox corner = { a, glm::vec3(0.0f) };
+			if (frontFacing && isVisible(frustum, corner)) {
+				wronglyCulled++;
+			}
+		}
+	}
+
+	cout << "Meshlets: " << mesh.indexCount / 3 << " triangles -> " << count << " meshlets in " << buildMs << " ms, at most "
+		<< maxVertices << " vertices / " << maxTriangles << " triangles each, " << (double)meshletTriangles / max<size_t>(count, 1) << " triangles on average" << endl;
+	cout << "  " << count - numVisible << " meshlets (" << culledTriangles << " triangles) culled, "
+		<< (double)count * iterations / cullSeconds / 1e6 << " M meshlets/s" << endl;
+	cout << "  " << wronglyCulled << " visible front facing triangles culled" << endl;
+
+	BenchmarkChecks checks("Meshlet benchmark");
+	checks.check("mesh splits into meshlets", count > 0);
+	checks.check("meshlets stay within the vertex and triangle limits", maxVertices <= MESHLET_MAX_VERTICES && maxTriangles <= MESHLET_MAX_TRIANGLES);
+	checks.check("meshlets cover every index", coveredIndices == mesh.indexCount);
+	checks.check("no visible front facing triangle is culled", wronglyCulled == 0);
+	return checks.report();
+}
@@ -1,77 +1,1242 @@
 #pragma once
 
+#include "allocationCounter.h"
+#include "benchmark.h"
+#include "frustumCulling.h"
+#include "geometryArena.h"
+#include "indirectDraw.h"
 #include "mesh.h"
+#include "meshCache.h"
+#include "meshLod.h"
+#include "meshlets.h"
+#include "meshOptimizer.h"
+#include "occlusionCulling.h"
+#include "sceneGraph.h"
 #include "shader.h"
+#include "textureArray.h"
+#include "textureLoader.h"
+#include "textureRegistry.h"
+#include "textureStreaming.h"
+#include "vertexQuantization.h"
+#include "vertexWelding.h"
 
 // Open Asset Import Library
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 
-// Image loading library
-#include "stb_image.h"
-
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <future>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 #include <vector>
 
 using namespace std;
 
+const unsigned int MODEL_IMPORT_FLAGS = aiProcess_Triangulate | aiProcess_FlipUVs;
+
 unsigned int textureFromFile(const char *path, const string &directory);
 
+// How a model is loaded
+struct ModelLoadOptions {
+	bool packVertices = false;    // Upload PackedVertex instead of Vertex, see vertexQuantization.h
+	bool keepCpuGeometry = false; // Keep the vertex/index arrays after upload instead of freeing them
+	unsigned int occluderTriangles = 512; // Meshes with a level of detail this small occlude others, 0 for none
+	bool shortIndices = false;            // Upload 16-bit indices when every mesh has fewer than 65536 vertices
+	bool parallelImport = true;           // Convert, weld, optimize and simplify meshes on loaderThreadPool()
+	bool compressTextures = false;        // Block compress textures with a precomputed mip chain, cached next to each image
+	bool streamTextures = false;          // Upload only the small mips of compressed textures, textureStreamer() brings in finer ones as the LOD and culling draws need them
+	bool textureArrays = false;           // Pack diffuse maps of matching size and format into array pages bound once per draw, see textureArray.h. Packed textures aren't streamed.
+};
+
+// CPU copy of one mesh's occluder geometry, the finest level of detail within the triangle budget
+struct MeshOccluder {
+	unsigned int mesh;
+	vector<glm::vec3> positions;
+	vector<unsigned int> indices;
+};
+
+// CPU half of a model load. Built without a GL context, so it can be produced on a worker thread.
+struct ModelData {
+	string path;
+	string directory;
+	vector<Mesh> meshes; // Arena ranges and material textures, ids are resolved at upload
+	SceneGraph scene;    // Node hierarchy, meshes point into it
+	vector<MeshOccluder> occluders;
+
+	// Packed geometry, either a mapped cache or vertices/indices packed after import
+	unique_ptr<MeshCache> cache;
+	vector<Vertex> vertices;
+	vector<unsigned int> indices;
+
+	ModelLoadOptions options;
+
+	// Optional compact vertex format, uploaded instead of the float vertices when requested
+	vector<PackedVertex> packedVertices;
+
+	// 16-bit copy of the indices, uploaded instead when every mesh fits
+	vector<uint16_t> shortIndices;
+
+	// Unique textures, a non-zero id means another model already uploaded it
+	vector<Texture> textures;
+	vector<string> textureKeys;
+	vector<DecodedImage> images;
+
+	ModelData() {}
+
+	~ModelData() {
+		for (DecodedImage &image : images) {
+			stbi_image_free(image.data);
+		}
+	}
+
+	// Owns decoded pixels
+	ModelData(const ModelData &) = delete;
+	ModelData &operator=(const ModelData &) = delete;
+
+	const Vertex *vertexData() const {
+		return cache ? cache->vertices() : vertices.data();
+	}
+
+	// What actually gets uploaded, Vertex or PackedVertex
+	const void *vertexBytes() const {
+		return options.packVertices ? (const void *)packedVertices.data() : (const void *)vertexData();
+	}
+
+	size_t vertexStride() const {
+		return options.packVertices ? sizeof(PackedVertex) : sizeof(Vertex);
+	}
+
+	const unsigned int *indexData() const {
+		return cache ? cache->indices() : indices.data();
+	}
+
+	// What actually gets uploaded, 16 or 32-bit
+	const void *indexBytes() const {
+		return !shortIndices.empty() ? (const void *)shortIndices.data() : (const void *)indexData();
+	}
+
+	size_t indexStride() const {
+		return !shortIndices.empty() ? sizeof(uint16_t) : sizeof(unsigned int);
+	}
+
+	size_t numVertices() const {
+		return cache ? (size_t)cache->numVertices() : vertices.size();
+	}
+
+	// The 32-bit array may be gone once the 16-bit copy exists
+	size_t numIndices() const {
+		if (!shortIndices.empty()) {
+			return shortIndices.size();
+		}
+		return cache ? (size_t)cache->numIndices() : indices.size();
+	}
+};
+
+// Limits on how much GL upload work a streamed model load may do per frame
+struct UploadBudget {
+	double milliseconds = 2.0;
+	size_t bytes = 8 << 20;
+
+	static UploadBudget unlimited() {
+		UploadBudget budget;
+		budget.milliseconds = INFINITY;
+		budget.bytes = SIZE_MAX;
+		return budget;
+	}
+};
+
 class Model {
 	public:
-		Model(const char *path) {
-			loadModel(path);
+		// Empty model, filled in over several frames by AsyncModelLoader
+		Model() {}
+
+		// Blocking load
+		Model(const char *path, const ModelLoadOptions &options = ModelLoadOptions()) {
+			unique_ptr<ModelData> data = make_unique<ModelData>();
+			data->options = options;
+			if (!importData(path, *data)) {
+				readyPromise.set_value();
+				return;
+			}
+			decodeTextures(*data);
+
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			beginUpload(move(data));
+			UploadBudget budget = UploadBudget::unlimited();
+			continueUpload(budget);
+			cout << "Uploaded " << path << " in " << elapsedMs(start) << " ms" << endl;
+		}
+
+		~Model() {
+			// Give back shared textures, the streamer forgets streamed ones nobody uses any more. Models that never
+			// streamed a texture leave textureStreamer() alone, so it isn't created just to be asked.
+			for (unsigned int i = 0; i < textureKeys.size(); i++) {
+				bool streamed = false;
+				if (TextureRegistry::instance().release(textureKeys[i], streamed) && streamed) {
+					textureStreamer().remove(textureIDs[i]);
+				}
+			}
 		}
 
+		// Owns registry references
+		Model(const Model &) = delete;
+		Model &operator=(const Model &) = delete;
+
+		// Full detail with the model's root at the origin, sets "model" to each mesh's node transform
 		void draw(Shader &shader) {
+			if (!ready) {
+				return;
+			}
+			syncScene();
+
+			// All meshes share one vertex array
+			int modelLocation = modelUniform(shader);
+			arena.bind();
+			texturePages.bind();
 			for (unsigned int i = 0; i < meshes.size(); i++) {
+				shader.setMat4(modelLocation, scene.world[meshes[i].node]);
 				meshes[i].draw(shader);
 			}
+			glBindVertexArray(0);
 		}
 
-	private:
-		vector<Mesh> meshes;
-		vector<Texture> texturesLoaded;
-		string directory;
+		// Draw each mesh at the level of detail its projected size calls for
+		void draw(Shader &shader, const glm::mat4 &model, const LodView &view) {
+			if (!ready) {
+				return;
+			}
+			syncScene();
+
+			int modelLocation = modelUniform(shader);
+			arena.bind();
+			texturePages.bind();
+			for (unsigned int i = 0; i < meshes.size(); i++) {
+				glm::mat4 meshModel = model * scene.world[meshes[i].node];
+				shader.setMat4(modelLocation, meshModel);
+				meshes[i].draw(shader, selectLod(meshes[i], meshModel, view));
+				if (streamTextures) {
+					textureStreamer().request(meshes[i], meshModel, view);
+				}
+			}
+			glBindVertexArray(0);
+		}
+
+		// Same, skipping meshes whose box is outside the view frustum, or hidden in an already rasterized occlusion buffer
+		void draw(Shader &shader, const glm::mat4 &model, const glm::mat4 &viewProjection, const LodView &view, const OcclusionBuffer *occlusion = nullptr) {
+			if (!ready) {
+				return;
+			}
+			syncScene();
+
+			// Planes in model space, the batch holds boxes already placed by their nodes
+			size_t numVisible = cullingBatch.cull(extractFrustum(viewProjection * model), meshVisible.data());
+			RenderStats &stats = renderStats();
+			stats.culledMeshes += (unsigned int)(meshes.size() - numVisible);
+
+			// Pick what each mesh draws first, so meshlets of every full detail mesh are culled in one go
+			bool useMeshlets = meshletCulling != MeshletCulling::Off && !meshlets.empty();
+			if (useMeshlets) {
+				meshlets.begin(meshletCulling);
+			}
+			for (unsigned int i = 0; i < meshes.size(); i++) {
+				meshLods[i] = -1;
+				if (!meshVisible[i]) {
+					continue;
+				}
+
+				meshModels[i] = model * scene.world[meshes[i].node];
+				if (occlusion && !occlusion->isVisible(viewProjection * meshModels[i], meshes[i].box)) {
+					stats.occludedMeshes++;
+					continue;
+				}
+
+				meshLods[i] = (int)selectLod(meshes[i], meshModels[i], view);
+				if (streamTextures) {
+					textureStreamer().request(meshes[i], meshModels[i], view);
+				}
+				if (useMeshlets && meshLods[i] == 0 && !meshes[i].meshlets.empty()) {
+					glm::vec3 meshCamera = glm::vec3(glm::inverse(meshModels[i]) * glm::vec4(view.cameraPosition, 1.0f));
+					meshlets.add(i, extractFrustum(viewProjection * meshModels[i]), meshCamera);
+				}
+			}
+			if (useMeshlets) {
+				meshlets.cull();
+				shader.use();
+			}
+
+			int modelLocation = modelUniform(shader);
+			// Cone culling drops back facing meshlets, so meshes drawn by meshlet drop back faces in the rasterizer too, or
+			// the result would depend on the meshlet split. Other meshes keep the caller's face culling.
+			bool callerCullsFaces = useMeshlets && glIsEnabled(GL_CULL_FACE);
+
+			arena.bind();
+			texturePages.bind();
+			for (unsigned int i = 0; i < meshes.size(); i++) {
+				if (meshLods[i] < 0) {
+					continue;
+				}
+
+				stats.visibleMeshes++;
+				shader.setMat4(modelLocation, meshModels[i]);
+				if (useMeshlets && meshlets.isQueued(i)) {
+					meshes[i].bind(shader);
+					if (!callerCullsFaces) {
+						glEnable(GL_CULL_FACE);
+					}
+					meshlets.draw(i, meshes[i]);
+					if (!callerCullsFaces) {
+						glDisable(GL_CULL_FACE);
+					}
+				} else {
+					meshes[i].draw(shader, (unsigned int)meshLods[i]);
+				}
+			}
+			glBindVertexArray(0);
+		}
+
+		// Cull meshlets of full detail meshes in the culling draw, see meshlets.h
+		void setMeshletCulling(MeshletCulling mode) {
+			meshletCulling = mode;
+		}
+
+		// Queue occluder meshes inside the view frustum, rasterize the buffer before drawing with it
+		void addOccluders(OcclusionBuffer &occlusion, const glm::mat4 &model, const glm::mat4 &viewProjection) {
+			if (!ready) {
+				return;
+			}
+			syncScene();
+
+			Frustum frustum = extractFrustum(viewProjection * model);
+			for (const MeshOccluder &occluder : occluders) {
+				const Mesh &mesh = meshes[occluder.mesh];
+				if (isVisible(frustum, transformBox(mesh.box, scene.world[mesh.node]))) {
+					occlusion.addOccluder(viewProjection * model * scene.world[mesh.node], occluder.positions.data(), occluder.indices.data(), occluder.indices.size());
+				}
+			}
+		}
+
+		// Draw one copy per transform, each mesh is submitted once. Expects a shader with the "instanced" switch (modelShader).
+		void drawInstanced(Shader &shader, const glm::mat4 *transforms, size_t count) {
+			if (!ready || count == 0) {
+				return;
+			}
+
+			syncScene();
+			arena.uploadInstances(transforms, count);
+			shader.setBool("instanced", true);
+
+			// The shader applies the node transform under each instance's
+			int modelLocation = modelUniform(shader);
+			arena.bind();
+			texturePages.bind();
+			for (unsigned int i = 0; i < meshes.size(); i++) {
+				shader.setMat4(modelLocation, scene.world[meshes[i].node]);
+				meshes[i].drawInstanced(shader, (unsigned int)count);
+			}
+			glBindVertexArray(0);
+
+			shader.setBool("instanced", false);
+		}
+
+		void drawInstanced(Shader &shader, const vector<glm::mat4> &transforms) {
+			drawInstanced(shader, transforms.data(), transforms.size());
+		}
+
+		// Whole model in one multi-draw, needs a shader using the material table (modelIndirectShader). Draws nothing and
+		// returns false unless canDrawIndirect(), the caller then draws the model through modelShader instead.
+		bool drawIndirect(Shader &shader) {
+			if (!indirectReady) {
+				return false;
+			}
+			syncScene();
+
+			arena.bind();
+			indirect.submit(shader);
+			glBindVertexArray(0);
+			return true;
+		}
+
+		// Ready, with at most MAX_INDIRECT_TEXTURES textures and none packed into texture array pages
+		bool canDrawIndirect() const {
+			return indirectReady;
+		}
+
+		// Node transforms, move sub-parts with setLocal. Draws pick up the change.
+		SceneGraph &sceneGraph() {
+			return scene;
+		}
+
+		// 0 when queued, 0.5 once the CPU work is done, 1 when drawable
+		float loadProgress() const {
+			return progress;
+		}
+
+		bool isReady() const {
+			return ready;
+		}
+
+		// Vertex and index arrays as uploaded, null unless loaded with keepCpuGeometry
+		const ModelData *cpuGeometry() const {
+			return cpuData.get();
+		}
+
+		// Becomes ready after the last GL upload, or when the load fails
+		shared_future<void> readyFuture() const {
+			return readyShared;
+		}
+
+		// Parse the source (or its mesh cache) into ModelData, touches no GL state
+		static bool importData(const string &path, ModelData &data) {
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			AllocationCounter allocationsAtStart = threadAllocations;
+
+			// Store parent directory
+			data.path = path;
+			data.directory = path.substr(0, path.find_last_of('/'));
+
+			// Skip Assimp entirely when an up-to-date binary cache exists
+			string cachePath = path + ".meshcache";
+			unique_ptr<MeshCache> cache = make_unique<MeshCache>();
+			if (cache->open(cachePath, path, MODEL_IMPORT_FLAGS)) {
+				for (unsigned int i = 0; i < cache->numTextures(); i++) {
+					addUniqueTexture(data, { 0, cache->textureType(i), cache->texturePath(i) });
+				}
+
+				for (unsigned int i = 0; i < cache->numNodes(); i++) {
+					const MeshCacheNode &node = cache->node(i);
+					glm::mat4 transform;
+					memcpy(&transform[0][0], node.transform, sizeof(node.transform));
+					data.scene.addNode(node.parent, transform, cache->nodeName(i));
+				}
+
+				for (unsigned int i = 0; i < cache->numMeshes(); i++) {
+					const MeshCacheEntry &entry = cache->mesh(i);
+
+					// Material textures through the cached path table
+					vector<Texture> textures;
+					const uint32_t *materialTextures = cache->materialTextures(entry);
+					for (unsigned int j = 0; j < entry.numMaterialTextures; j++) {
+						textures.push_back({ 0, cache->textureType(materialTextures[j]), cache->texturePath(materialTextures[j]) });
+					}
+
+					Mesh mesh(entry.baseVertex, entry.firstIndex, entry.numIndices, textures);
+					mesh.vertexCount = entry.numVertices;
+					mesh.node = entry.node;
+					mesh.bounds.center = glm::vec3(entry.boundsCenter[0], entry.boundsCenter[1], entry.boundsCenter[2]);
+					mesh.bounds.radius = entry.boundsRadius;
+					mesh.box.center = glm::vec3(entry.boxCenter[0], entry.boxCenter[1], entry.boxCenter[2]);
+					mesh.box.extents = glm::vec3(entry.boxExtents[0], entry.boxExtents[1], entry.boxExtents[2]);
+
+					// Levels of detail share the index block, the first one is the full mesh
+					const MeshCacheLod *lods = cache->lods(entry);
+					mesh.lods.clear();
+					for (unsigned int j = 0; j < entry.numLods; j++) {
+						mesh.lods.push_back({ lods[j].firstIndex, lods[j].indexCount, lods[j].error });
+					}
+					if (!mesh.lods.empty()) {
+						mesh.indexCount = mesh.lods[0].indexCount;
+					}
+					mesh.meshlets.assign(cache->meshlets(entry), cache->meshlets(entry) + entry.numMeshlets);
+					data.meshes.push_back(move(mesh));
+				}
+
+				data.cache = move(cache);
+				cout << "Loaded " << path << " from mesh cache in " << elapsedMs(start) << " ms" << endl;
+
+				buildOccluders(data);
+				narrowIndices(data);
+				if (data.options.packVertices) {
+					quantizeGeometry(data);
+				}
+				logGeometryMemory(data);
+				logImportCost(data, allocationsAtStart);
+				return true;
+			}
+			cache.reset();
 
-		void loadModel(string path) {
 			// Import scene
 			Assimp::Importer importer;
-			const aiScene *scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+			const aiScene *scene = importer.ReadFile(path, MODEL_IMPORT_FLAGS);
 
 			// Check for errors
 			if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
 				cout << "Scene import failed: " << importer.GetErrorString() << endl;
+				return false;
+			}
+
+			// Keep the node hierarchy, meshes are placed by their node's transform
+			processNodes(scene->mRootNode, scene, data);
+			cout << "Imported " << path << " with Assimp in " << elapsedMs(start) << " ms" << endl;
+
+			// Assimp's JoinIdenticalVertices isn't requested, OBJ faces come in with their own copies
+			weldMeshes(data);
+
+			// Reorder and simplify before caching, so cache hits get both for free
+			optimizeMeshes(data);
+			buildLods(data);
+			splitMeshlets(data);
+
+			if (!writeMeshCache(cachePath, path, MODEL_IMPORT_FLAGS, data.meshes, data.scene)) {
+				cout << "Failed to write mesh cache: " << cachePath << endl;
+			}
+
+			packGeometry(data);
+			buildOccluders(data);
+			narrowIndices(data);
+			if (data.options.packVertices) {
+				quantizeGeometry(data);
+			}
+			logGeometryMemory(data);
+			logImportCost(data, allocationsAtStart);
+			return true;
+		}
+
+		// Time the per-mesh import stages serially and on the pool over a synthetic scene of wavy grids, and check both give the same meshes
+		static void benchmarkImport(unsigned int numMeshes = 500, size_t numTriangles = 1000000) {
+			// Grids 40 quads wide, as many rows as the triangle budget allows
+			unsigned int columns = 40;
+			unsigned int rows = max<unsigned int>(1, (unsigned int)(numTriangles / numMeshes / (2 * columns)));
+			unsigned int gridVertices = (columns + 1) * (rows + 1);
+
+			aiScene scene;
+			scene.mNumMaterials = 1;
+			scene.mMaterials = new aiMaterial *[1] { new aiMaterial() };
+			scene.mNumMeshes = numMeshes;
+			scene.mMeshes = new aiMesh *[numMeshes];
+			scene.mRootNode = new aiNode("root");
+			scene.mRootNode->mNumMeshes = numMeshes;
+			scene.mRootNode->mMeshes = new unsigned int[numMeshes];
+			for (unsigned int m = 0; m < numMeshes; m++) {
+				aiMesh *mesh = new aiMesh();
+				mesh->mNumVertices = gridVertices;
+				mesh->mVertices = new aiVector3D[gridVertices];
+				mesh->mNormals = new aiVector3D[gridVertices];
+				mesh->mTextureCoords[0] = new aiVector3D[gridVertices];
+				mesh->mNumUVComponents[0] = 2;
+				for (unsigned int y = 0; y <= rows; y++) {
+					for (unsigned int x = 0; x <= columns; x++) {
+						unsigned int v = y * (columns + 1) + x;
+						float height = 0.2f * sin(x * 0.3f + m) * cos(y * 0.2f);
+						mesh->mVertices[v] = aiVector3D((float)x, (float)y, height);
+						mesh->mNormals[v] = aiVector3D(0.0f, 0.0f, 1.0f);
+						mesh->mTextureCoords[0][v] = aiVector3D((float)x / columns, (float)y / rows, 0.0f);
+					}
+				}
+
+				mesh->mNumFaces = columns * rows * 2;
+				mesh->mFaces = new aiFace[mesh->mNumFaces];
+				for (unsigned int y = 0, f = 0; y < rows; y++) {
+					for (unsigned int x = 0; x < columns; x++) {
+						unsigned int v = y * (columns + 1) + x;
+						unsigned int quad[2][3] = { { v, v + 1, v + columns + 2 }, { v, v + columns + 2, v + columns + 1 } };
+						for (unsigned int (&corners)[3] : quad) {
+							aiFace &face = mesh->mFaces[f++];
+							face.mNumIndices = 3;
+							face.mIndices = new unsigned int[3] { corners[0], corners[1], corners[2] };
+						}
+					}
+				}
+				scene.mMeshes[m] = mesh;
+				scene.mRootNode->mMeshes[m] = m;
+			}
+
+			cout << "Import benchmark: " << numMeshes << " meshes, " << (size_t)numMeshes * columns * rows * 2 << " triangles, "
+				<< loaderThreadPool().size() << " threads" << endl;
+
+			ModelData results[2];
+			for (int parallel = 0; parallel < 2; parallel++) {
+				ModelData &data = results[parallel];
+				data.options.parallelImport = parallel != 0;
+
+				// Stage logs would drown the timings
+				double stageMs[4];
+				chrono::steady_clock::time_point start = chrono::steady_clock::now();
+				cout.setstate(ios::failbit);
+				processNodes(scene.mRootNode, &scene, data);
+				stageMs[0] = elapsedMs(start);
+				weldMeshes(data);
+				stageMs[1] = elapsedMs(start) - stageMs[0];
+				optimizeMeshes(data);
+				stageMs[2] = elapsedMs(start) - stageMs[0] - stageMs[1];
+				buildLods(data);
+				stageMs[3] = elapsedMs(start) - stageMs[0] - stageMs[1] - stageMs[2];
+				cout.clear();
+
+				cout << "  " << (parallel ? "parallel" : "serial  ") << ": convert " << stageMs[0] << " ms, weld " << stageMs[1] << " ms, optimize "
+					<< stageMs[2] << " ms, LODs " << stageMs[3] << " ms, total " << elapsedMs(start) << " ms" << endl;
+			}
+
+			bool same = results[0].meshes.size() == results[1].meshes.size();
+			for (size_t i = 0; same && i < results[0].meshes.size(); i++) {
+				const Mesh &a = results[0].meshes[i], &b = results[1].meshes[i];
+				same = a.indices == b.indices && a.vertices.size() == b.vertices.size()
+					&& memcmp(a.vertices.data(), b.vertices.data(), a.vertices.size() * sizeof(Vertex)) == 0;
+			}
+			cout << "  serial and parallel output " << (same ? "identical" : "DIFFERENT") << endl;
+		}
+
+		// Time cold loads, Assimp import plus writing the mesh cache, against warm loads from the mapped cache, and check
+		// both give the same meshes. Deletes the model's cache on each cold pass, it is left rewritten.
+		static bool benchmarkMeshCache(const string &path, int iterations = 3) {
+			string cachePath = path + ".meshcache";
+			BenchmarkChecks checks("Mesh cache benchmark");
+
+			double coldMs = 0.0, warmMs = 0.0;
+			int passes = 0;
+			size_t numMeshes = 0, numVertices = 0, numIndices = 0;
+			for (int i = 0; i < iterations; i++) {
+				ModelData cold, warm;
+				remove(cachePath.c_str());
+
+				// Stage logs would drown the timings
+				cout.setstate(ios::failbit);
+				chrono::steady_clock::time_point start = chrono::steady_clock::now();
+				bool imported = importData(path, cold);
+				coldMs += elapsedMs(start);
+				start = chrono::steady_clock::now();
+				bool loaded = importData(path, warm);
+				warmMs += elapsedMs(start);
+				cout.clear();
+
+				checks.check("cold import", imported && !cold.cache);
+				checks.check("warm load from the cache", loaded && warm.cache);
+				if (!imported || !loaded) {
+					break;
+				}
+				passes++;
+
+				// Same ranges and the same bytes to upload
+				bool same = cold.meshes.size() == warm.meshes.size() && cold.numVertices() == warm.numVertices() && cold.numIndices() == warm.numIndices()
+					&& memcmp(cold.vertexBytes(), warm.vertexBytes(), cold.numVertices() * cold.vertexStride()) == 0
+					&& memcmp(cold.indexBytes(), warm.indexBytes(), cold.numIndices() * cold.indexStride()) == 0;
+				for (size_t j = 0; same && j < cold.meshes.size(); j++) {
+					const Mesh &a = cold.meshes[j], &b = warm.meshes[j];
+					same = a.baseVertex == b.baseVertex && a.firstIndex == b.firstIndex && a.indexCount == b.indexCount && a.vertexCount == b.vertexCount
+						&& a.node == b.node && a.lods.size() == b.lods.size() && a.meshlets.size() == b.meshlets.size() && a.textures.size() == b.textures.size();
+				}
+				checks.check("cached meshes match the import", same);
+				numMeshes = cold.meshes.size();
+				numVertices = cold.numVertices();
+				numIndices = cold.numIndices();
+			}
+
+			// Timings of the passes that got through both loads
+			cout << "Mesh cache benchmark: " << path << ", " << numMeshes << " meshes, " << numVertices << " vertices, " << numIndices << " indices" << endl;
+			if (passes > 0) {
+				cout << "  cold (Assimp + cache write): " << coldMs / passes << " ms" << endl;
+				cout << "  warm (mapped cache):         " << warmMs / passes << " ms" << endl;
+			}
+			return checks.report();
+		}
+
+		// Decode textures not yet resident anywhere in parallel, touches no GL state
+		static void decodeTextures(ModelData &data) {
+			TextureRegistry &registry = TextureRegistry::instance();
+			vector<string> filenames;
+			vector<unsigned int> pending;
+			for (unsigned int i = 0; i < data.textures.size(); i++) {
+				// Reuse textures other models already uploaded. Array layers aren't shared, a packed model decodes its own
+				// copy of every texture that may go into a page.
+				data.textureKeys.push_back(TextureRegistry::canonicalPath(data.directory + '/' + data.textures[i].path));
+				bool packable = data.options.textureArrays && packsIntoTextureArray(data.textures[i]);
+				if (packable || !registry.acquire(data.textureKeys[i], data.textures[i].id)) {
+					filenames.push_back(data.textureKeys[i]);
+					pending.push_back(i);
+				}
+			}
+
+			data.images.resize(data.textures.size());
+			if (pending.empty()) {
 				return;
 			}
 
-			// Store parent directory
-			directory = path.substr(0, path.find_last_of('/'));
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			ThreadPool &pool = loaderThreadPool();
+			vector<DecodedImage> images = decodeImages(filenames, pool, data.options.compressTextures);
+			for (unsigned int i = 0; i < pending.size(); i++) {
+				data.images[pending[i]] = images[i];
+			}
+			cout << "Decoded " << pending.size() << " textures on " << pool.size() << " threads in " << elapsedMs(start) << " ms" << endl;
+			if (data.options.compressTextures) {
+				logTextureCompression(images);
+			}
+		}
+
+		// Take over CPU data for upload, must run on the context thread. Null data marks a failed load.
+		void beginUpload(unique_ptr<ModelData> data) {
+			if (!data) {
+				readyPromise.set_value();
+				return;
+			}
+
+			pending = move(data);
+			verticesUploaded = 0;
+			indicesUploaded = 0;
+			texturesUploaded = 0;
+
+			arena.allocate(pending->numVertices(), pending->numIndices(), pending->options.packVertices, pending->indexStride());
+
+			totalUploadBytes = pending->numVertices() * pending->vertexStride() + pending->numIndices() * pending->indexStride();
+			for (const DecodedImage &image : pending->images) {
+				totalUploadBytes += image.uploadBytes();
+			}
+			uploadedBytes = 0;
+
+			if (pending->options.textureArrays) {
+				texturePages.plan(pending->images, pending->textures);
+				cout << "Packing " << texturePages.numLayers() << " of " << pending->images.size() << " textures into " << texturePages.numPages() << " texture array pages" << endl;
+			}
+		}
+
+		// Do GL uploads until the budget runs out, budget is reduced by what was spent. Returns true once drawable.
+		bool continueUpload(UploadBudget &budget) {
+			if (!pending) {
+				return true;
+			}
+
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			size_t bytes = 0;
+			bool first = true;
+			auto withinBudget = [&]() {
+				// Always make some progress, even on an exhausted budget
+				bool within = first || (bytes < budget.bytes && elapsedMs(start) < budget.milliseconds);
+				first = false;
+				return within;
+			};
+
+			// Geometry in chunks sized to what's left of the byte budget
+			size_t stride = pending->vertexStride();
+			while (verticesUploaded < pending->numVertices() && withinBudget()) {
+				size_t count = min(pending->numVertices() - verticesUploaded, max<size_t>((budget.bytes - min(bytes, budget.bytes)) / stride, 1024));
+				arena.uploadVertices(verticesUploaded, (const unsigned char *)pending->vertexBytes() + verticesUploaded * stride, count);
+				verticesUploaded += count;
+				bytes += count * stride;
+			}
+			size_t indexStride = pending->indexStride();
+			while (verticesUploaded == pending->numVertices() && indicesUploaded < pending->numIndices() && withinBudget()) {
+				size_t count = min(pending->numIndices() - indicesUploaded, max<size_t>((budget.bytes - min(bytes, budget.bytes)) / indexStride, 4096));
+				arena.uploadIndices(indicesUploaded, (const unsigned char *)pending->indexBytes() + indicesUploaded * indexStride, count);
+				indicesUploaded += count;
+				bytes += count * indexStride;
+			}
+
+			// One texture at a time
+			while (indicesUploaded == pending->numIndices() && texturesUploaded < pending->textures.size() && withinBudget()) {
+				bytes += uploadPendingTexture(texturesUploaded++);
+			}
+
+			uploadedBytes += bytes;
+			budget.bytes -= min(bytes, budget.bytes);
+			budget.milliseconds -= elapsedMs(start);
+
+			if (texturesUploaded < pending->textures.size() || indicesUploaded < pending->numIndices()) {
+				progress = 0.5f + 0.5f * (float)uploadedBytes / (float)max<size_t>(totalUploadBytes, 1);
+				return false;
+			}
+
+			finishUpload();
+			return true;
+		}
+
+	private:
+		friend class AsyncModelLoader;
+
+		vector<Mesh> meshes;
+		GeometryArena arena;
+		IndirectDrawList indirect;
+		bool indirectReady = false;
+		SceneGraph scene;
+		uint64_t sceneVersion = ~0ull; // Scene version the culling boxes and node buffer were built from
+		CullingBatch cullingBatch;     // Mesh boxes placed by their nodes, same order as meshes
+		vector<uint8_t> meshVisible;   // Culling result, reused every frame
+		vector<int> meshLods;          // Level each mesh draws at this frame, -1 when culled
+		vector<glm::mat4> meshModels;  // Model matrix each mesh draws with this frame
+		MeshletDrawList meshlets;
+		MeshletCulling meshletCulling = MeshletCulling::Off;
+		vector<MeshOccluder> occluders;
+		unsigned int modelShaderID = 0;
+		int modelLocation = -1;
+		unordered_map<string, Texture> texturesLoaded; // Keyed by material texture path
+		vector<string> textureKeys;                    // Registry references held by this model
+		vector<unsigned int> textureIDs;               // Same order as textureKeys
+		bool streamTextures = false;                   // Draws report texture sizes to textureStreamer()
+		TextureArrayPages texturePages;                // Empty unless loaded with textureArrays
+		unordered_map<string, TextureLayer> textureLayers; // Packed textures by material texture path
+
+		// Load state, progress is written by loader threads
+		atomic<float> progress = { 0.0f };
+		bool ready = false;
+		promise<void> readyPromise;
+		shared_future<void> readyShared = readyPromise.get_future().share();
+
+		// In-flight upload, and the CPU copy kept afterwards if asked for
+		unique_ptr<ModelData> pending;
+		unique_ptr<ModelData> cpuData;
+		size_t verticesUploaded = 0, indicesUploaded = 0, texturesUploaded = 0;
+		size_t totalUploadBytes = 0, uploadedBytes = 0;
+
+		void setProgress(float value) {
+			progress = value;
+		}
+
+		static double elapsedMs(chrono::steady_clock::time_point start) {
+			return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		}
+
+		// body(i) for every mesh, on loaderThreadPool() unless the options say otherwise. Each call only touches its own mesh.
+		// Allocations made on the workers are added to the calling thread's count, so import costs stay complete.
+		template <typename Function>
+		static void forEachMesh(ModelData &data, Function body) {
+			if (!data.options.parallelImport) {
+				for (size_t i = 0; i < data.meshes.size(); i++) {
+					body(i);
+				}
+				return;
+			}
+
+			thread::id caller = this_thread::get_id();
+			mutex counterMutex;
+			AllocationCounter workerAllocations;
+			loaderThreadPool().parallelFor(data.meshes.size(), [&](size_t i) {
+				AllocationCounter before = threadAllocations;
+				body(i);
+				if (this_thread::get_id() != caller) {
+					lock_guard<mutex> lock(counterMutex);
+					workerAllocations += threadAllocations - before;
+				}
+			});
+			threadAllocations += workerAllocations;
+		}
+
+		static void addUniqueTexture(ModelData &data, const Texture &texture) {
+			for (const Texture &other : data.textures) {
+				if (other.path == texture.path) {
+					return;
+				}
+			}
+			data.textures.push_back(texture);
+		}
+
+		// Vertex cache, overdraw and vertex fetch ordering for every mesh, with before/after metrics
+		static void optimizeMeshes(ModelData &data) {
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			double transformsBefore = 0.0, transformsAfter = 0.0;
+			size_t numTriangles = 0;
+			vector<MeshOptimizationReport> reports(data.meshes.size());
+			vector<size_t> meshTriangles(data.meshes.size());
+			forEachMesh(data, [&](size_t i) {
+				meshTriangles[i] = data.meshes[i].indices.size() / 3;
+				reports[i] = optimizeMesh(data.meshes[i]);
+			});
+
+			// Reported in mesh order whatever order the work ran in
+			for (unsigned int i = 0; i < data.meshes.size(); i++) {
+				size_t triangles = meshTriangles[i];
+				const MeshOptimizationReport &report = reports[i];
+
+				cout << "Mesh " << i << " (" << triangles << " triangles): ACMR " << report.cacheBefore.acmr << " -> " << report.cacheAfter.acmr
+					<< ", ATVR " << report.cacheBefore.atvr << " -> " << report.cacheAfter.atvr
+					<< ", overdraw " << report.overdrawBefore.overdraw << " -> " << report.overdrawAfter.overdraw << endl;
+
+				transformsBefore += report.cacheBefore.acmr * triangles;
+				transformsAfter += report.cacheAfter.acmr * triangles;
+				numTriangles += triangles;
+			}
+
+			if (numTriangles > 0) {
+				cout << "Optimized " << data.meshes.size() << " meshes in " << elapsedMs(start) << " ms, model ACMR "
+					<< transformsBefore / numTriangles << " -> " << transformsAfter / numTriangles << endl;
+			}
+		}
+
+		// Simplified index lists appended after each mesh's own, see buildLodChain
+		static void buildLods(ModelData &data) {
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			LodSettings settings;
+			forEachMesh(data, [&](size_t i) {
+				buildLodChain(data.meshes[i], settings);
+			});
+
+			vector<size_t> triangles(settings.maxLods, 0);
+			for (const Mesh &mesh : data.meshes) {
+				for (unsigned int lod = 0; lod < settings.maxLods; lod++) {
+					// Meshes with a shorter chain use their coarsest level
+					triangles[lod] += mesh.lods[min<size_t>(lod, mesh.lods.size() - 1)].indexCount / 3;
+				}
+			}
+
+			cout << "Built LODs in " << elapsedMs(start) << " ms, triangles per level:";
+			for (size_t count : triangles) {
+				cout << " " << count;
+			}
+			cout << endl;
+		}
+
+		// Meshlets of every full detail level, stored in the cache with the LODs
+		static void splitMeshlets(ModelData &data) {
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			forEachMesh(data, [&](size_t i) {
+				buildMeshlets(data.meshes[i]);
+			});
+
+			size_t numMeshlets = 0, numTriangles = 0;
+			for (const Mesh &mesh : data.meshes) {
+				numMeshlets += mesh.meshlets.size();
+				numTriangles += mesh.lods.empty() ? 0 : mesh.lods[0].indexCount / 3;
+			}
+			cout << "Built " << numMeshlets << " meshlets in " << elapsedMs(start) << " ms, " << (numMeshlets ? (double)numTriangles / numMeshlets : 0.0)
+				<< " triangles each on average" << endl;
+		}
+
+		// Merge duplicate vertices per mesh and report what it saves
+		static void weldMeshes(ModelData &data) {
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			vector<WeldReport> reports(data.meshes.size());
+			forEachMesh(data, [&](size_t i) {
+				reports[i] = weldVertices(data.meshes[i]);
+			});
+
+			size_t verticesBefore = 0, verticesAfter = 0, bytesSaved = 0;
+			for (unsigned int i = 0; i < data.meshes.size(); i++) {
+				const WeldReport &report = reports[i];
+				size_t saved = report.vertexBytesBefore() - report.vertexBytesAfter();
+				cout << "Mesh " << i << " welded " << report.verticesBefore << " -> " << report.verticesAfter << " vertices, " << saved / 1024 << " KB saved";
+				if (report.fitsShortIndices()) {
+					cout << ", " << report.shortIndexSavings() / 1024 << " KB more with 16-bit indices";
+				}
+				cout << endl;
+
+				verticesBefore += report.verticesBefore;
+				verticesAfter += report.verticesAfter;
+				bytesSaved += saved;
+			}
+			cout << "Welded " << verticesBefore << " -> " << verticesAfter << " vertices in " << elapsedMs(start) << " ms, " << bytesSaved / 1024 << " KB saved" << endl;
+		}
+
+		// 16-bit indices for the whole arena when every mesh's vertex range fits, indices are relative to the base vertex
+		static void narrowIndices(ModelData &data) {
+			if (!data.options.shortIndices) {
+				return;
+			}
+			for (const Mesh &mesh : data.meshes) {
+				if (mesh.vertexCount >= 65536) {
+					return;
+				}
+			}
+
+			const unsigned int *indices = data.indexData();
+			data.shortIndices.resize(data.numIndices());
+			for (size_t i = 0; i < data.shortIndices.size(); i++) {
+				data.shortIndices[i] = (uint16_t)indices[i];
+			}
+			for (Mesh &mesh : data.meshes) {
+				mesh.shortIndices = true;
+			}
+			cout << "Narrowed " << data.shortIndices.size() << " indices to 16 bits, " << data.shortIndices.size() * sizeof(uint16_t) / 1024 << " KB saved" << endl;
+
+			// Keep the 32-bit copy only for callers that asked for CPU geometry, a mapped cache is simply left unused
+			if (!data.options.keepCpuGeometry) {
+				vector<unsigned int>().swap(data.indices);
+			}
+		}
+
+		// Copy positions and indices of small enough meshes, they outlive the float vertices
+		static void buildOccluders(ModelData &data) {
+			if (data.options.occluderTriangles == 0) {
+				return;
+			}
 
-			// Recursively process nodes
-			processNode(scene->mRootNode, scene);
+			const Vertex *vertices = data.vertexData();
+			const unsigned int *indices = data.indexData();
+			for (unsigned int i = 0; i < data.meshes.size(); i++) {
+				const Mesh &mesh = data.meshes[i];
+				const MeshLod *level = nullptr;
+				for (const MeshLod &lod : mesh.lods) {
+					if (lod.indexCount / 3 <= data.options.occluderTriangles) {
+						level = &lod;
+						break;
+					}
+				}
+				if (!level || level->indexCount == 0) {
+					continue;
+				}
+
+				// Only the vertices this level uses
+				MeshOccluder occluder;
+				occluder.mesh = i;
+				vector<int> remap(mesh.vertexCount, -1);
+				for (unsigned int j = 0; j < level->indexCount; j++) {
+					unsigned int index = indices[mesh.firstIndex + level->firstIndex + j];
+					if (remap[index] < 0) {
+						remap[index] = (int)occluder.positions.size();
+						occluder.positions.push_back(vertices[mesh.baseVertex + index].position);
+					}
+					occluder.indices.push_back((unsigned int)remap[index]);
+				}
+				data.occluders.push_back(move(occluder));
+			}
 		}
 
-		void processNode(aiNode *node, const aiScene *scene) {
-			// Process all meshes in current node
-			for (unsigned int i = 0; i < node->mNumMeshes; i++) {
+		// Convert to PackedVertex with per-mesh bounds, and report how far the result is from the float data
+		static void quantizeGeometry(ModelData &data) {
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			data.packedVertices.resize(data.numVertices());
+
+			QuantizationError total;
+			for (Mesh &mesh : data.meshes) {
+				total.merge(quantizeVertices(data.vertexData() + mesh.baseVertex, mesh.vertexCount, &data.packedVertices[mesh.baseVertex], mesh));
+			}
+
+			cout << "Packed " << total.numVertices << " vertices in " << elapsedMs(start) << " ms, position error max " << total.maxPosition
+				<< " rms " << total.rmsPosition() << ", normal error max " << total.maxNormalDegrees << " deg, texcoord error max " << total.maxTexCoord << endl;
+
+			// Float copy is no longer needed, a mapped cache is simply left unused
+			vector<Vertex>().swap(data.vertices);
+		}
+
+		// Per texture: where the chain came from, how fast it compressed and what it saves in VRAM
+		static void logTextureCompression(const vector<DecodedImage> &images) {
+			size_t compressedBytes = 0, uncompressedBytes = 0;
+			double decodeMs = 0.0, compressMs = 0.0;
+			for (const DecodedImage &image : images) {
+				if (!image.compressed) {
+					continue;
+				}
+
+				const CompressedImage &compressed = *image.compressed;
+				cout << "Texture " << image.filename << " (" << image.width << "x" << image.height << " " << blockFormatName(compressed.format) << ", "
+					<< compressed.levels.size() << " levels): ";
+				if (image.fromCache) {
+					cout << "texture cache in " << image.decodeMs << " ms";
+				} else {
+					double megapixels = (double)image.width * image.height * 4.0 / 3.0 / 1e6;
+					cout << "decoded in " << image.decodeMs << " ms, compressed in " << image.compressMs << " ms (" << megapixels / (image.compressMs / 1000.0) << " MP/s)";
+				}
+				cout << ", " << compressed.totalBytes() / 1024 << " KB instead of " << compressed.uncompressedBytes() / 1024 << " KB" << endl;
+
+				compressedBytes += compressed.totalBytes();
+				uncompressedBytes += compressed.uncompressedBytes();
+				decodeMs += image.decodeMs;
+				compressMs += image.compressMs;
+			}
+			cout << "Compressed textures: " << compressedBytes / 1024 << " KB of VRAM, " << (uncompressedBytes - compressedBytes) / 1024 << " KB saved, "
+				<< decodeMs << " ms decoding or mapping and " << compressMs << " ms compressing across threads" << endl;
+		}
+
+		static void logImportCost(const ModelData &data, const AllocationCounter &allocationsAtStart) {
+			AllocationCounter cost = threadAllocations - allocationsAtStart;
+			cout << "Import of " << data.path << ": ";
+			if (ALLOCATION_COUNTING) {
+				cout << cost.allocations << " allocations, " << cost.allocatedBytes / 1024 << " KB allocated, ";
+			}
+			cout << cost.copiedBytes / 1024 << " KB of geometry copied" << endl;
+		}
+
+		static void logGeometryMemory(const ModelData &data) {
+			size_t vertexBytes = data.numVertices() * data.vertexStride();
+			size_t floatVertexBytes = data.numVertices() * sizeof(Vertex);
+			size_t indexBytes = data.numIndices() * data.indexStride();
+
+			cout << "Geometry for " << data.path << ": " << data.numVertices() << " vertices " << vertexBytes / 1024 << " KB, "
+				<< data.numIndices() << " indices " << indexBytes / 1024 << " KB, total " << (vertexBytes + indexBytes) / 1024 << " KB";
+			if (data.options.packVertices) {
+				cout << " (float vertices would be " << (floatVertexBytes + indexBytes) / 1024 << " KB)";
+			}
+			cout << endl;
+		}
+
+		// Lay every mesh's geometry back to back and record where each one landed
+		static void packGeometry(ModelData &data) {
+			size_t numVertices = 0, numIndices = 0;
+			for (const Mesh &mesh : data.meshes) {
+				numVertices += mesh.vertices.size();
+				numIndices += mesh.indices.size();
+			}
+			data.vertices.reserve(numVertices);
+			data.indices.reserve(numIndices);
+
+			for (Mesh &mesh : data.meshes) {
+				mesh.baseVertex = (unsigned int)data.vertices.size();
+				mesh.firstIndex = (unsigned int)data.indices.size();
+				mesh.vertexCount = (unsigned int)mesh.vertices.size();
+				data.vertices.insert(data.vertices.end(), mesh.vertices.begin(), mesh.vertices.end());
+				data.indices.insert(data.indices.end(), mesh.indices.begin(), mesh.indices.end());
+				threadAllocations.copiedBytes += mesh.vertices.size() * sizeof(Vertex) + mesh.indices.size() * sizeof(unsigned int);
+
+				// The packed copy is the one that gets uploaded
+				vector<Vertex>().swap(mesh.vertices);
+				vector<unsigned int>().swap(mesh.indices);
+			}
+		}
+
+		// Returns the number of bytes sent to GL
+		size_t uploadPendingTexture(unsigned int i) {
+			Texture texture = pending->textures[i];
+			const string &key = pending->textureKeys[i];
+			DecodedImage &image = pending->images[i];
+			size_t bytes = image.uploadBytes();
+
+			// Into its array page, which this model owns outright
+			TextureLayer layer = texturePages.layer(i);
+			if (layer.page >= 0) {
+				texturePages.upload(i, image);
+				stbi_image_free(image.data);
+				image.data = nullptr;
+				image.compressed.reset();
+				textureLayers[texture.path] = layer;
+				return bytes;
+			}
+
+			// Another model may have uploaded the same file while this one was decoding
+			TextureRegistry &registry = TextureRegistry::instance();
+			if (texture.id == 0 && !registry.acquire(key, texture.id)) {
+				bool streamed = pending->options.streamTextures && image.compressed;
+				if (streamed) {
+					texture.id = textureStreamer().add(image.compressed);
+				} else {
+					texture.id = uploadTexture(image);
+				}
+				registry.add(key, texture.id, streamed);
+			}
+			stbi_image_free(image.data);
+			image.data = nullptr;
+			image.compressed.reset();
+
+			texturesLoaded[texture.path] = texture;
+			textureKeys.push_back(key);
+			textureIDs.push_back(texture.id);
+			return bytes;
+		}
+
+		// Bring world matrices up to date and refresh what's derived from them
+		void syncScene() {
+			scene.update();
+			if (sceneVersion == scene.version()) {
+				return;
+			}
+
+			cullingBatch.clear();
+			for (const Mesh &mesh : meshes) {
+				cullingBatch.add(transformBox(mesh.box, scene.world[mesh.node]));
+			}
+			indirect.updateNodes(scene.world);
+			sceneVersion = scene.version();
+		}
+
+		// "model" handle for the last shader used
+		int modelUniform(Shader &shader) {
+			if (modelShaderID != shader.ID) {
+				modelLocation = shader.getLocation("model");
+				modelShaderID = shader.ID;
+			}
+			return modelLocation;
+		}
+
+		void finishUpload() {
+			// Resolve material textures now that every texture has a GL handle or a layer, packed ones keep id 0
+			texturePages.finish();
+			meshes = move(pending->meshes);
+			for (Mesh &mesh : meshes) {
+				for (Texture &texture : mesh.textures) {
+					unordered_map<string, TextureLayer>::iterator packed = textureLayers.find(texture.path);
+					if (packed == textureLayers.end()) {
+						texture.id = texturesLoaded[texture.path].id;
+					} else if (texture.type == "texture_diffuse" && mesh.diffusePage < 0) {
+						mesh.diffusePage = packed->second.page;
+						mesh.diffuseLayer = packed->second.layer;
+					}
+				}
+			}
+
+			// The indirect shader samples a table of 2D textures, a packed model draws per mesh instead
+			indirectReady = texturePages.empty() && indirect.build(meshes);
+			streamTextures = pending->options.streamTextures;
+			scene = move(pending->scene);
+			occluders = move(pending->occluders);
+			meshVisible.assign(meshes.size(), 1);
+			meshLods.assign(meshes.size(), -1);
+			meshModels.assign(meshes.size(), glm::mat4(1.0f));
+			meshlets.build(meshes);
+
+			// Meshes were moved out, what's left is the uploaded geometry
+			if (pending->options.keepCpuGeometry) {
+				cpuData = move(pending);
+			}
+			pending.reset();
+			progress = 1.0f;
+			ready = true;
+			readyPromise.set_value();
+		}
+
+		// Breadth first so the scene graph gets its nodes level by level. Meshes are converted afterwards,
+		// in parallel into slots laid out here, so their order never depends on scheduling.
+		static void processNodes(aiNode *root, const aiScene *scene, ModelData &data) {
+			vector<const aiMesh *> sources;
+			vector<pair<aiNode *, int>> queue = { { root, -1 } };
+			for (size_t next = 0; next < queue.size(); next++) {
+				aiNode *node = queue[next].first;
+				int index = data.scene.addNode(queue[next].second, toGlm(node->mTransformation), node->mName.C_Str());
+
 				// Nodes contain indices to scene's mesh array
-				aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-				meshes.push_back(processMesh(mesh, scene));
+				for (unsigned int i = 0; i < node->mNumMeshes; i++) {
+					sources.push_back(scene->mMeshes[node->mMeshes[i]]);
+					data.meshes.emplace_back(vector<Vertex>(), vector<unsigned int>(), vector<Texture>());
+					data.meshes.back().node = (unsigned int)index;
+				}
+
+				for (unsigned int i = 0; i < node->mNumChildren; i++) {
+					queue.push_back({ node->mChildren[i], index });
+				}
+			}
+
+			// Material textures once per material rather than per mesh, serial since they fill the shared texture table
+			vector<vector<Texture>> materials(scene->mNumMaterials);
+			vector<bool> materialLoaded(scene->mNumMaterials, false);
+			for (unsigned int i = 0; i < sources.size(); i++) {
+				unsigned int material = sources[i]->mMaterialIndex;
+				if (material < scene->mNumMaterials && !materialLoaded[material]) {
+					materials[material] = loadMaterial(scene->mMaterials[material], data);
+					materialLoaded[material] = true;
+				}
+				if (material < scene->mNumMaterials) {
+					data.meshes[i].textures = materials[material];
+				}
 			}
 
-			// Process child nodes
-			for (unsigned int i = 0; i < node->mNumChildren; i++) {
-				processNode(node->mChildren[i], scene);
+			forEachMesh(data, [&](size_t i) {
+				processMesh(sources[i], data.meshes[i]);
+			});
+		}
+
+		// Assimp matrices are row major
+		static glm::mat4 toGlm(const aiMatrix4x4 &matrix) {
+			glm::mat4 result;
+			for (int row = 0; row < 4; row++) {
+				for (int column = 0; column < 4; column++) {
+					result[column][row] = matrix[row][column];
+				}
 			}
+			return result;
 		}
 
-		Mesh processMesh(aiMesh *mesh, const aiScene *scene) {
+		// Fill a mesh from Assimp's arrays. Output is sized up front and written in place, and nothing shared
+		// is touched, so different meshes can be converted at once.
+		static void processMesh(const aiMesh *mesh, Mesh &result) {
 			// Process vertices
-			vector<Vertex> vertices;
+			result.vertices.resize(mesh->mNumVertices);
 			for (unsigned int i = 0; i < mesh->mNumVertices; i++) {
-				Vertex vertex;
+				Vertex &vertex = result.vertices[i];
 
 				// Process position
 				aiVector3D pos = mesh->mVertices[i];
@@ -89,42 +1254,40 @@ class Model {
 					// No texcoords
 					vertex.texCoords = glm::vec2(0.0f, 0.0f);
 				}
-
-				// Push vertex
-				vertices.push_back(vertex);
 			}
 
-			// Process indices
-			vector<unsigned int> indices;
+			// Process indices, three per face once triangulated but points and lines can remain
+			size_t numIndices = 0;
 			for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
-				// Get primitive
-				aiFace face = mesh->mFaces[i];
-
-				// Iterate over indices
+				numIndices += mesh->mFaces[i].mNumIndices;
+			}
+			result.indices.resize(numIndices);
+			unsigned int *index = result.indices.data();
+			for (unsigned int i = 0; i < mesh->mNumFaces; i++) {
+				const aiFace &face = mesh->mFaces[i];
 				for (unsigned int j = 0; j < face.mNumIndices; j++) {
-					indices.push_back(face.mIndices[j]);
+					*index++ = face.mIndices[j];
 				}
 			}
 
-			// Process material
-			vector<Texture> textures;
-			if (mesh->mMaterialIndex >= 0) {
-				// Mesh contains index into scene's material array
-				aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
-
-				// Load diffuse maps
-				vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-				textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
-
-				// Load specular maps
-				vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-				textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+			result.indexCount = (unsigned int)result.indices.size();
+			result.vertexCount = (unsigned int)result.vertices.size();
+			result.lods.assign(1, { 0, result.indexCount, 0.0f });
+			if (!result.vertices.empty()) {
+				result.bounds = computeBoundingSphere(&result.vertices[0].position, result.vertices.size(), sizeof(Vertex));
+				result.box = computeBoundingBox(&result.vertices[0].position, result.vertices.size(), sizeof(Vertex));
 			}
+		}
 
-			return Mesh(vertices, indices, textures);
+		// Diffuse then specular maps, like the sampler names Mesh assigns
+		static vector<Texture> loadMaterial(aiMaterial *material, ModelData &data) {
+			vector<Texture> textures = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse", data);
+			vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular", data);
+			textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+			return textures;
 		}
 
-		vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName) {
+		static vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName, ModelData &data) {
 			// Iterate over textures of provided type
 			vector<Texture> textures;
 			for (unsigned int i = 0; i < mat->GetTextureCount(type); i++) {
@@ -132,27 +1295,10 @@ class Model {
 				aiString str;
 				mat->GetTexture(type, i, &str);
 
-				// Check if texture has already been loaded
-				bool skip = false;
-				for (unsigned int j = 0; j < texturesLoaded.size(); j++) {
-					if (texturesLoaded[j].path.compare(str.C_Str()) == 0) {
-						textures.push_back(texturesLoaded[j]);
-						skip = true;
-						break;
-					}
-				}
-
-				if (!skip) {
-					// Process texture
-					Texture texture;
-					texture.id = textureFromFile(str.C_Str(), directory);
-					texture.type = typeName;
-					texture.path = str.C_Str();
-
-					// Push texture
-					textures.push_back(texture);
-					texturesLoaded.push_back(texture);
-				}
+				// Handles are filled in once the texture is uploaded
+				Texture texture = { 0, typeName, str.C_Str() };
+				textures.push_back(texture);
+				addUniqueTexture(data, texture);
 			}
 
 			return textures;
@@ -160,38 +1306,6 @@ class Model {
 };
 
 unsigned int textureFromFile(const char *path, const string &directory) {
-	string filename = directory + '/' + string(path);
-
-	// Create texture
-	unsigned int textureID;
-	glGenTextures(1, &textureID);
-
-	// Load texture and generate mipmaps
-	int width, height, numComponents;
-	unsigned char *data = stbi_load(filename.c_str(), &width, &height, &numComponents, 0);
-	if (data) {
-		GLenum format;
-		if (numComponents == 1) {
-			format = GL_RED;
-		} else if (numComponents == 3) {
-			format = GL_RGB;
-		} else if (numComponents == 4) {
-			format = GL_RGBA;
-		}
-
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		// Set wrap and filter options
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);  // Magnification doesn't use mipmaps
-	} else {
-		cout << "Texture failed to load at path: " << filename << endl;
-	}
-	stbi_image_free(data);
-
-	return textureID;
-}
\ No newline at end of file
+	DecodedImage image = decodeImage(directory + '/' + string(path), true);
+	return uploadTexture(image);
+}
@@ -0,0 +1,24 @@
+#version 460 core
+out vec4 fragColor;
+
+in vec2 texCoords;
+flat in int diffuseTexture;
+
+// Every texture the model uses, bound to units 0..N-1. Must match MAX_INDIRECT_TEXTURES in indirectDraw.h.
+const int MAX_TEXTURES = 16;
+uniform sampler2D modelTextures[MAX_TEXTURES];
+
+void main() {
+	// Derivatives before any branching
+	vec2 dx = dFdx(texCoords);
+	vec2 dy = dFdy(texCoords);
+
+	// Sampler arrays may only be indexed with dynamically uniform expressions, and diffuseTexture changes between the
+	// draws of one multi-draw. Walk the table with a uniform counter instead and sample the entry that matches.
+	fragColor = vec4(1.0);
+	for (int i = 0; i < MAX_TEXTURES; i++) {
+		if (i == diffuseTexture) {
+			fragColor = textureGrad(modelTextures[i], texCoords, dx, dy);
+		}
+	}
+}
@@ -0,0 +1,43 @@
+#version 460 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+
+out vec2 texCoords;
+flat out int diffuseTexture;
+
+// Per-frame camera data shared by all shaders
+layout (std140, binding = 0) uniform FrameData {
+	mat4 projection;
+	mat4 view;
+	vec3 viewPos;
+};
+
+// Per-draw materials, see IndirectMaterial in indirectDraw.h
+struct DrawMaterial {
+	ivec4 textures;      // Diffuse slot, specular slot, scene graph node
+	vec4 positionOffset; // PackedVertex dequantization, identity for float vertices
+	vec4 positionScale;
+};
+
+layout (std430, binding = 5) readonly buffer MaterialData {
+	DrawMaterial materials[];
+};
+
+// Scene graph world matrices, see IndirectDrawList::updateNodes
+layout (std430, binding = 6) readonly buffer NodeData {
+	mat4 nodeTransforms[];
+};
+
+uniform mat4 model;
+
+void main() {
+    // gl_DrawID is the index of the command within the multi-draw
+    DrawMaterial material = materials[gl_DrawID];
+
+    vec3 position = material.positionOffset.xyz + material.positionScale.xyz * aPos;
+    gl_Position = projection * view * model * nodeTransforms[material.textures.z] * vec4(position, 1.0f);
+    texCoords = aTexCoords;
+
+    diffuseTexture = material.textures.x;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include "lockFreeQueue.h"
+#include "model.h"
+#include "threadPool.h"
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Loads models in the background. Import and texture decode run on worker threads,
+// GL uploads are spread over frames by update() under a shared per-frame budget.
+class AsyncModelLoader {
+	public:
+		// Shared across every model uploading in the same frame
+		UploadBudget budget;
+
+		AsyncModelLoader(unsigned int numThreads = 2) : importPool(numThreads) {}
+
+		AsyncModelLoader(const AsyncModelLoader &) = delete;
+		AsyncModelLoader &operator=(const AsyncModelLoader &) = delete;
+
+		// Returns immediately with an empty model that becomes drawable later, see Model::readyFuture()
+		shared_ptr<Model> load(const string &path, const ModelLoadOptions &options = ModelLoadOptions()) {
+			shared_ptr<Model> model = make_shared<Model>();
+			importPool.submit([this, model, path, options] {
+				unique_ptr<ModelData> data = make_unique<ModelData>();
+				data->options = options;
+				if (Model::importData(path, *data)) {
+					model->setProgress(0.25f);
+					Model::decodeTextures(*data);
+					model->setProgress(0.5f);
+				} else {
+					data.reset();
+				}
+				completed.push({ model, move(data) });
+			});
+			return model;
+		}
+
+		// Call once per frame on the context thread
+		void update() {
+			// Models whose CPU work finished since last frame
+			arrived.clear();
+			completed.popAll(arrived);
+			for (Completed &load : arrived) {
+				load.model->beginUpload(move(load.data));
+				uploading.push_back(load.model);
+			}
+
+			// Oldest first, so one model finishes before the next starts eating the budget
+			UploadBudget remaining = budget;
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			while (!uploading.empty() && remaining.bytes > 0 && remaining.milliseconds > 0.0) {
+				if (!uploading.front()->continueUpload(remaining)) {
+					break;
+				}
+				uploading.erase(uploading.begin());
+			}
+
+			uploadMs += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		}
+
+		// Models with GL uploads still outstanding
+		bool busy() const {
+			return !uploading.empty();
+		}
+
+		// Render thread time spent on uploads so far
+		double uploadTime() const {
+			return uploadMs;
+		}
+
+	private:
+		struct Completed {
+			shared_ptr<Model> model;
+			unique_ptr<ModelData> data; // Null when the import failed
+		};
+
+		LockFreeQueue<Completed> completed;
+		vector<Completed> arrived;
+		vector<shared_ptr<Model>> uploading;
+		double uploadMs = 0.0;
+
+		// Import tasks block on decode work in loaderThreadPool(), so they get their own threads.
+		// Declared last so workers are joined before the queue they push to goes away.
+		ThreadPool importPool;
+};
@@ -6,6 +6,16 @@ in vec2 texCoords;
 uniform sampler2D texture_diffuse1;
 uniform sampler2D texture_specular1;
 
+// Texture array pages the model binds once (TEXTURE_PAGE_UNIT and MAX_TEXTURE_PAGES in textureArray.h).
+// diffusePage and diffuseLayer are set per draw, page -1 samples texture_diffuse1 instead.
+layout (binding = 8) uniform sampler2DArray texturePages[4];
+uniform int diffusePage = -1;
+uniform int diffuseLayer = 0;
+
 void main() {
-	fragColor = texture(texture_diffuse1, texCoords);
+	if (diffusePage >= 0) {
+		fragColor = texture(texturePages[diffusePage], vec3(texCoords, diffuseLayer));
+	} else {
+		fragColor = texture(texture_diffuse1, texCoords);
+	}
 }
\ No newline at end of file
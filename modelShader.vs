@@ -2,14 +2,27 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
+layout (location = 3) in mat4 aInstanceModel; // Per-instance transform, see Model::drawInstanced
 
 out vec2 texCoords;
 
+// Per-frame camera data shared by all shaders
+layout (std140, binding = 0) uniform FrameData {
+	mat4 projection;
+	mat4 view;
+	vec3 viewPos;
+};
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+uniform bool instanced; // Place with aInstanceModel, model then only holds the mesh's node transform
+
+// PackedVertex dequantization (see Mesh), identity for float vertices
+uniform vec3 positionOffset = vec3(0.0);
+uniform vec3 positionScale = vec3(1.0);
 
 void main() {
-    gl_Position = projection * view * model * vec4(aPos, 1.0f);
+    mat4 world = instanced ? aInstanceModel * model : model;
+    vec3 position = positionOffset + positionScale * aPos;
+    gl_Position = projection * view * world * vec4(position, 1.0f);
     texCoords = aTexCoords;
 }
\ No newline at end of file
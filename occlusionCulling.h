@@ -0,0 +1,388 @@
+#pragma once
+
+#include "benchmark.h"
+#include "bounds.h"
+#include "threadPool.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define OCCLUSION_CULLING_SSE
+#endif
+
+using namespace std;
+
+// Pixels per side of a tile, each keeps its farthest depth so most tests never touch pixels
+const unsigned int OCCLUSION_TILE_SIZE = 8;
+
+// Low resolution depth buffer on the CPU. Occluder triangles are rasterized into it,
+// then mesh boxes are tested against it before anything is submitted to the GPU.
+// Depth is window z in [0, 1], rows go bottom to top like GL.
+class OcclusionBuffer {
+	public:
+		// Width and height are rounded up to whole tiles
+		OcclusionBuffer(unsigned int width = 256, unsigned int height = 128) {
+			bufferWidth = (width + OCCLUSION_TILE_SIZE - 1) / OCCLUSION_TILE_SIZE * OCCLUSION_TILE_SIZE;
+			bufferHeight = (height + OCCLUSION_TILE_SIZE - 1) / OCCLUSION_TILE_SIZE * OCCLUSION_TILE_SIZE;
+			tilesX = bufferWidth / OCCLUSION_TILE_SIZE;
+			tilesY = bufferHeight / OCCLUSION_TILE_SIZE;
+			depth.resize(bufferWidth * bufferHeight);
+			tileMax.resize(tilesX * tilesY);
+			clear();
+		}
+
+		// Start a frame, drops queued occluders
+		void clear() {
+			fill(depth.begin(), depth.end(), 1.0f);
+			fill(tileMax.begin(), tileMax.end(), 1.0f);
+			triangles.clear();
+		}
+
+		// Clip and set up an occluder's triangles. Indices address positions directly.
+		void addOccluder(const glm::mat4 &modelViewProjection, const glm::vec3 *positions, const unsigned int *indices, size_t indexCount) {
+			for (size_t i = 0; i + 2 < indexCount; i += 3) {
+				glm::vec4 clip[3];
+				for (int corner = 0; corner < 3; corner++) {
+					clip[corner] = modelViewProjection * glm::vec4(positions[indices[i + corner]], 1.0f);
+				}
+				addClipTriangle(clip);
+			}
+		}
+
+		// Fill the buffer with everything queued, in horizontal bands on the pool if one is given
+		void rasterize(ThreadPool *pool = nullptr) {
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+			unsigned int numBands = pool ? min(tilesY, pool->size() * 2) : 1;
+			if (numBands <= 1) {
+				rasterizeBand(0, tilesY);
+			} else {
+				// Bands own whole tile rows, so nothing is shared between tasks
+				vector<future<void>> bands;
+				for (unsigned int band = 0; band < numBands; band++) {
+					unsigned int first = tilesY * band / numBands;
+					unsigned int last = tilesY * (band + 1) / numBands;
+					bands.push_back(pool->submit([this, first, last] { rasterizeBand(first, last); }));
+				}
+				for (future<void> &band : bands) {
+					band.get();
+				}
+			}
+
+			rasterizeTime = chrono::duration<float, milli>(chrono::steady_clock::now() - start).count();
+		}
+
+		// False only if the whole box is behind rasterized occluders. Boxes crossing the near plane always pass.
+		bool isVisible(const glm::mat4 &modelViewProjection, const BoundingBox &box) const {
+			glm::vec2 screenMin(INFINITY), screenMax(-INFINITY);
+			float nearest = INFINITY;
+			for (int corner = 0; corner < 8; corner++) {
+				glm::vec3 sign((corner & 1) ? 1.0f : -1.0f, (corner & 2) ? 1.0f : -1.0f, (corner & 4) ? 1.0f : -1.0f);
+				glm::vec4 clip = modelViewProjection * glm::vec4(box.center + sign * box.extents, 1.0f);
+				if (clip.z < -clip.w) {
+					return true;
+				}
+
+				glm::vec3 window = toWindow(clip);
+				screenMin = glm::min(screenMin, glm::vec2(window));
+				screenMax = glm::max(screenMax, glm::vec2(window));
+				nearest = fmin(nearest, window.z);
+			}
+
+			// Every pixel the rectangle touches
+			int x0 = max(0, (int)floor(screenMin.x)), x1 = min((int)bufferWidth - 1, (int)floor(screenMax.x));
+			int y0 = max(0, (int)floor(screenMin.y)), y1 = min((int)bufferHeight - 1, (int)floor(screenMax.y));
+			if (x0 > x1 || y0 > y1) {
+				return true; // Off screen is the frustum test's call
+			}
+
+			// Visible as soon as one touched pixel holds something farther than the box's nearest point
+			for (int tileY = y0 / (int)OCCLUSION_TILE_SIZE; tileY <= y1 / (int)OCCLUSION_TILE_SIZE; tileY++) {
+				for (int tileX = x0 / (int)OCCLUSION_TILE_SIZE; tileX <= x1 / (int)OCCLUSION_TILE_SIZE; tileX++) {
+					if (tileMax[tileY * tilesX + tileX] < nearest) {
+						continue;
+					}
+
+					int rowFirst = max(y0, tileY * (int)OCCLUSION_TILE_SIZE), rowLast = min(y1, (tileY + 1) * (int)OCCLUSION_TILE_SIZE - 1);
+					int columnFirst = max(x0, tileX * (int)OCCLUSION_TILE_SIZE), columnLast = min(x1, (tileX + 1) * (int)OCCLUSION_TILE_SIZE - 1);
+					for (int y = rowFirst; y <= rowLast; y++) {
+						for (int x = columnFirst; x <= columnLast; x++) {
+							if (depth[y * bufferWidth + x] >= nearest) {
+								return true;
+							}
+						}
+					}
+				}
+			}
+			return false;
+		}
+
+		float depthAt(unsigned int x, unsigned int y) const {
+			return depth[y * bufferWidth + x];
+		}
+
+		unsigned int width() const {
+			return bufferWidth;
+		}
+
+		unsigned int height() const {
+			return bufferHeight;
+		}
+
+		// Triangles queued this frame after clipping
+		size_t numTriangles() const {
+			return triangles.size();
+		}
+
+		float lastRasterizeMs() const {
+			return rasterizeTime;
+		}
+
+	private:
+		// Edge functions are >= 0 inside, depth is a plane over the screen
+		struct Triangle {
+			float edgeA[3], edgeB[3], edgeC[3];
+			float depthA, depthB, depthC;
+			int minX, maxX, minY, maxY;
+		};
+
+		unsigned int bufferWidth, bufferHeight;
+		unsigned int tilesX, tilesY;
+		vector<float> depth;
+		vector<float> tileMax;
+		vector<Triangle> triangles;
+		float rasterizeTime = 0.0f;
+
+		glm::vec3 toWindow(const glm::vec4 &clip) const {
+			glm::vec3 ndc = glm::vec3(clip) / clip.w;
+			return glm::vec3((ndc.x * 0.5f + 0.5f) * bufferWidth, (ndc.y * 0.5f + 0.5f) * bufferHeight, ndc.z * 0.5f + 0.5f);
+		}
+
+		// Only the near plane needs real clipping, the rest is handled by clamping to the buffer
+		void addClipTriangle(const glm::vec4 *clip) {
+			glm::vec4 polygon[4];
+			int count = 0;
+			for (int i = 0; i < 3; i++) {
+				const glm::vec4 &a = clip[i];
+				const glm::vec4 &b = clip[(i + 1) % 3];
+				float distanceA = a.z + a.w, distanceB = b.z + b.w;
+				if (distanceA >= 0.0f) {
+					polygon[count++] = a;
+				}
+				if ((distanceA >= 0.0f) != (distanceB >= 0.0f)) {
+					polygon[count++] = a + (b - a) * (distanceA / (distanceA - distanceB));
+				}
+			}
+
+			for (int i = 1; i + 1 < count; i++) {
+				addScreenTriangle(toWindow(polygon[0]), toWindow(polygon[i]), toWindow(polygon[i + 1]));
+			}
+		}
+
+		void addScreenTriangle(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2) {
+			float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+			if (area == 0.0f) {
+				return;
+			}
+
+			Triangle triangle;
+			triangle.minX = max(0, (int)floor(fmin(v0.x, fmin(v1.x, v2.x))));
+			triangle.maxX = min((int)bufferWidth - 1, (int)ceil(fmax(v0.x, fmax(v1.x, v2.x))));
+			triangle.minY = max(0, (int)floor(fmin(v0.y, fmin(v1.y, v2.y))));
+			triangle.maxY = min((int)bufferHeight - 1, (int)ceil(fmax(v0.y, fmax(v1.y, v2.y))));
+			if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY) {
+				return;
+			}
+
+			// Both windings are drawn, flip the edges of clockwise triangles so inside stays positive
+			const glm::vec3 *vertices[3] = { &v0, &v1, &v2 };
+			float orientation = area > 0.0f ? 1.0f : -1.0f;
+			for (int edge = 0; edge < 3; edge++) {
+				const glm::vec3 &a = *vertices[edge];
+				const glm::vec3 &b = *vertices[(edge + 1) % 3];
+				triangle.edgeA[edge] = (a.y - b.y) * orientation;
+				triangle.edgeB[edge] = (b.x - a.x) * orientation;
+				triangle.edgeC[edge] = (a.x * b.y - a.y * b.x) * orientation;
+			}
+
+			triangle.depthA = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) / area;
+			triangle.depthB = ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) / area;
+			triangle.depthC = v0.z - triangle.depthA * v0.x - triangle.depthB * v0.y;
+			triangles.push_back(triangle);
+		}
+
+		// Rasterize every triangle overlapping rows of tiles [firstTileRow, lastTileRow), then refresh their tile maxima
+		void rasterizeBand(unsigned int firstTileRow, unsigned int lastTileRow) {
+			int firstRow = firstTileRow * OCCLUSION_TILE_SIZE;
+			int lastRow = lastTileRow * OCCLUSION_TILE_SIZE - 1;
+
+			for (const Triangle &triangle : triangles) {
+				int rowFirst = max(firstRow, triangle.minY), rowLast = min(lastRow, triangle.maxY);
+				int columnFirst = triangle.minX & ~3;
+
+				for (int y = rowFirst; y <= rowLast; y++) {
+					float *row = &depth[y * bufferWidth];
+					float centerY = y + 0.5f;
+					int x = columnFirst;
+
+#if defined(OCCLUSION_CULLING_SSE)
+					// Four pixels at a time, rows are a whole number of tiles so this never runs past the end
+					__m128 rowEdge[3], edgeA[3];
+					for (int edge = 0; edge < 3; edge++) {
+						rowEdge[edge] = _mm_set1_ps(triangle.edgeB[edge] * centerY + triangle.edgeC[edge]);
+						edgeA[edge] = _mm_set1_ps(triangle.edgeA[edge]);
+					}
+					__m128 rowDepth = _mm_set1_ps(triangle.depthB * centerY + triangle.depthC);
+					__m128 depthA = _mm_set1_ps(triangle.depthA);
+					__m128 zero = _mm_setzero_ps();
+
+					for (; x <= triangle.maxX; x += 4) {
+						__m128 centerX = _mm_add_ps(_mm_set1_ps(x + 0.5f), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f));
+						__m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeA[0], centerX), rowEdge[0]), zero);
+						inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeA[1], centerX), rowEdge[1]), zero));
+						inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edgeA[2], centerX), rowEdge[2]), zero));
+						if (_mm_movemask_ps(inside) == 0) {
+							continue;
+						}
+
+						__m128 stored = _mm_loadu_ps(row + x);
+						__m128 nearer = _mm_min_ps(stored, _mm_add_ps(_mm_mul_ps(depthA, centerX), rowDepth));
+						_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, stored)));
+					}
+#endif
+
+					for (; x <= triangle.maxX; x++) {
+						float centerX = x + 0.5f;
+						bool inside = true;
+						for (int edge = 0; edge < 3; edge++) {
+							inside = inside && triangle.edgeA[edge] * centerX + triangle.edgeB[edge] * centerY + triangle.edgeC[edge] >= 0.0f;
+						}
+						if (inside) {
+							row[x] = fmin(row[x], triangle.depthA * centerX + triangle.depthB * centerY + triangle.depthC);
+						}
+					}
+				}
+			}
+
+			for (unsigned int tileY = firstTileRow; tileY < lastTileRow; tileY++) {
+				for (unsigned int tileX = 0; tileX < tilesX; tileX++) {
+					float farthest = 0.0f;
+					for (unsigned int y = 0; y < OCCLUSION_TILE_SIZE; y++) {
+						const float *row = &depth[(tileY * OCCLUSION_TILE_SIZE + y) * bufferWidth + tileX * OCCLUSION_TILE_SIZE];
+						for (unsigned int x = 0; x < OCCLUSION_TILE_SIZE; x++) {
+							farthest = fmax(farthest, row[x]);
+						}
+					}
+					tileMax[tileY * tilesX + tileX] = farthest;
+				}
+			}
+		}
+};
+
+// Checks on synthetic scenes with known answers, then rasterize/test timings on a random one. Returns false if a check failed.
+bool benchmarkOcclusionCulling(ThreadPool &pool) {
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), 2.0f, 0.1f, 100.0f);
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	glm::mat4 viewProjection = projection * view;
+
+	// Quad facing the camera, 2 * halfSize wide at depth z
+	auto addWall = [](OcclusionBuffer &buffer, const glm::mat4 &transform, float halfSize, float z) {
+		glm::vec3 corners[4] = { { -halfSize, -halfSize, z }, { halfSize, -halfSize, z }, { halfSize, halfSize, z }, { -halfSize, halfSize, z } };
+		unsigned int indices[6] = { 0, 1, 2, 0, 2, 3 };
+		buffer.addOccluder(transform, corners, indices, 6);
+	};
+	auto box = [](glm::vec3 center, float extent) {
+		BoundingBox result;
+		result.center = center;
+		result.extents = glm::vec3(extent);
+		return result;
+	};
+
+	BenchmarkChecks checks("Occlusion culling checks");
+
+	// Wall 5 units away covering the middle of the view
+	OcclusionBuffer buffer;
+	addWall(buffer, viewProjection, 2.0f, -5.0f);
+	buffer.rasterize(&pool);
+	checks.check("box behind the wall is hidden", !buffer.isVisible(viewProjection, box({ 0.0f, 0.0f, -10.0f }, 0.5f)));
+	checks.check("box in front of the wall is visible", buffer.isVisible(viewProjection, box({ 0.0f, 0.0f, -3.0f }, 0.5f)));
+	checks.check("box straddling the wall is visible", buffer.isVisible(viewProjection, box({ 0.0f, 0.0f, -5.0f }, 0.5f)));
+	checks.check("box beside the wall is visible", buffer.isVisible(viewProjection, box({ 4.0f, 0.0f, -10.0f }, 0.5f)));
+	checks.check("box peeking past the edge is visible", buffer.isVisible(viewProjection, box({ 3.8f, 0.0f, -10.0f }, 0.5f)));
+	checks.check("box crossing the near plane is visible", buffer.isVisible(viewProjection, box({ 0.0f, 0.0f, 0.0f }, 0.5f)));
+
+	// Same wall seen from behind, winding must not matter
+	OcclusionBuffer flipped;
+	addWall(flipped, viewProjection * glm::rotate(glm::mat4(1.0f), glm::radians(180.0f), glm::vec3(0.0f, 1.0f, 0.0f)), 2.0f, 5.0f);
+	flipped.rasterize();
+	checks.check("back facing wall still occludes", !flipped.isVisible(viewProjection, box({ 0.0f, 0.0f, -10.0f }, 0.5f)));
+
+	// Wall crossing the near plane is clipped, not dropped
+	OcclusionBuffer clipped;
+	glm::vec3 slopeCorners[4] = { { -2.0f, -2.0f, 1.0f }, { 2.0f, -2.0f, 1.0f }, { 2.0f, 2.0f, -6.0f }, { -2.0f, 2.0f, -6.0f } };
+	unsigned int slopeIndices[6] = { 0, 1, 2, 0, 2, 3 };
+	clipped.addOccluder(viewProjection, slopeCorners, slopeIndices, 6);
+	clipped.rasterize();
+	checks.check("clipped occluder still occludes", !clipped.isVisible(viewProjection, box({ 0.0f, 0.0f, -20.0f }, 0.3f)));
+
+	// Single threaded and banded rasterization agree
+	OcclusionBuffer single;
+	addWall(single, viewProjection, 2.0f, -5.0f);
+	single.rasterize();
+	bool same = true;
+	for (unsigned int y = 0; y < buffer.height(); y++) {
+		for (unsigned int x = 0; x < buffer.width(); x++) {
+			same = same && single.depthAt(x, y) == buffer.depthAt(x, y);
+		}
+	}
+	checks.check("banded rasterization matches single threaded", same);
+	checks.report();
+
+	// Random field: a layer of large occluders near the camera and many small boxes behind
+	mt19937 random(1234);
+	uniform_real_distribution<float> spread(-1.0f, 1.0f);
+	OcclusionBuffer field;
+	const int numOccluders = 200, numBoxes = 20000, frames = 20;
+	vector<glm::mat4> occluders;
+	for (int i = 0; i < numOccluders; i++) {
+		glm::vec3 position(spread(random) * 8.0f, spread(random) * 4.0f, -6.0f - spread(random));
+		occluders.push_back(viewProjection * glm::translate(glm::mat4(1.0f), position));
+	}
+	vector<BoundingBox> boxes;
+	for (int i = 0; i < numBoxes; i++) {
+		boxes.push_back(box(glm::vec3(spread(random) * 20.0f, spread(random) * 10.0f, -15.0f - 30.0f * (spread(random) * 0.5f + 0.5f)), 0.3f));
+	}
+
+	size_t hidden = 0;
+	double rasterizeMs = 0.0, testMs = 0.0;
+	for (int frame = 0; frame < frames; frame++) {
+		field.clear();
+		for (const glm::mat4 &transform : occluders) {
+			addWall(field, transform, 0.6f, 0.0f);
+		}
+		field.rasterize(&pool);
+		rasterizeMs += field.lastRasterizeMs();
+
+		auto start = chrono::steady_clock::now();
+		hidden = 0;
+		for (const BoundingBox &occludee : boxes) {
+			hidden += !field.isVisible(viewProjection, occludee);
+		}
+		testMs += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	}
+	cout << "  " << field.width() << "x" << field.height() << ", " << field.numTriangles() << " occluder triangles: " << rasterizeMs / frames << " ms to rasterize" << endl;
+	cout << "  " << numBoxes << " boxes: " << testMs / frames << " ms to test, " << hidden * 100.0 / numBoxes << "% culled" << endl;
+	return checks.passed();
+}
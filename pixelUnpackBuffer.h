@@ -0,0 +1,108 @@
+#pragma once
+
+#include "glResource.h"
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+// Persistently mapped GL_PIXEL_UNPACK_BUFFER split into segments, each guarded by a fence. Uploads copy pixels into
+// the mapping and source the texture call from a buffer offset, so the call returns at once and the GPU pulls the
+// data itself. A segment is only reused once the GPU has finished reading it.
+class PixelUnpackBuffer {
+	public:
+		GLBuffer ID;
+
+		PixelUnpackBuffer(size_t segmentSize = 16 << 20, unsigned int numSegments = 4) : segmentSize(segmentSize), fences(numSegments, nullptr) {
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			ID = GLBuffer::create();
+			glNamedBufferStorage(ID, segmentSize * numSegments, NULL, flags);
+			mapped = (uint8_t *)glMapNamedBufferRange(ID, 0, segmentSize * numSegments, flags);
+		}
+
+		~PixelUnpackBuffer() {
+			for (GLsync fence : fences) {
+				if (fence) {
+					glDeleteSync(fence);
+				}
+			}
+			if (mapped) {
+				glUnmapNamedBuffer(ID);
+			}
+		}
+
+		// Owns the mapping
+		PixelUnpackBuffer(const PixelUnpackBuffer &) = delete;
+		PixelUnpackBuffer &operator=(const PixelUnpackBuffer &) = delete;
+
+		// Largest single reservation, bigger uploads go in bands
+		size_t maxReservation() const {
+			return segmentSize;
+		}
+
+		// Offset of size free bytes. Moving on to the next segment fences the current one, everything reading it
+		// has been issued by then, and waits if the GPU hasn't finished with the next one yet.
+		size_t reserve(size_t size, size_t alignment = 16) {
+			size_t offset = (used + alignment - 1) & ~(alignment - 1);
+			if (offset + size > segmentSize) {
+				fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+				segment = (segment + 1) % (unsigned int)fences.size();
+				if (fences[segment]) {
+					GLenum result = glClientWaitSync(fences[segment], GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+					while (result == GL_TIMEOUT_EXPIRED) {
+						result = glClientWaitSync(fences[segment], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+						stalls++;
+					}
+					glDeleteSync(fences[segment]);
+					fences[segment] = nullptr;
+				}
+				offset = 0;
+			}
+			used = offset + size;
+			bytesReserved += size;
+			return segment * segmentSize + offset;
+		}
+
+		// Write pointer for a reserved offset, coherent so no flush is needed
+		uint8_t *data(size_t offset) const {
+			return mapped + offset;
+		}
+
+		// Times a reservation had to wait for the GPU, and bytes that went through the buffer
+		size_t numStalls() const {
+			return stalls;
+		}
+
+		size_t totalBytes() const {
+			return bytesReserved;
+		}
+
+	private:
+		uint8_t *mapped = nullptr;
+		size_t segmentSize;
+		vector<GLsync> fences; // Per segment, set once the segment has been left
+		unsigned int segment = 0;
+		size_t used = 0;
+		size_t stalls = 0;
+		size_t bytesReserved = 0;
+};
+
+// Shared by every texture upload, created on first use with the context current
+unique_ptr<PixelUnpackBuffer> sharedPixelUnpackBuffer;
+
+PixelUnpackBuffer &pixelUnpackBuffer() {
+	if (!sharedPixelUnpackBuffer) {
+		sharedPixelUnpackBuffer = make_unique<PixelUnpackBuffer>();
+	}
+	return *sharedPixelUnpackBuffer;
+}
+
+// Unmap and delete the shared buffer while the context is still current, a later upload would create a new one
+void shutdownPixelUnpackBuffer() {
+	sharedPixelUnpackBuffer.reset();
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+// CPU-side counters for what was submitted this frame
+struct RenderStats {
+	unsigned int drawCalls = 0;    // GL draw entry points called
+	unsigned int drawCommands = 0; // Individual draws, a multi-draw counts once per command
+	unsigned int textureBinds = 0; // glBindTexture calls made by draws
+	unsigned long long triangles = 0;
+	unsigned long long fullDetailTriangles = 0; // Triangles the same draws would have without LOD
+	unsigned int visibleMeshes = 0;  // Meshes that passed culling and were drawn
+	unsigned int culledMeshes = 0;   // Outside the view frustum
+	unsigned int occludedMeshes = 0; // Inside the frustum but hidden in the occlusion buffer
+	unsigned int culledMeshlets = 0; // Outside the frustum or back facing, within meshes that were drawn
+	unsigned long long culledMeshletTriangles = 0;
+
+	void reset() {
+		*this = RenderStats();
+	}
+};
+
+RenderStats &renderStats() {
+	static RenderStats stats;
+	return stats;
+}
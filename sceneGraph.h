@@ -0,0 +1,194 @@
+#pragma once
+
+#include "threadPool.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Node transforms in flat arrays, ordered by depth so every parent comes before its children
+// and each level is one contiguous range. An update is a single forward pass, one level at a time.
+class SceneGraph {
+	public:
+		vector<int> parent; // -1 for roots
+		vector<glm::mat4> local;
+		vector<glm::mat4> world;
+		vector<string> names;
+
+		// Nodes must be added breadth first, a node's depth can't be less than the one added before it
+		int addNode(int parentNode, const glm::mat4 &transform, const string &name = "") {
+			unsigned int nodeDepth = parentNode < 0 ? 0 : depth[parentNode] + 1;
+			if (nodeDepth >= levelStart.size()) {
+				levelStart.push_back((uint32_t)size());
+			}
+
+			int node = (int)size();
+			parent.push_back(parentNode);
+			local.push_back(transform);
+			world.push_back(parentNode < 0 ? transform : world[parentNode] * transform);
+			names.push_back(name);
+			depth.push_back(nodeDepth);
+			dirty.push_back(0);
+			changed.push_back(0);
+			return node;
+		}
+
+		void clear() {
+			*this = SceneGraph();
+		}
+
+		size_t size() const {
+			return parent.size();
+		}
+
+		unsigned int numLevels() const {
+			return (unsigned int)levelStart.size();
+		}
+
+		// First node with this name, -1 if none
+		int find(const string &name) const {
+			for (size_t i = 0; i < names.size(); i++) {
+				if (names[i] == name) {
+					return (int)i;
+				}
+			}
+			return -1;
+		}
+
+		// World matrices follow on the next update()
+		void setLocal(int node, const glm::mat4 &transform) {
+			local[node] = transform;
+			dirty[node] = 1;
+			anyDirty = true;
+		}
+
+		// Bumped by every update that moved something, lets users cache world-space data
+		uint64_t version() const {
+			return updateVersion;
+		}
+
+		// Recompute world matrices under dirty nodes only. Returns how many were recomputed.
+		size_t update() {
+			if (!anyDirty) {
+				return 0;
+			}
+
+			size_t recomputed = updateRange(0, (uint32_t)size());
+			finishUpdate();
+			return recomputed;
+		}
+
+		// Same, splitting each level across the pool. Levels run in order so parents are always done first.
+		size_t update(ThreadPool &pool, size_t minBatch = 4096) {
+			if (!anyDirty) {
+				return 0;
+			}
+
+			size_t recomputed = 0;
+			vector<future<size_t>> batches;
+			for (unsigned int level = 0; level < numLevels(); level++) {
+				uint32_t first = levelStart[level];
+				uint32_t last = level + 1 < numLevels() ? levelStart[level + 1] : (uint32_t)size();
+
+				// Small levels aren't worth a round trip through the queue
+				size_t numBatches = min<size_t>(pool.size(), (last - first) / minBatch);
+				if (numBatches <= 1) {
+					recomputed += updateRange(first, last);
+					continue;
+				}
+
+				uint32_t batchSize = (uint32_t)((last - first + numBatches - 1) / numBatches);
+				batches.clear();
+				for (uint32_t begin = first; begin < last; begin += batchSize) {
+					uint32_t end = min(last, begin + batchSize);
+					batches.push_back(pool.submit([this, begin, end] { return updateRange(begin, end); }));
+				}
+				for (future<size_t> &batch : batches) {
+					recomputed += batch.get();
+				}
+			}
+			finishUpdate();
+			return recomputed;
+		}
+
+	private:
+		vector<unsigned int> depth;
+		vector<uint32_t> levelStart; // First node of each depth
+		vector<uint8_t> dirty;       // Local transform set since the last update
+		vector<uint8_t> changed;     // World recomputed in this update, children must follow
+		bool anyDirty = false;
+		uint64_t updateVersion = 0;
+
+		// Nodes in the range only read parents from earlier levels (or earlier in the same forward pass)
+		size_t updateRange(uint32_t first, uint32_t last) {
+			size_t recomputed = 0;
+			for (uint32_t i = first; i < last; i++) {
+				int p = parent[i];
+				changed[i] = dirty[i] || (p >= 0 && changed[p]);
+				if (changed[i]) {
+					world[i] = p < 0 ? local[i] : world[p] * local[i];
+					recomputed++;
+				}
+			}
+			return recomputed;
+		}
+
+		void finishUpdate() {
+			fill(dirty.begin(), dirty.end(), 0);
+			anyDirty = false;
+			updateVersion++;
+		}
+};
+
+// Build a random breadth first tree and time full and partial updates, single threaded and on the pool
+void benchmarkSceneGraph(ThreadPool &pool, size_t numNodes = 100000, int frames = 100) {
+	mt19937 random(1234);
+	uniform_real_distribution<float> offset(-1.0f, 1.0f);
+
+	// A few roots, then each level picks parents from the one before with a fan-out of about 8
+	SceneGraph scene;
+	size_t levelFirst = 0, levelLast = 0;
+	while (scene.size() < numNodes) {
+		size_t levelSize = levelLast == levelFirst ? 16 : (levelLast - levelFirst) * 8;
+		size_t nextFirst = scene.size();
+		for (size_t i = 0; i < levelSize && scene.size() < numNodes; i++) {
+			int parentNode = levelLast == levelFirst ? -1 : (int)(levelFirst + random() % (levelLast - levelFirst));
+			scene.addNode(parentNode, glm::translate(glm::mat4(1.0f), glm::vec3(offset(random), offset(random), offset(random))));
+		}
+		levelFirst = nextFirst;
+		levelLast = scene.size();
+	}
+
+	auto run = [&](bool threaded, size_t dirtyStride) {
+		size_t recomputed = 0;
+		auto start = chrono::steady_clock::now();
+		for (int frame = 0; frame < frames; frame++) {
+			float angle = frame * 0.01f;
+			for (size_t i = frame % dirtyStride; i < scene.size(); i += dirtyStride) {
+				scene.setLocal((int)i, glm::rotate(scene.local[i], angle, glm::vec3(0.0f, 1.0f, 0.0f)));
+			}
+			recomputed = threaded ? scene.update(pool) : scene.update();
+		}
+		double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / frames;
+		cout << "  " << (threaded ? "pool:   " : "single: ") << ms << " ms/frame, " << recomputed << " world matrices per frame" << endl;
+	};
+
+	cout << "Scene graph: " << scene.size() << " nodes in " << scene.numLevels() << " levels, " << pool.size() << " threads" << endl;
+	cout << " every node dirty" << endl;
+	run(false, 1);
+	run(true, 1);
+	cout << " 1% of nodes dirty" << endl;
+	run(false, 100);
+	run(true, 100);
+}
@@ -1,52 +1,28 @@
 #pragma once
 
+#include "glResource.h"
+
 #include <glad/glad.h>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <chrono>
 #include <string>
+#include <unordered_map>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 
 class Shader {
 	public:
-	unsigned int ID; // Shader program ID
+	GLProgram ID; // Shader program, deleted with the Shader
 
 	// Constructor
 	Shader(const char *vertexPath, const char *fragmentPath) {
 		// Retrieve source code from filepaths
-		std::string vertexCode;
-		std::string fragmentCode;
-		std::ifstream vShaderFile;
-		std::ifstream fShaderFile;
-
-		// Throw these exceptions
-		vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-		fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-
-		try {
-			// Open files
-			vShaderFile.open(vertexPath);
-			fShaderFile.open(fragmentPath);
-
-			// Read file buffer contents into streams
-			std::stringstream vShaderStream, fShaderStream;
-			vShaderStream << vShaderFile.rdbuf();
-			fShaderStream << fShaderFile.rdbuf();
-
-			// Convert stream to string
-			vertexCode = vShaderStream.str();
-			fragmentCode = fShaderStream.str();
-
-			// Close files
-			vShaderFile.close();
-			fShaderFile.close();
-		}
-		catch (std::ifstream::failure e) {
-			std::cout << "Error reading shader file" << std::endl;
-		}
+		std::string vertexCode = readSource(vertexPath);
+		std::string fragmentCode = readSource(fragmentPath);
 
 		const char* vShaderCode = vertexCode.c_str();
 		const char* fShaderCode = fragmentCode.c_str();
@@ -79,7 +55,7 @@ class Shader {
 		}
 
 		// Create shader program
-		ID = glCreateProgram();
+		ID = GLProgram::create();
 		glAttachShader(ID, vertex);
 		glAttachShader(ID, fragment);
 		glLinkProgram(ID);
@@ -94,39 +70,194 @@ class Shader {
 		// Delete shaders
 		glDeleteShader(vertex);
 		glDeleteShader(fragment);
+
+		cacheUniformLocations();
 	}
 
-	~Shader() {
-		glDeleteProgram(ID);
+	// Compute program from a single source file
+	explicit Shader(const char *computePath) {
+		std::string computeCode = readSource(computePath);
+
+		const char* cShaderCode = computeCode.c_str();
+
+		int success;
+		char infoLog[512];
+
+		// Compile compute shader
+		unsigned int compute = glCreateShader(GL_COMPUTE_SHADER);
+		glShaderSource(compute, 1, &cShaderCode, NULL);
+		glCompileShader(compute);
+
+		glGetShaderiv(compute, GL_COMPILE_STATUS, &success);
+		if (!success) {
+			glGetShaderInfoLog(compute, 512, NULL, infoLog);
+			std::cout << "Compute shader compilation failed: " << infoLog << std::endl;
+		}
+
+		ID = GLProgram::create();
+		glAttachShader(ID, compute);
+		glLinkProgram(ID);
+
+		glGetProgramiv(ID, GL_LINK_STATUS, &success);
+		if (!success) {
+			glGetProgramInfoLog(ID, 512, NULL, infoLog);
+			std::cout << "Shader program linking failed: " << infoLog << std::endl;
+		}
+
+		glDeleteShader(compute);
+
+		cacheUniformLocations();
 	}
 
+	// Owns the program, so moves only
+	Shader(const Shader &) = delete;
+	Shader &operator=(const Shader &) = delete;
+	Shader(Shader &&) = default;
+	Shader &operator=(Shader &&) = default;
+
 	// Use/activate shader
 	void use() {
 		glUseProgram(ID);
 	}
 
+	// Pre-resolved uniform handle, -1 if the uniform is not active
+	int getLocation(const std::string &name) const {
+		std::unordered_map<std::string, int>::const_iterator found = uniformLocations.find(name);
+		return found != uniformLocations.end() ? found->second : -1;
+	}
+
 	// Utility uniform functions
 	void setBool(const std::string &name, bool value) const {
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+		setBool(getLocation(name), value);
 	}
 
 	void setInt(const std::string &name, int value) const {
-		glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+		setInt(getLocation(name), value);
 	}
 
 	void setFloat(const std::string &name, float value) const {
-		glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+		setFloat(getLocation(name), value);
 	}
 
-	void setMat4(const std::string &name, glm::mat4 value) const {
-		glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, glm::value_ptr(value));
+	void setMat4(const std::string &name, const glm::mat4 &value) const {
+		setMat4(getLocation(name), value);
 	}
 
 	void setVec3(const std::string &name, float x, float y, float z) const {
-		glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
+		setVec3(getLocation(name), x, y, z);
+	}
+
+	void setVec3(const std::string &name, const glm::vec3 &value) const {
+		setVec3(getLocation(name), value);
 	}
 
-	void setVec3(const std::string &name, glm::vec3 value) const {
-		glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, glm::value_ptr(value));
+	// Setters taking handles from getLocation(), no string hashing
+	void setBool(int location, bool value) const {
+		glUniform1i(location, (int)value);
+	}
+
+	void setInt(int location, int value) const {
+		glUniform1i(location, value);
+	}
+
+	void setFloat(int location, float value) const {
+		glUniform1f(location, value);
+	}
+
+	void setMat4(int location, const glm::mat4 &value) const {
+		glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
+	}
+
+	void setVec3(int location, float x, float y, float z) const {
+		glUniform3f(location, x, y, z);
+	}
+
+	void setVec3(int location, const glm::vec3 &value) const {
+		glUniform3fv(location, 1, glm::value_ptr(value));
+	}
+
+	private:
+	std::unordered_map<std::string, int> uniformLocations;
+
+	// Whole file as a string, empty if it can't be read
+	static std::string readSource(const char *path) {
+		std::ifstream file;
+
+		// Throw these exceptions
+		file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+
+		try {
+			// Read file buffer contents into a stream
+			file.open(path);
+			std::stringstream stream;
+			stream << file.rdbuf();
+			file.close();
+			return stream.str();
+		}
+		catch (const std::ifstream::failure &) {
+			std::cout << "Error reading shader file: " << path << std::endl;
+		}
+		return std::string();
+	}
+
+	// Look up every active uniform once after linking
+	void cacheUniformLocations() {
+		int numUniforms = 0;
+		int maxNameLength = 0;
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &numUniforms);
+		glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+
+		std::string name(maxNameLength, '\0');
+		for (int i = 0; i < numUniforms; i++) {
+			int length, size;
+			GLenum type;
+			glGetActiveUniform(ID, i, maxNameLength, &length, &size, &type, &name[0]);
+
+			std::string uniformName = name.substr(0, length);
+			int location = glGetUniformLocation(ID, uniformName.c_str());
+			uniformLocations[uniformName] = location;
+
+			// Arrays are reported as "name[0]", expose every element plus the bare name
+			if (size > 1 || (uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0)) {
+				std::string baseName = uniformName.substr(0, uniformName.find_last_of('['));
+				uniformLocations[baseName] = location;
+				for (int element = 1; element < size; element++) {
+					std::string elementName = baseName + "[" + std::to_string(element) + "]";
+					uniformLocations[elementName] = glGetUniformLocation(ID, elementName.c_str());
+				}
+			}
+		}
+	}
+};
+
+// Time setting one mat4 uniform with glGetUniformLocation on every call, through the cached name lookup, and through a
+// location resolved once. Uses the shader, needs a current context.
+void benchmarkUniformSetters(Shader &shader, const std::string &name, int iterations = 100000) {
+	int location = shader.getLocation(name);
+	if (location < 0) {
+		std::cout << "Uniform setters: " << name << " is not an active uniform" << std::endl;
+		return;
+	}
+
+	shader.use();
+	glm::mat4 value(1.0f);
+	const char *variants[] = { "glGetUniformLocation per call", "cached name lookup", "resolved location" };
+	for (int variant = 0; variant < 3; variant++) {
+		glFinish();
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		for (int i = 0; i < iterations; i++) {
+			value[3][0] = (float)i;
+			if (variant == 0) {
+				glUniformMatrix4fv(glGetUniformLocation(shader.ID, name.c_str()), 1, GL_FALSE, glm::value_ptr(value));
+			} else if (variant == 1) {
+				shader.setMat4(name, value);
+			} else {
+				shader.setMat4(location, value);
+			}
+		}
+		glFinish();
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		std::cout << "Uniform setters (" << variants[variant] << "): " << iterations << " setMat4 in " << ms << " ms, "
+			<< ms * 1e6 / iterations << " ns per call" << std::endl;
 	}
-};
\ No newline at end of file
+}
\ No newline at end of file
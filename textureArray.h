@@ -0,0 +1,158 @@
+#pragma once
+
+#include "glResource.h"
+#include "mesh.h"
+#include "pixelUnpackBuffer.h"
+#include "renderStats.h"
+#include "textureCompression.h"
+#include "textureLoader.h"
+
+#include <glad/glad.h>
+
+#include <vector>
+
+using namespace std;
+
+// First unit of the texturePages samplers, must match their binding in modelShader.fs. Clear of the units meshes bind their own textures to.
+const unsigned int TEXTURE_PAGE_UNIT = 8;
+
+// Must match the texturePages array size in modelShader.fs
+const unsigned int MAX_TEXTURE_PAGES = 4;
+
+// Only diffuse maps are packed, meshes sample no other type through a layer
+bool packsIntoTextureArray(const Texture &texture) {
+	return texture.type == "texture_diffuse";
+}
+
+// Where a texture landed, page -1 when it wasn't packed
+struct TextureLayer {
+	int page = -1;
+	int layer = 0;
+};
+
+// A model's textures packed into GL_TEXTURE_2D_ARRAY pages, one page per size and format. Meshes pick their layer
+// with per-draw uniforms, so the whole model draws with its pages bound once instead of rebinding textures per mesh.
+class TextureArrayPages {
+	public:
+		// Group decoded images by size and format, before any upload(). Textures packsIntoTextureArray() turns down,
+		// images that failed to decode and groups past MAX_TEXTURE_PAGES stay ordinary textures.
+		void plan(const vector<DecodedImage> &images, const vector<Texture> &textures) {
+			pages.clear();
+			layers.assign(images.size(), TextureLayer());
+			for (unsigned int i = 0; i < images.size(); i++) {
+				const DecodedImage &image = images[i];
+				if (!packsIntoTextureArray(textures[i]) || (!image.data && !image.compressed)) {
+					continue;
+				}
+
+				Page page;
+				page.width = image.width;
+				page.height = image.height;
+				if (image.compressed) {
+					page.internalFormat = blockGLFormat(image.compressed->format);
+					page.numLevels = (int)image.compressed->levels.size();
+				} else {
+					GLenum format;
+					imageFormats(image.numComponents, format, page.internalFormat);
+					page.numLevels = mipLevels(image.width, image.height);
+				}
+
+				int found = -1;
+				for (unsigned int j = 0; j < pages.size() && found < 0; j++) {
+					if (pages[j].width == page.width && pages[j].height == page.height && pages[j].internalFormat == page.internalFormat && pages[j].numLevels == page.numLevels) {
+						found = (int)j;
+					}
+				}
+				if (found < 0) {
+					if (pages.size() == MAX_TEXTURE_PAGES) {
+						continue;
+					}
+					found = (int)pages.size();
+					pages.push_back(move(page));
+				}
+				layers[i] = { found, pages[found].numLayers++ };
+			}
+		}
+
+		// Copy image i into its layer, creating the page on first use. Must run on the context thread. Returns the bytes sent.
+		size_t upload(unsigned int i, const DecodedImage &image) {
+			Page &page = pages[layers[i].page];
+			if (page.texture == 0) {
+				page.texture = GLTexture::create(GL_TEXTURE_2D_ARRAY);
+				glBindTexture(GL_TEXTURE_2D_ARRAY, page.texture);
+				glTexStorage3D(GL_TEXTURE_2D_ARRAY, page.numLevels, page.internalFormat, page.width, page.height, page.numLayers);
+
+				// Set wrap and filter options
+				glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+				glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+				glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+				glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			}
+
+			glBindTexture(GL_TEXTURE_2D_ARRAY, page.texture);
+			if (image.compressed) {
+				for (unsigned int level = 0; level < image.compressed->levels.size(); level++) {
+					uploadCompressedLevel(*image.compressed, level, pixelUnpackBuffer(), layers[i].layer);
+				}
+			} else {
+				uploadImageRows(image, pixelUnpackBuffer(), layers[i].layer);
+				page.needsMipmaps = true;
+			}
+			return image.uploadBytes();
+		}
+
+		// Mips of uncompressed pages, once every layer is in
+		void finish() {
+			for (Page &page : pages) {
+				if (page.needsMipmaps) {
+					glBindTexture(GL_TEXTURE_2D_ARRAY, page.texture);
+					glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+					page.needsMipmaps = false;
+				}
+			}
+		}
+
+		// Every page to its unit, once per model draw
+		void bind() const {
+			for (unsigned int i = 0; i < pages.size(); i++) {
+				glActiveTexture(GL_TEXTURE0 + TEXTURE_PAGE_UNIT + i);
+				glBindTexture(GL_TEXTURE_2D_ARRAY, pages[i].texture);
+				renderStats().textureBinds++;
+			}
+			glActiveTexture(GL_TEXTURE0);
+		}
+
+		TextureLayer layer(unsigned int i) const {
+			return i < layers.size() ? layers[i] : TextureLayer();
+		}
+
+		bool empty() const {
+			return pages.empty();
+		}
+
+		size_t numPages() const {
+			return pages.size();
+		}
+
+		size_t numLayers() const {
+			size_t total = 0;
+			for (const Page &page : pages) {
+				total += page.numLayers;
+			}
+			return total;
+		}
+
+	private:
+		struct Page {
+			int width = 0;
+			int height = 0;
+			GLenum internalFormat = GL_RGBA8;
+			int numLevels = 1;
+			int numLayers = 0;
+			bool needsMipmaps = false;
+			GLTexture texture;
+		};
+
+		vector<Page> pages;
+		vector<TextureLayer> layers; // Per planned image
+};
@@ -0,0 +1,632 @@
+#pragma once
+
+#include "mappedFile.h"
+#include "pixelUnpackBuffer.h"
+#include "threadPool.h"
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+// SSE2 for the per-pixel palette fit, every x64 target has it
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TEXTURE_COMPRESSION_SSE2
+#endif
+
+// EXT_texture_compression_s3tc, on every desktop driver but not in the core profile loader
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+using namespace std;
+
+// Picked from the source's channel count: BC4 for grey, BC5 for two channels, BC1 for RGB, BC3 for RGBA
+enum class BlockFormat {
+	BC1,
+	BC3,
+	BC4,
+	BC5
+};
+
+BlockFormat blockFormatFor(int numComponents) {
+	switch (numComponents) {
+		case 1: return BlockFormat::BC4;
+		case 2: return BlockFormat::BC5;
+		case 4: return BlockFormat::BC3;
+		default: return BlockFormat::BC1;
+	}
+}
+
+// Bytes per 4x4 block
+unsigned int blockBytes(BlockFormat format) {
+	return format == BlockFormat::BC1 || format == BlockFormat::BC4 ? 8 : 16;
+}
+
+GLenum blockGLFormat(BlockFormat format) {
+	switch (format) {
+		case BlockFormat::BC1: return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+		case BlockFormat::BC3: return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		case BlockFormat::BC4: return GL_COMPRESSED_RED_RGTC1;
+		default: return GL_COMPRESSED_RG_RGTC2;
+	}
+}
+
+const char *blockFormatName(BlockFormat format) {
+	const char *names[] = { "BC1", "BC3", "BC4", "BC5" };
+	return names[(int)format];
+}
+
+uint16_t packColor565(const float color[3]) {
+	int r = (int)(fmin(fmax(color[0], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+	int g = (int)(fmin(fmax(color[1], 0.0f), 255.0f) * 63.0f / 255.0f + 0.5f);
+	int b = (int)(fmin(fmax(color[2], 0.0f), 255.0f) * 31.0f / 255.0f + 0.5f);
+	return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+void unpackColor565(uint16_t packed, float color[3]) {
+	int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+	color[0] = (float)((r << 3) | (r >> 2));
+	color[1] = (float)((g << 2) | (g >> 4));
+	color[2] = (float)((b << 3) | (b >> 2));
+}
+
+// Color half of BC1/BC3 from 16 RGBA8 pixels. Endpoints span the block's principal axis, inset a little
+// so the extremes land between palette entries, then each pixel takes the nearest of the four colors.
+void encodeBC1Block(const uint8_t pixels[64], uint8_t block[8]) {
+	float mean[3] = { 0.0f, 0.0f, 0.0f };
+	for (int i = 0; i < 16; i++) {
+		for (int c = 0; c < 3; c++) {
+			mean[c] += pixels[i * 4 + c];
+		}
+	}
+	for (int c = 0; c < 3; c++) {
+		mean[c] /= 16.0f;
+	}
+
+	// Covariance, then a few power iterations for its largest eigenvector
+	float covariance[6] = {};
+	for (int i = 0; i < 16; i++) {
+		float r = pixels[i * 4] - mean[0], g = pixels[i * 4 + 1] - mean[1], b = pixels[i * 4 + 2] - mean[2];
+		covariance[0] += r * r;
+		covariance[1] += r * g;
+		covariance[2] += r * b;
+		covariance[3] += g * g;
+		covariance[4] += g * b;
+		covariance[5] += b * b;
+	}
+	float axis[3] = { 1.0f, 1.0f, 1.0f };
+	for (int iteration = 0; iteration < 8; iteration++) {
+		float x = covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2];
+		float y = covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2];
+		float z = covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2];
+		float length = fmax(fabs(x), fmax(fabs(y), fabs(z)));
+		if (length == 0.0f) {
+			break;
+		}
+		axis[0] = x / length;
+		axis[1] = y / length;
+		axis[2] = z / length;
+	}
+
+	float minProjection = INFINITY, maxProjection = -INFINITY;
+	for (int i = 0; i < 16; i++) {
+		float projection = (pixels[i * 4] - mean[0]) * axis[0] + (pixels[i * 4 + 1] - mean[1]) * axis[1] + (pixels[i * 4 + 2] - mean[2]) * axis[2];
+		minProjection = fmin(minProjection, projection);
+		maxProjection = fmax(maxProjection, projection);
+	}
+	float inset = (maxProjection - minProjection) / 16.0f;
+	float endpoints[2][3];
+	for (int c = 0; c < 3; c++) {
+		endpoints[0][c] = mean[c] + axis[c] * (maxProjection - inset);
+		endpoints[1][c] = mean[c] + axis[c] * (minProjection + inset);
+	}
+
+	// color0 > color1 selects the four color mode, equal endpoints mean a flat block
+	uint16_t color0 = packColor565(endpoints[0]), color1 = packColor565(endpoints[1]);
+	if (color0 < color1) {
+		swap(color0, color1);
+	}
+	block[0] = (uint8_t)color0;
+	block[1] = (uint8_t)(color0 >> 8);
+	block[2] = (uint8_t)color1;
+	block[3] = (uint8_t)(color1 >> 8);
+	uint32_t indices = 0;
+	if (color0 != color1) {
+		// Palette is evenly spaced on the line between the decoded endpoints, so the nearest entry comes from the projection
+		float start[3], end[3], direction[3];
+		unpackColor565(color0, start);
+		unpackColor565(color1, end);
+		for (int c = 0; c < 3; c++) {
+			direction[c] = end[c] - start[c];
+		}
+		float scale = 3.0f / (direction[0] * direction[0] + direction[1] * direction[1] + direction[2] * direction[2]);
+
+		int steps[16];
+#if defined(TEXTURE_COMPRESSION_SSE2)
+		for (int i = 0; i < 16; i += 4) {
+			__m128i quad = _mm_loadu_si128((const __m128i *)(pixels + i * 4));
+			__m128 r = _mm_cvtepi32_ps(_mm_and_si128(quad, _mm_set1_epi32(0xff)));
+			__m128 g = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(quad, 8), _mm_set1_epi32(0xff)));
+			__m128 b = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(quad, 16), _mm_set1_epi32(0xff)));
+			__m128 t = _mm_mul_ps(_mm_sub_ps(r, _mm_set1_ps(start[0])), _mm_set1_ps(direction[0]));
+			t = _mm_add_ps(t, _mm_mul_ps(_mm_sub_ps(g, _mm_set1_ps(start[1])), _mm_set1_ps(direction[1])));
+			t = _mm_add_ps(t, _mm_mul_ps(_mm_sub_ps(b, _mm_set1_ps(start[2])), _mm_set1_ps(direction[2])));
+			t = _mm_min_ps(_mm_max_ps(_mm_mul_ps(t, _mm_set1_ps(scale)), _mm_setzero_ps()), _mm_set1_ps(3.0f));
+			_mm_storeu_si128((__m128i *)(steps + i), _mm_cvtps_epi32(t));
+		}
+#else
+		for (int i = 0; i < 16; i++) {
+			float t = 0.0f;
+			for (int c = 0; c < 3; c++) {
+				t += (pixels[i * 4 + c] - start[c]) * direction[c];
+			}
+			steps[i] = (int)lrintf(fmin(fmax(t * scale, 0.0f), 3.0f));
+		}
+#endif
+
+		// Steps along the line to palette order: color0, color1, 2/3 color0 + 1/3 color1, 1/3 color0 + 2/3 color1
+		const uint32_t order[4] = { 0, 2, 3, 1 };
+		for (int i = 0; i < 16; i++) {
+			indices |= order[steps[i]] << (i * 2);
+		}
+	}
+	memcpy(block + 4, &indices, sizeof(indices));
+}
+
+// BC4 block (also BC3 alpha and each half of BC5) from one channel of 16 RGBA8 pixels, eight value mode
+void encodeBC4Block(const uint8_t pixels[64], int channel, uint8_t block[8]) {
+	int low = 255, high = 0;
+	for (int i = 0; i < 16; i++) {
+		low = min<int>(low, pixels[i * 4 + channel]);
+		high = max<int>(high, pixels[i * 4 + channel]);
+	}
+	block[0] = (uint8_t)high;
+	block[1] = (uint8_t)low;
+
+	uint64_t indices = 0;
+	if (high != low) {
+		// Nearest of the seven steps from low to high, mapped to palette order: high, low, then 6/7 high down to 1/7 high
+		float scale = 7.0f / (float)(high - low);
+		for (int i = 0; i < 16; i++) {
+			int step = (int)lrintf((pixels[i * 4 + channel] - low) * scale);
+			uint64_t index = step == 7 ? 0 : step == 0 ? 1 : (uint64_t)(8 - step);
+			indices |= index << (i * 3);
+		}
+	}
+	for (int i = 0; i < 6; i++) {
+		block[2 + i] = (uint8_t)(indices >> (i * 8));
+	}
+}
+
+// Decoders for checking encoder quality, writes 16 RGBA8 pixels (only the channels the format stores)
+void decodeBC1Block(const uint8_t block[8], uint8_t pixels[64]) {
+	uint16_t color0 = (uint16_t)(block[0] | (block[1] << 8)), color1 = (uint16_t)(block[2] | (block[3] << 8));
+	float palette[4][3];
+	unpackColor565(color0, palette[0]);
+	unpackColor565(color1, palette[1]);
+	for (int c = 0; c < 3; c++) {
+		if (color0 > color1) {
+			palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+			palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+		} else {
+			palette[2][c] = (palette[0][c] + palette[1][c]) / 2.0f;
+			palette[3][c] = 0.0f;
+		}
+	}
+
+	uint32_t indices;
+	memcpy(&indices, block + 4, sizeof(indices));
+	for (int i = 0; i < 16; i++) {
+		const float *color = palette[(indices >> (i * 2)) & 3];
+		for (int c = 0; c < 3; c++) {
+			pixels[i * 4 + c] = (uint8_t)(color[c] + 0.5f);
+		}
+	}
+}
+
+void decodeBC4Block(const uint8_t block[8], int channel, uint8_t pixels[64]) {
+	int palette[8] = { block[0], block[1] };
+	for (int i = 2; i < 8; i++) {
+		palette[i] = block[0] > block[1] ? ((8 - i) * block[0] + (i - 1) * block[1]) / 7
+			: i < 6 ? ((6 - i) * block[0] + (i - 1) * block[1]) / 5 : (i == 6 ? 0 : 255);
+	}
+
+	uint64_t indices = 0;
+	for (int i = 0; i < 6; i++) {
+		indices |= (uint64_t)block[2 + i] << (i * 8);
+	}
+	for (int i = 0; i < 16; i++) {
+		pixels[i * 4 + channel] = (uint8_t)palette[(indices >> (i * 3)) & 7];
+	}
+}
+
+void encodeBlock(BlockFormat format, const uint8_t pixels[64], uint8_t *block) {
+	switch (format) {
+		case BlockFormat::BC1:
+			encodeBC1Block(pixels, block);
+			break;
+		case BlockFormat::BC3:
+			encodeBC4Block(pixels, 3, block);
+			encodeBC1Block(pixels, block + 8);
+			break;
+		case BlockFormat::BC4:
+			encodeBC4Block(pixels, 0, block);
+			break;
+		case BlockFormat::BC5:
+			encodeBC4Block(pixels, 0, block);
+			encodeBC4Block(pixels, 1, block + 8);
+			break;
+	}
+}
+
+void decodeBlock(BlockFormat format, const uint8_t *block, uint8_t pixels[64]) {
+	switch (format) {
+		case BlockFormat::BC1:
+			decodeBC1Block(block, pixels);
+			break;
+		case BlockFormat::BC3:
+			decodeBC4Block(block, 3, pixels);
+			decodeBC1Block(block + 8, pixels);
+			break;
+		case BlockFormat::BC4:
+			decodeBC4Block(block, 0, pixels);
+			break;
+		case BlockFormat::BC5:
+			decodeBC4Block(block, 0, pixels);
+			decodeBC4Block(block + 8, 1, pixels);
+			break;
+	}
+}
+
+struct CompressedLevel {
+	uint32_t width;
+	uint32_t height;
+	uint64_t offset; // From the start of the level data
+	uint64_t size;
+};
+
+// Block compressed texture with its whole mip chain, either built in memory or mapped from a cache file
+struct CompressedImage {
+	BlockFormat format = BlockFormat::BC1;
+	int width = 0;
+	int height = 0;
+	vector<CompressedLevel> levels;
+	vector<uint8_t> storage; // Freshly compressed data
+	MappedFile file;         // Or the cache it was read from
+	const uint8_t *bytes = nullptr;
+
+	size_t totalBytes() const {
+		return levels.empty() ? 0 : (size_t)(levels.back().offset + levels.back().size);
+	}
+
+	// What the same chain costs as R8, RG8 or RGBA8, drivers store RGB8 as RGBA8 too
+	size_t uncompressedBytes() const {
+		size_t pixelBytes = format == BlockFormat::BC4 ? 1 : format == BlockFormat::BC5 ? 2 : 4;
+		size_t total = 0;
+		for (const CompressedLevel &level : levels) {
+			total += (size_t)level.width * level.height * pixelBytes;
+		}
+		return total;
+	}
+};
+
+// Every level down to 1x1. Mips are 2x2 box filtered from the level above, as glGenerateMipmap does.
+// flipRows takes top-first source rows to GL's bottom-first order on the way in.
+// The pool splits each level's block rows, pass null when already running on that pool.
+shared_ptr<CompressedImage> compressImage(const uint8_t *pixels, int width, int height, int numComponents, bool flipRows = false, ThreadPool *pool = nullptr) {
+	shared_ptr<CompressedImage> image = make_shared<CompressedImage>();
+	image->format = blockFormatFor(numComponents);
+	image->width = width;
+	image->height = height;
+
+	// Expand to RGBA8 so every format reads the same block layout
+	vector<uint8_t> level((size_t)width * height * 4);
+	for (int y = 0; y < height; y++) {
+		const uint8_t *row = pixels + (size_t)(flipRows ? height - 1 - y : y) * width * numComponents;
+		for (size_t x = 0; x < (size_t)width; x++) {
+			for (int c = 0; c < 4; c++) {
+				level[((size_t)y * width + x) * 4 + c] = c < numComponents ? row[x * numComponents + c] : (c == 3 ? 255 : 0);
+			}
+		}
+	}
+
+	unsigned int bytesPerBlock = blockBytes(image->format);
+	int levelWidth = width, levelHeight = height;
+	while (true) {
+		unsigned int blocksX = (levelWidth + 3) / 4, blocksY = (levelHeight + 3) / 4;
+		CompressedLevel entry = { (uint32_t)levelWidth, (uint32_t)levelHeight, image->storage.size(), (uint64_t)blocksX * blocksY * bytesPerBlock };
+		image->levels.push_back(entry);
+		image->storage.resize(entry.offset + entry.size);
+
+		// Edge blocks repeat the last row and column
+		uint8_t *out = image->storage.data() + entry.offset;
+		auto encodeRow = [&](size_t blockY) {
+			uint8_t block[64];
+			for (unsigned int blockX = 0; blockX < blocksX; blockX++) {
+				for (int y = 0; y < 4; y++) {
+					int sourceY = min<int>((int)blockY * 4 + y, levelHeight - 1);
+					for (int x = 0; x < 4; x++) {
+						int sourceX = min<int>(blockX * 4 + x, levelWidth - 1);
+						memcpy(block + (y * 4 + x) * 4, &level[((size_t)sourceY * levelWidth + sourceX) * 4], 4);
+					}
+				}
+				encodeBlock(image->format, block, out + ((size_t)blockY * blocksX + blockX) * bytesPerBlock);
+			}
+		};
+		if (pool) {
+			pool->parallelFor(blocksY, encodeRow);
+		} else {
+			for (unsigned int blockY = 0; blockY < blocksY; blockY++) {
+				encodeRow(blockY);
+			}
+		}
+
+		if (levelWidth == 1 && levelHeight == 1) {
+			break;
+		}
+
+		int nextWidth = max(levelWidth / 2, 1), nextHeight = max(levelHeight / 2, 1);
+		vector<uint8_t> next((size_t)nextWidth * nextHeight * 4);
+		for (int y = 0; y < nextHeight; y++) {
+			int y0 = min(y * 2, levelHeight - 1), y1 = min(y * 2 + 1, levelHeight - 1);
+			for (int x = 0; x < nextWidth; x++) {
+				int x0 = min(x * 2, levelWidth - 1), x1 = min(x * 2 + 1, levelWidth - 1);
+				for (int c = 0; c < 4; c++) {
+					int sum = level[((size_t)y0 * levelWidth + x0) * 4 + c] + level[((size_t)y0 * levelWidth + x1) * 4 + c]
+						+ level[((size_t)y1 * levelWidth + x0) * 4 + c] + level[((size_t)y1 * levelWidth + x1) * 4 + c];
+					next[((size_t)y * nextWidth + x) * 4 + c] = (uint8_t)((sum + 2) / 4);
+				}
+			}
+		}
+		level = move(next);
+		levelWidth = nextWidth;
+		levelHeight = nextHeight;
+	}
+
+	image->bytes = image->storage.data();
+	return image;
+}
+
+// Texture cache file, DDS-like: header, level table, then every level's blocks back to back
+const uint32_t TEXTURE_CACHE_MAGIC   = 0x5845544C; // "LTEX"
+const uint32_t TEXTURE_CACHE_VERSION = 2;
+
+struct TextureCacheHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t format; // BlockFormat
+	uint32_t numLevels;
+	uint32_t width;
+	uint32_t height;
+	uint32_t flipped; // Rows flipped on load
+	uint32_t pad0;
+
+	// Source file stamp
+	uint64_t sourceSize;
+	int64_t sourceTime;
+
+	uint64_t dataOffset;
+};
+
+// What a cached chain depends on besides the source file, a cache built for anything else is stale
+struct TextureCacheKey {
+	BlockFormat format;
+	int width;
+	int height;
+	unsigned int numLevels; // Full chain down to 1x1, as compressImage builds it
+	bool flipped;           // See setFlipTexturesOnLoad
+};
+
+// From the source's header, so the cache can be checked without decoding
+TextureCacheKey textureCacheKey(int width, int height, int numComponents, bool flipped) {
+	TextureCacheKey key;
+	key.format = blockFormatFor(numComponents);
+	key.width = width;
+	key.height = height;
+	key.numLevels = 1;
+	for (int size = max(width, height); size > 1; size /= 2) {
+		key.numLevels++;
+	}
+	key.flipped = flipped;
+	return key;
+}
+
+string textureCachePath(const string &sourcePath) {
+	return sourcePath + ".texcache";
+}
+
+bool writeTextureCache(const string &cachePath, const string &sourcePath, const CompressedImage &image, bool flipped) {
+	TextureCacheHeader header = {};
+	header.magic = TEXTURE_CACHE_MAGIC;
+	header.version = TEXTURE_CACHE_VERSION;
+	header.format = (uint32_t)image.format;
+	header.numLevels = (uint32_t)image.levels.size();
+	header.width = (uint32_t)image.width;
+	header.height = (uint32_t)image.height;
+	header.flipped = flipped ? 1 : 0;
+	if (!getSourceStamp(sourcePath, header.sourceSize, header.sourceTime)) {
+		return false;
+	}
+	header.dataOffset = (sizeof(TextureCacheHeader) + image.levels.size() * sizeof(CompressedLevel) + 15) & ~(uint64_t)15;
+
+	// Temporary file first so a crash never leaves a half-written cache behind
+	string tempPath = cachePath + ".tmp";
+	ofstream out(tempPath, ios::binary | ios::trunc);
+	if (!out) {
+		return false;
+	}
+	static const char padding[16] = {};
+	out.write((const char *)&header, sizeof(header));
+	out.write((const char *)image.levels.data(), image.levels.size() * sizeof(CompressedLevel));
+	out.write(padding, header.dataOffset - (uint64_t)out.tellp());
+	out.write((const char *)image.bytes, image.totalBytes());
+	out.close();
+
+	if (!out) {
+		filesystem::remove(tempPath);
+		return false;
+	}
+
+	error_code error;
+	filesystem::rename(tempPath, cachePath, error);
+	return !error;
+}
+
+// Map a cache built from the current source for the same key, null when missing or stale
+shared_ptr<CompressedImage> openTextureCache(const string &cachePath, const string &sourcePath, const TextureCacheKey &key) {
+	uint64_t sourceSize;
+	int64_t sourceTime;
+	shared_ptr<CompressedImage> image = make_shared<CompressedImage>();
+	if (!getSourceStamp(sourcePath, sourceSize, sourceTime) || !image->file.open(cachePath) || image->file.size() < sizeof(TextureCacheHeader)) {
+		return nullptr;
+	}
+
+	const TextureCacheHeader *header = (const TextureCacheHeader *)image->file.data();
+	bool valid = header->magic == TEXTURE_CACHE_MAGIC
+		&& header->version == TEXTURE_CACHE_VERSION
+		&& header->format == (uint32_t)key.format
+		&& header->width == (uint32_t)key.width
+		&& header->height == (uint32_t)key.height
+		&& header->numLevels == key.numLevels
+		&& header->flipped == (key.flipped ? 1u : 0u)
+		&& header->sourceSize == sourceSize
+		&& header->sourceTime == sourceTime
+		&& sizeof(TextureCacheHeader) + header->numLevels * sizeof(CompressedLevel) <= header->dataOffset;
+	if (!valid) {
+		return nullptr;
+	}
+
+	image->format = (BlockFormat)header->format;
+	image->width = (int)header->width;
+	image->height = (int)header->height;
+	const CompressedLevel *levels = (const CompressedLevel *)(image->file.data() + sizeof(TextureCacheHeader));
+	image->levels.assign(levels, levels + header->numLevels);
+	image->bytes = image->file.data() + header->dataOffset;
+	if (image->levels.empty() || header->dataOffset + image->totalBytes() > image->file.size()) {
+		return nullptr;
+	}
+	return image;
+}
+
+// One level of the texture bound to GL_TEXTURE_2D, or one layer's level of the one bound to GL_TEXTURE_2D_ARRAY,
+// copied through the unpack buffer in bands of block rows. Storage must already exist. Returns the bytes sent.
+size_t uploadCompressedLevel(const CompressedImage &image, unsigned int levelIndex, PixelUnpackBuffer &unpack, int layer = -1) {
+	const CompressedLevel &level = image.levels[levelIndex];
+	size_t rowBytes = (size_t)(level.width + 3) / 4 * blockBytes(image.format);
+	unsigned int blockRows = (level.height + 3) / 4;
+	unsigned int bandRows = (unsigned int)max<size_t>(unpack.maxReservation() / rowBytes, 1);
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpack.ID);
+	for (unsigned int first = 0; first < blockRows; first += bandRows) {
+		unsigned int rows = min(bandRows, blockRows - first);
+		size_t offset = unpack.reserve(rows * rowBytes);
+		memcpy(unpack.data(offset), image.bytes + level.offset + first * rowBytes, rows * rowBytes);
+
+		unsigned int y = first * 4;
+		unsigned int height = min(level.height - y, rows * 4);
+		if (layer < 0) {
+			glCompressedTexSubImage2D(GL_TEXTURE_2D, levelIndex, 0, y, level.width, height, blockGLFormat(image.format), (int)(rows * rowBytes), (void *)offset);
+		} else {
+			glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, levelIndex, 0, y, layer, level.width, height, 1, blockGLFormat(image.format), (int)(rows * rowBytes), (void *)offset);
+		}
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	return (size_t)level.size;
+}
+
+// Immutable storage for the whole chain with every level uploaded. Must run on the context thread.
+unsigned int uploadCompressedTexture(const CompressedImage &image, PixelUnpackBuffer &unpack) {
+	unsigned int textureID;
+	glGenTextures(1, &textureID);
+	glBindTexture(GL_TEXTURE_2D, textureID);
+	glTexStorage2D(GL_TEXTURE_2D, (int)image.levels.size(), blockGLFormat(image.format), image.width, image.height);
+	for (unsigned int i = 0; i < image.levels.size(); i++) {
+		uploadCompressedLevel(image, i, unpack);
+	}
+
+	// Set wrap and filter options
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	return textureID;
+}
+
+// Peak signal to noise ratio of the top level against the RGBA8 source, over the channels the format keeps
+double compressionPsnr(const CompressedImage &image, const uint8_t *pixels, int numComponents) {
+	const CompressedLevel &level = image.levels[0];
+	unsigned int blocksX = (level.width + 3) / 4, blocksY = (level.height + 3) / 4;
+	double squaredError = 0.0;
+	size_t samples = 0;
+	for (unsigned int blockY = 0; blockY < blocksY; blockY++) {
+		for (unsigned int blockX = 0; blockX < blocksX; blockX++) {
+			uint8_t decoded[64] = {};
+			decodeBlock(image.format, image.bytes + level.offset + ((size_t)blockY * blocksX + blockX) * blockBytes(image.format), decoded);
+			for (unsigned int y = blockY * 4; y < min(blockY * 4 + 4, level.height); y++) {
+				for (unsigned int x = blockX * 4; x < min(blockX * 4 + 4, level.width); x++) {
+					for (int c = 0; c < numComponents; c++) {
+						double difference = (double)decoded[((y - blockY * 4) * 4 + (x - blockX * 4)) * 4 + c] - pixels[((size_t)y * level.width + x) * numComponents + c];
+						squaredError += difference * difference;
+						samples++;
+					}
+				}
+			}
+		}
+	}
+	double meanSquaredError = squaredError / max<size_t>(samples, 1);
+	return meanSquaredError == 0.0 ? INFINITY : 10.0 * log10(255.0 * 255.0 / meanSquaredError);
+}
+
+// Compress a synthetic 2K RGB and RGBA image serially and on the pool, log throughput, quality and size
+void benchmarkTextureCompression(ThreadPool &pool, int size = 2048) {
+	// Smooth gradients with a noisy detail band, like a photo texture
+	mt19937 random(1234);
+	uniform_int_distribution<int> noise(-12, 12);
+	for (int numComponents : { 3, 4 }) {
+		vector<uint8_t> pixels((size_t)size * size * numComponents);
+		for (int y = 0; y < size; y++) {
+			for (int x = 0; x < size; x++) {
+				uint8_t *pixel = &pixels[((size_t)y * size + x) * numComponents];
+				int detail = (y / 64) % 2 ? noise(random) : 0;
+				pixel[0] = (uint8_t)min(max(x * 255 / size + detail, 0), 255);
+				pixel[1] = (uint8_t)min(max(y * 255 / size + detail, 0), 255);
+				pixel[2] = (uint8_t)min(max(128 + (int)(100.0f * sin(x * 0.01f) * cos(y * 0.013f)) + detail, 0), 255);
+				if (numComponents == 4) {
+					pixel[3] = (uint8_t)((x ^ y) & 255);
+				}
+			}
+		}
+
+		auto start = chrono::steady_clock::now();
+		shared_ptr<CompressedImage> serial = compressImage(pixels.data(), size, size, numComponents);
+		auto middle = chrono::steady_clock::now();
+		shared_ptr<CompressedImage> parallel = compressImage(pixels.data(), size, size, numComponents, false, &pool);
+		auto end = chrono::steady_clock::now();
+
+		// Mip chain has 4/3 the pixels of the top level
+		double megapixels = (double)size * size * 4.0 / 3.0 / 1e6;
+		double serialSeconds = chrono::duration<double>(middle - start).count();
+		double parallelSeconds = chrono::duration<double>(end - middle).count();
+		bool same = serial->storage == parallel->storage;
+		cout << "Texture compression " << size << "x" << size << " " << blockFormatName(serial->format) << ", " << serial->levels.size() << " levels: "
+			<< megapixels / serialSeconds << " MP/s single, " << megapixels / parallelSeconds << " MP/s on " << pool.size() << " threads" << endl;
+		cout << "  " << serial->totalBytes() / 1024 << " KB instead of " << serial->uncompressedBytes() / 1024 << " KB, PSNR "
+			<< compressionPsnr(*serial, pixels.data(), numComponents) << " dB" << (same ? "" : ", MISMATCH between serial and pool output") << endl;
+	}
+}
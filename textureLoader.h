@@ -0,0 +1,313 @@
+#pragma once
+
+#include "allocationCounter.h"
+#include "mappedFile.h"
+#include "pixelUnpackBuffer.h"
+#include "textureCompression.h"
+#include "threadPool.h"
+
+#include <glad/glad.h>
+
+// Image loading library
+#include "stb_image.h"
+
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// GL wants the bottom row first. Set once at startup, replaces stbi_set_flip_vertically_on_load.
+bool &flipTexturesOnLoad() {
+	static bool flip = false;
+	return flip;
+}
+
+void setFlipTexturesOnLoad(bool flip) {
+	flipTexturesOnLoad() = flip;
+	stbi_set_flip_vertically_on_load(flip);
+}
+
+// CPU-side pixels waiting to be uploaded
+struct DecodedImage {
+	string filename;
+	unsigned char *data = nullptr;
+	int width = 0;
+	int height = 0;
+	int numComponents = 0;
+	bool flipRows = false; // Rows are still top first, the upload reverses them as it copies
+
+	// Block compressed chain, uploaded instead of data when set
+	shared_ptr<CompressedImage> compressed;
+	bool fromCache = false;  // Compressed chain came from the texture cache, nothing was decoded
+	double decodeMs = 0.0;   // JPEG/PNG decode, or mapping the cache
+	double compressMs = 0.0;
+
+	// Bytes the upload sends to GL
+	size_t uploadBytes() const {
+		return compressed ? compressed->totalBytes() : (size_t)width * height * numComponents;
+	}
+};
+
+// Safe to call from any thread, touches no GL state. With compress, reads the block compressed chain from the
+// texture cache when it is current, otherwise decodes, compresses on this thread and writes the cache.
+DecodedImage decodeImage(const string &filename, bool compress = false) {
+	DecodedImage image;
+	image.filename = filename;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	if (compress) {
+		// Only the source's header, a cache built for another orientation or format of it is never used
+		int width, height, numComponents;
+		if (stbi_info(filename.c_str(), &width, &height, &numComponents)) {
+			image.compressed = openTextureCache(textureCachePath(filename), filename, textureCacheKey(width, height, numComponents, flipTexturesOnLoad()));
+		}
+		if (image.compressed) {
+			image.fromCache = true;
+			image.width = image.compressed->width;
+			image.height = image.compressed->height;
+			image.decodeMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+			return image;
+		}
+	}
+
+	// Decode straight from the page cache, no stdio buffer. stb's own flip would be another pass over the pixels,
+	// so it is turned off for this thread and the copy into the upload buffer does it instead.
+	MappedFile file;
+	if (file.open(filename)) {
+		stbi_set_flip_vertically_on_load_thread(0);
+		image.data = stbi_load_from_memory(file.data(), (int)file.size(), &image.width, &image.height, &image.numComponents, 0);
+		stbi_set_flip_vertically_on_load_thread(flipTexturesOnLoad());
+		image.flipRows = flipTexturesOnLoad();
+	} else {
+		image.data = stbi_load(filename.c_str(), &image.width, &image.height, &image.numComponents, 0);
+	}
+	image.decodeMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	if (!compress || !image.data) {
+		return image;
+	}
+
+	start = chrono::steady_clock::now();
+	image.compressed = compressImage(image.data, image.width, image.height, image.numComponents, image.flipRows);
+	image.compressMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+	if (!writeTextureCache(textureCachePath(filename), filename, *image.compressed, flipTexturesOnLoad())) {
+		cout << "Failed to write texture cache: " << textureCachePath(filename) << endl;
+	}
+	stbi_image_free(image.data);
+	image.data = nullptr;
+	return image;
+}
+
+// Decode every file on the pool, results are in the same order as the input
+vector<DecodedImage> decodeImages(const vector<string> &filenames, ThreadPool &pool, bool compress = false) {
+	vector<future<DecodedImage>> pending;
+	pending.reserve(filenames.size());
+	for (const string &filename : filenames) {
+		pending.push_back(pool.submit([filename, compress] { return decodeImage(filename, compress); }));
+	}
+
+	vector<DecodedImage> images;
+	images.reserve(filenames.size());
+	for (future<DecodedImage> &image : pending) {
+		images.push_back(image.get());
+	}
+	return images;
+}
+
+// Rows of a top-first or bottom-first image into a bottom-first destination, one pass either way
+void copyImageRows(const unsigned char *source, int width, int height, int numComponents, int firstRow, int numRows, bool flipRows, unsigned char *destination) {
+	size_t rowBytes = (size_t)width * numComponents;
+	for (int row = firstRow; row < firstRow + numRows; row++) {
+		int sourceRow = flipRows ? height - 1 - row : row;
+		memcpy(destination + (row - firstRow) * rowBytes, source + sourceRow * rowBytes, rowBytes);
+	}
+}
+
+// Sized and client formats for 8-bit pixels with 1 to 4 channels
+void imageFormats(int numComponents, GLenum &format, GLenum &internalFormat) {
+	format = GL_RGBA;
+	internalFormat = GL_RGBA8;
+	if (numComponents == 1) {
+		format = GL_RED;
+		internalFormat = GL_R8;
+	} else if (numComponents == 2) {
+		format = GL_RG;
+		internalFormat = GL_RG8;
+	} else if (numComponents == 3) {
+		format = GL_RGB;
+		internalFormat = GL_RGB8;
+	}
+}
+
+// Levels of a full chain down to 1x1
+int mipLevels(int width, int height) {
+	int numLevels = 1;
+	while ((max(width, height) >> numLevels) > 0) {
+		numLevels++;
+	}
+	return numLevels;
+}
+
+// Level 0 of the texture bound to GL_TEXTURE_2D, or one layer of the one bound to GL_TEXTURE_2D_ARRAY, copied through
+// the unpack buffer in bands of rows. Storage must already exist.
+void uploadImageRows(const DecodedImage &image, PixelUnpackBuffer &unpack, int layer = -1) {
+	GLenum format, internalFormat;
+	imageFormats(image.numComponents, format, internalFormat);
+
+	// Rows are tightly packed, RGB rows needn't be a multiple of 4 bytes
+	size_t rowBytes = (size_t)image.width * image.numComponents;
+	int bandRows = (int)max<size_t>(unpack.maxReservation() / rowBytes, 1);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpack.ID);
+	for (int first = 0; first < image.height; first += bandRows) {
+		int rows = min(bandRows, image.height - first);
+		size_t offset = unpack.reserve(rows * rowBytes);
+		copyImageRows(image.data, image.width, image.height, image.numComponents, first, rows, image.flipRows, unpack.data(offset));
+		if (layer < 0) {
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first, image.width, rows, format, GL_UNSIGNED_BYTE, (void *)offset);
+		} else {
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, first, layer, image.width, rows, 1, format, GL_UNSIGNED_BYTE, (void *)offset);
+		}
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+// Create a mipmapped texture from decoded pixels, must run on the context thread. Frees the pixels.
+// Pixels are copied into the shared unpack buffer in bands and the texture sourced from there, so GL makes no copy of its own.
+unsigned int uploadTexture(DecodedImage &image) {
+	PixelUnpackBuffer &unpack = pixelUnpackBuffer();
+
+	// Whole chain is precomputed, no glGenerateMipmap
+	if (image.compressed) {
+		unsigned int textureID = uploadCompressedTexture(*image.compressed, unpack);
+		image.compressed.reset();
+		return textureID;
+	}
+
+	// Create texture
+	unsigned int textureID;
+	glGenTextures(1, &textureID);
+
+	if (image.data) {
+		GLenum format, internalFormat;
+		imageFormats(image.numComponents, format, internalFormat);
+		glBindTexture(GL_TEXTURE_2D, textureID);
+		glTexStorage2D(GL_TEXTURE_2D, mipLevels(image.width, image.height), internalFormat, image.width, image.height);
+		uploadImageRows(image, unpack);
+		glGenerateMipmap(GL_TEXTURE_2D);
+
+		// Set wrap and filter options
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);  // Magnification doesn't use mipmaps
+	} else {
+		cout << "Texture failed to load at path: " << image.filename << endl;
+	}
+	stbi_image_free(image.data);
+	image.data = nullptr;
+
+	return textureID;
+}
+
+// JPEGs and PNGs directly in a directory
+vector<string> imageFilenames(const string &directory) {
+	vector<string> filenames;
+	error_code error;
+	for (const filesystem::directory_entry &entry : filesystem::directory_iterator(directory, error)) {
+		string extension = entry.path().extension().string();
+		if (extension == ".jpg" || extension == ".jpeg" || extension == ".png") {
+			filenames.push_back(entry.path().generic_string());
+		}
+	}
+	return filenames;
+}
+
+// Decode every JPEG/PNG in a directory through stdio with stb's flip, then from a mapping with the flip folded into the
+// copy to the upload buffer (a heap stand-in here, no GL needed). Logs time, MB/s and heap allocations of each path,
+// stb_image's through its hooks and the rest only with COUNT_ALLOCATIONS (see allocationCounter.h).
+void benchmarkImageLoading(const string &directory, int iterations = 3) {
+	vector<string> filenames = imageFilenames(directory);
+	if (filenames.empty()) {
+		cout << "Image loading: no images in " << directory << endl;
+		return;
+	}
+
+	vector<unsigned char> staging;
+	for (int mapped = 0; mapped < 2; mapped++) {
+		size_t decodedBytes = 0;
+		AllocationCounter cost;
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (int iteration = 0; iteration < iterations; iteration++) {
+			for (const string &filename : filenames) {
+				// The staging copy stands in for glTexImage2D's copy of client memory, or the write into the unpack buffer
+				AllocationCounter before = threadAllocations;
+				int width = 0, height = 0, numComponents = 0;
+				unsigned char *pixels = nullptr;
+				if (mapped) {
+					MappedFile file(filename);
+					stbi_set_flip_vertically_on_load_thread(0);
+					pixels = file.isOpen() ? stbi_load_from_memory(file.data(), (int)file.size(), &width, &height, &numComponents, 0) : nullptr;
+				} else {
+					stbi_set_flip_vertically_on_load_thread(1);
+					pixels = stbi_load(filename.c_str(), &width, &height, &numComponents, 0);
+				}
+				stbi_set_flip_vertically_on_load_thread(flipTexturesOnLoad());
+				if (!pixels) {
+					continue;
+				}
+
+				size_t bytes = (size_t)width * height * numComponents;
+				if (staging.size() < bytes) {
+					staging.resize(bytes);
+				}
+				copyImageRows(pixels, width, height, numComponents, 0, height, mapped != 0, staging.data());
+				stbi_image_free(pixels);
+				cost += threadAllocations - before;
+				decodedBytes += bytes;
+			}
+		}
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		cout << "Image loading " << (mapped ? "(mapped):" : "(stdio): ") << " " << filenames.size() << " images x " << iterations << ", "
+			<< seconds * 1000.0 / iterations << " ms per pass, " << decodedBytes / seconds / 1e6 << " MB/s decoded, "
+			<< cost.allocations / iterations << " allocations per pass" << endl;
+	}
+}
+
+// Decode every JPEG/PNG in a directory through decodeImages on pools of 1 to maxThreads threads (hardware threads by
+// default) and log the time and speedup of each, without compression so the texture cache can't hide the decode.
+void benchmarkParallelDecoding(const string &directory, unsigned int maxThreads = 0, int iterations = 3) {
+	vector<string> filenames = imageFilenames(directory);
+	if (filenames.empty()) {
+		cout << "Parallel decoding: no images in " << directory << endl;
+		return;
+	}
+	if (maxThreads == 0) {
+		maxThreads = max(thread::hardware_concurrency(), 1u);
+	}
+
+	cout << "Parallel decoding: " << filenames.size() << " images x " << iterations << endl;
+	double serialMs = 0.0;
+	for (unsigned int numThreads = 1; numThreads <= maxThreads; numThreads++) {
+		ThreadPool pool(numThreads);
+		size_t decodedBytes = 0;
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for (int iteration = 0; iteration < iterations; iteration++) {
+			for (DecodedImage &image : decodeImages(filenames, pool)) {
+				decodedBytes += image.uploadBytes();
+				stbi_image_free(image.data);
+			}
+		}
+		double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() / iterations;
+		if (numThreads == 1) {
+			serialMs = ms;
+		}
+		cout << "  " << numThreads << (numThreads == 1 ? " thread:  " : " threads: ") << ms << " ms per pass, "
+			<< decodedBytes / iterations / (ms / 1000.0) / 1e6 << " MB/s decoded, " << serialMs / ms << "x" << endl;
+	}
+}
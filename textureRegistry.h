@@ -0,0 +1,97 @@
+#pragma once
+
+#include "glResource.h"
+
+#include <glad/glad.h>
+
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+using namespace std;
+
+// Process-wide set of resident textures keyed by canonical file path, so models sharing an image share one GL texture
+class TextureRegistry {
+	public:
+		static TextureRegistry &instance() {
+			static TextureRegistry registry;
+			return registry;
+		}
+
+		// Absolute, normalized form of a path so different spellings of the same file collide
+		static string canonicalPath(const string &path) {
+			error_code error;
+			filesystem::path canonical = filesystem::weakly_canonical(filesystem::absolute(path), error);
+			if (error) {
+				return filesystem::path(path).lexically_normal().generic_string();
+			}
+			return canonical.generic_string();
+		}
+
+		// Take a reference to a resident texture, returns false if it still has to be loaded
+		bool acquire(const string &key, unsigned int &id) {
+			lock_guard<mutex> lock(registryMutex);
+			unordered_map<string, Entry>::iterator found = entries.find(key);
+			if (found == entries.end()) {
+				return false;
+			}
+
+			found->second.refCount++;
+			id = found->second.texture;
+			return true;
+		}
+
+		// Register a freshly uploaded texture with one reference held by the caller. Streamed textures were added to
+		// textureStreamer(), which must forget them when they are deleted.
+		void add(const string &key, unsigned int id, bool streamed = false) {
+			lock_guard<mutex> lock(registryMutex);
+			Entry &entry = entries[key];
+			if (entry.texture != id) {
+				entry.texture.reset(id);
+			}
+			entry.streamed = streamed;
+			entry.refCount++;
+		}
+
+		// Drop a reference, deleting the GL texture once nobody uses it. Returns true if it was deleted, with streamed
+		// set to how it was added.
+		bool release(const string &key, bool &streamed) {
+			lock_guard<mutex> lock(registryMutex);
+			unordered_map<string, Entry>::iterator found = entries.find(key);
+			if (found == entries.end()) {
+				return false;
+			}
+
+			// Erasing the entry deletes the GL texture
+			if (--found->second.refCount == 0) {
+				streamed = found->second.streamed;
+				entries.erase(found);
+				return true;
+			}
+			return false;
+		}
+
+		size_t size() {
+			lock_guard<mutex> lock(registryMutex);
+			return entries.size();
+		}
+
+		// Delete textures still registered while the context is current, models that outlived it never released theirs
+		void shutdown() {
+			lock_guard<mutex> lock(registryMutex);
+			entries.clear();
+		}
+
+	private:
+		struct Entry {
+			GLTexture texture;
+			unsigned int refCount = 0;
+			bool streamed = false;
+		};
+
+		unordered_map<string, Entry> entries;
+		mutex registryMutex;
+
+		TextureRegistry() {}
+};
@@ -0,0 +1,474 @@
+#pragma once
+
+#include "benchmark.h"
+#include "bounds.h"
+#include "camera.h"
+#include "frustumCulling.h"
+#include "lockFreeQueue.h"
+#include "mesh.h"
+#include "meshLod.h"
+#include "pixelUnpackBuffer.h"
+#include "textureCompression.h"
+#include "threadPool.h"
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// Levels this small or smaller are uploaded with the texture and never evicted
+const unsigned int TEXTURE_STREAMING_TAIL_SIZE = 64;
+
+// What the streamer holds after the last update
+struct TextureResidency {
+	unsigned int numTextures = 0;
+	size_t budgetBytes = 0;
+	size_t residentBytes = 0;  // Levels holding valid data, tails included
+	size_t pendingBytes = 0;   // Levels being fetched or waiting for upload, already counted against the budget
+	size_t peakBytes = 0;      // Highest resident + pending seen
+	size_t fullChainBytes = 0; // Every texture fully resident
+	unsigned int missingLevels = 0; // Levels requested textures want that aren't resident yet
+	size_t streamedLevels = 0;
+	size_t streamedBytes = 0;
+	size_t evictedLevels = 0;
+	unsigned int overBudgetUpdates = 0; // Updates that ended over the budget, only tails can cause it
+};
+
+// Block compressed textures whose fine mips are streamed in on demand. Each texture gets immutable storage for its
+// whole chain but only the tail levels are uploaded up front. Draws report how large each texture appears with
+// request(), and update() fetches the next finer level of the largest ones on worker threads, then uploads it on
+// the context thread. GL_TEXTURE_BASE_LEVEL keeps sampling on resident levels. Resident levels stay within a byte
+// budget, textures requested least recently give up their finest levels first.
+// Storage is immutable, so an evicted level is invalidated rather than freed and the driver may drop its pages.
+// Without GL everything but the GL calls runs, which is what the headless check below uses.
+class TextureStreamer {
+	public:
+		size_t frameUploadBytes = 8 << 20; // GL uploads per update
+		unsigned int maxInFlight = 8;      // Levels being fetched at once
+
+		TextureStreamer(size_t budgetBytes = 256 << 20, bool useGL = true, unsigned int numThreads = 2) : useGL(useGL), workers(numThreads) {
+			stats.budgetBytes = budgetBytes;
+		}
+
+		TextureStreamer(const TextureStreamer &) = delete;
+		TextureStreamer &operator=(const TextureStreamer &) = delete;
+
+		// Create storage for the whole chain and upload the tail, returns the GL texture (an opaque handle without GL).
+		// The caller owns the texture and must remove() it before deleting it.
+		unsigned int add(shared_ptr<CompressedImage> image) {
+			Entry entry;
+			entry.image = image;
+			entry.serial = nextSerial++;
+			entry.tailLevel = (unsigned int)image->levels.size() - 1;
+			while (entry.tailLevel > 0 && max(image->levels[entry.tailLevel - 1].width, image->levels[entry.tailLevel - 1].height) <= TEXTURE_STREAMING_TAIL_SIZE) {
+				entry.tailLevel--;
+			}
+			entry.residentLevel = entry.tailLevel;
+			entry.wantedLevel = entry.tailLevel;
+
+			unsigned int id;
+			if (useGL) {
+				glGenTextures(1, &id);
+				glBindTexture(GL_TEXTURE_2D, id);
+				glTexStorage2D(GL_TEXTURE_2D, (int)image->levels.size(), blockGLFormat(image->format), image->width, image->height);
+				for (unsigned int level = entry.tailLevel; level < image->levels.size(); level++) {
+					uploadCompressedLevel(*image, level, pixelUnpackBuffer());
+				}
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, entry.tailLevel);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			} else {
+				id = ++lastHeadlessID;
+			}
+
+			stats.residentBytes += bytesFrom(entry, entry.tailLevel);
+			stats.fullChainBytes += image->totalBytes();
+			stats.numTextures++;
+			entries[id] = move(entry);
+			return id;
+		}
+
+		// Forget a texture, a level still being fetched for it is dropped when it arrives
+		void remove(unsigned int id) {
+			unordered_map<unsigned int, Entry>::iterator found = entries.find(id);
+			if (found == entries.end()) {
+				return;
+			}
+
+			Entry &entry = found->second;
+			if (entry.fetchingLevel != NOT_FETCHING) {
+				stats.pendingBytes -= entry.image->levels[entry.fetchingLevel].size;
+			}
+			stats.residentBytes -= bytesFrom(entry, entry.residentLevel);
+			stats.fullChainBytes -= entry.image->totalBytes();
+			stats.numTextures--;
+			entries.erase(found);
+		}
+
+		// Report that a mesh is drawn this frame, its textures want the level matching its projected size.
+		// With LOD disabled (no pixelsPerUnit) they want full detail.
+		void request(const Mesh &mesh, const glm::mat4 &model, const LodView &view) {
+			glm::vec3 center = glm::vec3(model * glm::vec4(mesh.bounds.center, 1.0f));
+			float scale = max(max(glm::length(glm::vec3(model[0])), glm::length(glm::vec3(model[1]))), glm::length(glm::vec3(model[2])));
+			float radius = mesh.bounds.radius * scale;
+			float distance = glm::length(center - view.cameraPosition);
+
+			// Screen height of the bounding sphere, a texture mapped once across the mesh needs that many texels
+			float pixels = INFINITY;
+			if (view.pixelsPerUnit > 0.0f && distance > radius) {
+				pixels = 2.0f * radius * view.pixelsPerUnit / distance;
+			}
+			for (const Texture &texture : mesh.textures) {
+				request(texture.id, pixels, distance);
+			}
+		}
+
+		// Same for one texture, ignored for textures the streamer doesn't hold
+		void request(unsigned int id, float pixels, float distance) {
+			unordered_map<unsigned int, Entry>::iterator found = entries.find(id);
+			if (found == entries.end()) {
+				return;
+			}
+
+			// Coarsest level at least as large as the texture appears
+			Entry &entry = found->second;
+			unsigned int level = 0;
+			float size = (float)max(entry.image->width, entry.image->height);
+			if (pixels < size) {
+				level = min((unsigned int)floor(log2(size / max(pixels, 1.0f))), entry.tailLevel);
+			}
+
+			// Several meshes may share a texture, the largest decides
+			if (entry.lastRequested != frame) {
+				entry.lastRequested = frame;
+				entry.wantedLevel = level;
+				entry.pixels = pixels;
+				entry.distance = distance;
+			} else {
+				entry.wantedLevel = min(entry.wantedLevel, level);
+				entry.pixels = max(entry.pixels, pixels);
+				entry.distance = min(entry.distance, distance);
+			}
+		}
+
+		// Once per frame on the context thread, after this frame's requests: upload levels that finished fetching,
+		// evict down to the budget and start fetching the next finer level of the most visible textures
+		void update() {
+			uploadFetched();
+
+			// The budget may have been lowered
+			if (stats.residentBytes + stats.pendingBytes > stats.budgetBytes) {
+				makeRoom(0, nullptr, true);
+			}
+
+			// Largest on screen first, the nearer one on a tie
+			candidates.clear();
+			for (pair<const unsigned int, Entry> &entry : entries) {
+				Entry &texture = entry.second;
+				if (texture.lastRequested == frame && texture.wantedLevel < texture.residentLevel && texture.fetchingLevel == NOT_FETCHING) {
+					candidates.push_back({ entry.first, &texture });
+				}
+			}
+			sort(candidates.begin(), candidates.end(), [](const Candidate &a, const Candidate &b) {
+				return a.entry->pixels != b.entry->pixels ? a.entry->pixels > b.entry->pixels : a.entry->distance < b.entry->distance;
+			});
+
+			// One level at a time, coarse to fine, so every texture sharpens progressively
+			for (const Candidate &candidate : candidates) {
+				if (inFlight >= maxInFlight) {
+					break;
+				}
+
+				Entry &texture = *candidate.entry;
+				unsigned int level = texture.residentLevel - 1;
+				size_t bytes = texture.image->levels[level].size;
+				if (stats.residentBytes + stats.pendingBytes + bytes > stats.budgetBytes && !makeRoom(bytes, &texture, false)) {
+					continue;
+				}
+				fetch(candidate.id, texture, level);
+			}
+
+			stats.missingLevels = 0;
+			for (pair<const unsigned int, Entry> &entry : entries) {
+				if (entry.second.lastRequested == frame && entry.second.wantedLevel < entry.second.residentLevel) {
+					stats.missingLevels += entry.second.residentLevel - entry.second.wantedLevel;
+				}
+			}
+			size_t used = stats.residentBytes + stats.pendingBytes;
+			stats.peakBytes = max(stats.peakBytes, used);
+			if (used > stats.budgetBytes) {
+				stats.overBudgetUpdates++;
+			}
+			frame++;
+		}
+
+		void setBudget(size_t bytes) {
+			stats.budgetBytes = bytes;
+		}
+
+		const TextureResidency &residency() const {
+			return stats;
+		}
+
+		// Finest level with valid data, or -1 for a texture the streamer doesn't hold
+		int residentLevel(unsigned int id) const {
+			unordered_map<unsigned int, Entry>::const_iterator found = entries.find(id);
+			return found == entries.end() ? -1 : (int)found->second.residentLevel;
+		}
+
+		int wantedLevel(unsigned int id) const {
+			unordered_map<unsigned int, Entry>::const_iterator found = entries.find(id);
+			return found == entries.end() ? -1 : (int)found->second.wantedLevel;
+		}
+
+	private:
+		static const unsigned int NOT_FETCHING = ~0u;
+
+		struct Entry {
+			shared_ptr<CompressedImage> image;
+			uint64_t serial = 0;              // Tells a re-added texture with a reused GL name from the old one
+			unsigned int tailLevel = 0;       // Always resident from here down
+			unsigned int residentLevel = 0;   // Finest valid level, the base level GL samples from
+			unsigned int wantedLevel = 0;     // Finest level the last request asked for
+			unsigned int fetchingLevel = NOT_FETCHING;
+			uint64_t lastRequested = 0;       // Frame of the last request, eviction goes oldest first
+			float pixels = 0.0f;
+			float distance = 0.0f;
+		};
+
+		struct Candidate {
+			unsigned int id;
+			Entry *entry;
+		};
+
+		// A level whose pages a worker has read, waiting for the context thread
+		struct Fetched {
+			unsigned int id;
+			uint64_t serial;
+			unsigned int level;
+		};
+
+		bool useGL;
+		unordered_map<unsigned int, Entry> entries;
+		TextureResidency stats;
+		uint64_t frame = 1;
+		uint64_t nextSerial = 1;
+		unsigned int lastHeadlessID = 0;
+		unsigned int inFlight = 0;
+		vector<Candidate> candidates;
+		vector<Candidate> victims;
+		vector<Fetched> fetched; // Arrived but not uploaded yet, carried over when an update runs out of upload budget
+		LockFreeQueue<Fetched> completed;
+
+		// Fetches push to completed, so workers are declared last and joined first
+		ThreadPool workers;
+
+		size_t bytesFrom(const Entry &entry, unsigned int level) const {
+			size_t bytes = 0;
+			for (unsigned int i = level; i < entry.image->levels.size(); i++) {
+				bytes += entry.image->levels[i].size;
+			}
+			return bytes;
+		}
+
+		// Read the level on a worker so a mapped texture cache faults in there, not in the upload. GL calls stay
+		// on the context thread, the upload copies the now resident pages into the unpack buffer.
+		void fetch(unsigned int id, Entry &entry, unsigned int level) {
+			entry.fetchingLevel = level;
+			stats.pendingBytes += entry.image->levels[level].size;
+			inFlight++;
+
+			shared_ptr<CompressedImage> image = entry.image;
+			uint64_t serial = entry.serial;
+			workers.submit([this, image, id, serial, level] {
+				const volatile uint8_t *bytes = image->bytes + image->levels[level].offset;
+				for (size_t offset = 0; offset < image->levels[level].size; offset += 4096) {
+					(void)bytes[offset];
+				}
+				completed.push({ id, serial, level });
+			});
+		}
+
+		void uploadFetched() {
+			completed.popAll(fetched);
+
+			size_t uploaded = 0, kept = 0;
+			for (const Fetched &level : fetched) {
+				// Removed, or removed and its name reused, while the fetch was running
+				unordered_map<unsigned int, Entry>::iterator found = entries.find(level.id);
+				if (found == entries.end() || found->second.serial != level.serial || found->second.fetchingLevel != level.level) {
+					inFlight--;
+					continue;
+				}
+				if (uploaded >= frameUploadBytes) {
+					fetched[kept++] = level;
+					continue;
+				}
+
+				Entry &entry = found->second;
+				size_t bytes = entry.image->levels[level.level].size;
+				if (useGL) {
+					glBindTexture(GL_TEXTURE_2D, level.id);
+					uploadCompressedLevel(*entry.image, level.level, pixelUnpackBuffer());
+					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level.level);
+				}
+				entry.residentLevel = level.level;
+				entry.fetchingLevel = NOT_FETCHING;
+				stats.pendingBytes -= bytes;
+				stats.residentBytes += bytes;
+				stats.streamedLevels++;
+				stats.streamedBytes += bytes;
+				uploaded += bytes;
+				inFlight--;
+			}
+			fetched.resize(kept);
+		}
+
+		// Drop finest levels, least recently requested texture first, until bytes more fit. Textures requested this frame
+		// only give up levels finer than they want unless force is set. Never touches the requester or a texture mid-fetch.
+		bool makeRoom(size_t bytes, const Entry *requester, bool force) {
+			victims.clear();
+			for (pair<const unsigned int, Entry> &entry : entries) {
+				Entry &texture = entry.second;
+				if (&texture != requester && texture.fetchingLevel == NOT_FETCHING && texture.residentLevel < texture.tailLevel) {
+					victims.push_back({ entry.first, &texture });
+				}
+			}
+			sort(victims.begin(), victims.end(), [](const Candidate &a, const Candidate &b) {
+				return a.entry->lastRequested != b.entry->lastRequested ? a.entry->lastRequested < b.entry->lastRequested : a.entry->pixels < b.entry->pixels;
+			});
+
+			for (const Candidate &victim : victims) {
+				Entry &texture = *victim.entry;
+				while (stats.residentBytes + stats.pendingBytes + bytes > stats.budgetBytes && texture.residentLevel < texture.tailLevel
+					&& (force || texture.lastRequested != frame || texture.residentLevel < texture.wantedLevel)) {
+					evict(victim.id, texture);
+				}
+				if (stats.residentBytes + stats.pendingBytes + bytes <= stats.budgetBytes) {
+					return true;
+				}
+			}
+			return false;
+		}
+
+		void evict(unsigned int id, Entry &entry) {
+			unsigned int level = entry.residentLevel++;
+			if (useGL) {
+				glBindTexture(GL_TEXTURE_2D, id);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, entry.residentLevel);
+				glInvalidateTexImage(id, level);
+			}
+			stats.residentBytes -= entry.image->levels[level].size;
+			stats.evictedLevels++;
+		}
+};
+
+// Shared by every model loaded with streamed textures, created on first use with the context current
+unique_ptr<TextureStreamer> sharedTextureStreamer;
+
+TextureStreamer &textureStreamer() {
+	if (!sharedTextureStreamer) {
+		sharedTextureStreamer = make_unique<TextureStreamer>();
+	}
+	return *sharedTextureStreamer;
+}
+
+// Join the shared streamer's workers and drop its entries before the context goes, once every model is gone
+void shutdownTextureStreamer() {
+	sharedTextureStreamer.reset();
+}
+
+// Fly a camera over a grid of textured meshes with a budget well under the full chains and check it is never
+// exceeded, that fine levels get evicted on the way and that the textures near the end point sharpen fully once
+// the camera stops. Headless, the chains are zero filled. Returns false if a check failed.
+bool benchmarkTextureStreaming(size_t budgetBytes = 8 << 20, unsigned int gridSize = 8, int frames = 600) {
+	// Chain layouts only, every image reads the same zeroed bytes (BC1 at 2048 is the largest chain)
+	auto makeImage = [](BlockFormat format, int size) {
+		shared_ptr<CompressedImage> image = make_shared<CompressedImage>();
+		image->format = format;
+		image->width = size;
+		image->height = size;
+		uint64_t offset = 0;
+		for (int levelSize = size; ; levelSize = max(levelSize / 2, 1)) {
+			uint64_t bytes = (uint64_t)((levelSize + 3) / 4) * ((levelSize + 3) / 4) * blockBytes(format);
+			image->levels.push_back({ (uint32_t)levelSize, (uint32_t)levelSize, offset, bytes });
+			offset += bytes;
+			if (levelSize == 1) {
+				break;
+			}
+		}
+		return image;
+	};
+	vector<uint8_t> zeros(makeImage(BlockFormat::BC1, 2048)->totalBytes());
+
+	// Unit spheres 4 apart, each with its own texture
+	TextureStreamer streamer(budgetBytes, false);
+	vector<Mesh> meshes;
+	for (unsigned int i = 0; i < gridSize * gridSize; i++) {
+		shared_ptr<CompressedImage> image = i % 2 ? makeImage(BlockFormat::BC3, 1024) : makeImage(BlockFormat::BC1, 2048);
+		image->bytes = zeros.data();
+		vector<Texture> textures = { { streamer.add(image), "texture_diffuse", "" } };
+		Mesh mesh(0, 0, 0, textures);
+		mesh.bounds.center = glm::vec3((i % gridSize) * 4.0f, 0.0f, (i / gridSize) * 4.0f);
+		mesh.bounds.radius = 1.0f;
+		mesh.box.center = mesh.bounds.center;
+		mesh.box.extents = glm::vec3(1.0f);
+		meshes.push_back(move(mesh));
+	}
+
+	// Diagonal pass low over the grid, turning as it goes, then a hold at the end
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 100.0f);
+	Camera camera(glm::vec3(-4.0f, 1.5f, -4.0f), glm::vec3(0.0f, 1.0f, 0.0f), 45.0f, -10.0f);
+	float span = gridSize * 4.0f;
+	int holdFrames = 100;
+	double updateMs = 0.0;
+	size_t missingLevels = 0;
+	for (int frame = 0; frame < frames + holdFrames; frame++) {
+		if (frame < frames) {
+			float t = (float)frame / frames;
+			camera.position = glm::vec3(-4.0f + span * t, 1.5f, -4.0f + span * 0.5f * t);
+			camera.processMouseMovement(0.2f / camera.mouseSensitivity, 0.0f);
+		}
+		this_thread::sleep_for(chrono::milliseconds(1)); // Stands in for rendering, the workers fetch meanwhile
+
+		Frustum frustum = extractFrustum(projection * camera.getViewMatrix());
+		LodView view = makeLodView(camera, 600);
+		for (const Mesh &mesh : meshes) {
+			if (isVisible(frustum, mesh.box)) {
+				streamer.request(mesh, glm::mat4(1.0f), view);
+			}
+		}
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		streamer.update();
+		updateMs += chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		missingLevels += streamer.residency().missingLevels;
+	}
+
+	const TextureResidency &residency = streamer.residency();
+	BenchmarkChecks checks("Texture streaming benchmark");
+	checks.check("resident and pending levels stay within the budget", residency.overBudgetUpdates == 0 && residency.peakBytes <= budgetBytes);
+	checks.check("the budget forces fine levels out", residency.evictedLevels > 0);
+	checks.check("every requested level is resident once the camera stops", residency.missingLevels == 0);
+
+	int totalFrames = frames + holdFrames;
+	cout << "Texture streaming: " << meshes.size() << " textures, " << residency.fullChainBytes / (1 << 20) << " MB of full chains in a "
+		<< budgetBytes / (1 << 20) << " MB budget, " << totalFrames << " frames" << endl;
+	cout << "  peak " << residency.peakBytes / 1024 << " KB, " << residency.streamedLevels << " levels (" << residency.streamedBytes / (1 << 20) << " MB) streamed, "
+		<< residency.evictedLevels << " evicted, " << (double)missingLevels / totalFrames << " levels missing per frame, "
+		<< updateMs / totalFrames << " ms per update" << endl;
+	return checks.report();
+}
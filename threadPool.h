@@ -0,0 +1,126 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed set of worker threads pulling tasks from a shared queue
+class ThreadPool {
+	public:
+		ThreadPool(unsigned int numThreads = std::thread::hardware_concurrency()) {
+			if (numThreads == 0) {
+				numThreads = 1;
+			}
+
+			for (unsigned int i = 0; i < numThreads; i++) {
+				workers.emplace_back([this] { workerLoop(); });
+			}
+		}
+
+		~ThreadPool() {
+			{
+				std::lock_guard<std::mutex> lock(queueMutex);
+				stopping = true;
+			}
+			queueCondition.notify_all();
+
+			for (std::thread &worker : workers) {
+				worker.join();
+			}
+		}
+
+		ThreadPool(const ThreadPool &) = delete;
+		ThreadPool &operator=(const ThreadPool &) = delete;
+
+		// Queue a task and get a future for its result
+		template <typename Function>
+		std::future<std::invoke_result_t<Function>> submit(Function task) {
+			using Result = std::invoke_result_t<Function>;
+
+			// std::function must be copyable, so share the move-only packaged task
+			std::shared_ptr<std::packaged_task<Result()>> packaged = std::make_shared<std::packaged_task<Result()>>(std::move(task));
+			std::future<Result> result = packaged->get_future();
+			{
+				std::lock_guard<std::mutex> lock(queueMutex);
+				tasks.push([packaged] { (*packaged)(); });
+			}
+			queueCondition.notify_one();
+
+			return result;
+		}
+
+		// Run body(i) for every i in [0, count) in contiguous chunks and wait for all of them.
+		// Must not be called from one of this pool's own tasks, the waiting worker could starve it.
+		template <typename Function>
+		void parallelFor(size_t count, Function body) {
+			// A few chunks per worker so uneven items still balance
+			size_t numChunks = std::min<size_t>(count, (size_t)size() * 4);
+			if (numChunks <= 1) {
+				for (size_t i = 0; i < count; i++) {
+					body(i);
+				}
+				return;
+			}
+
+			std::vector<std::future<void>> chunks;
+			for (size_t chunk = 0; chunk < numChunks; chunk++) {
+				size_t first = count * chunk / numChunks;
+				size_t last = count * (chunk + 1) / numChunks;
+				chunks.push_back(submit([&body, first, last] {
+					for (size_t i = first; i < last; i++) {
+						body(i);
+					}
+				}));
+			}
+
+			// Every chunk references body, so all must finish before an exception leaves this frame
+			for (std::future<void> &chunk : chunks) {
+				chunk.wait();
+			}
+			for (std::future<void> &chunk : chunks) {
+				chunk.get();
+			}
+		}
+
+		unsigned int size() const {
+			return (unsigned int)workers.size();
+		}
+
+	private:
+		std::vector<std::thread> workers;
+		std::queue<std::function<void()>> tasks;
+		std::mutex queueMutex;
+		std::condition_variable queueCondition;
+		bool stopping = false;
+
+		void workerLoop() {
+			while (true) {
+				std::function<void()> task;
+				{
+					std::unique_lock<std::mutex> lock(queueMutex);
+					queueCondition.wait(lock, [this] { return stopping || !tasks.empty(); });
+
+					// Drain remaining work before exiting
+					if (tasks.empty()) {
+						return;
+					}
+					task = std::move(tasks.front());
+					tasks.pop();
+				}
+				task();
+			}
+		}
+};
+
+// Shared pool for asset loading work
+ThreadPool &loaderThreadPool() {
+	static ThreadPool pool;
+	return pool;
+}
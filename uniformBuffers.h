@@ -0,0 +1,118 @@
+#pragma once
+
+#include "glResource.h"
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+
+// Binding points shared by every shader's uniform blocks (see "layout (std140, binding = N)")
+const unsigned int FRAME_UNIFORM_BINDING = 0;
+const unsigned int LIGHT_UNIFORM_BINDING = 1;
+
+// C++ mirrors of the std140 blocks. vec3 members are 16-byte aligned in std140, so padding is spelled out.
+
+// FrameData block
+struct FrameUniforms {
+	glm::mat4 projection;
+	glm::mat4 view;
+	glm::vec3 viewPos;
+	float pad0;
+};
+
+struct DirLightUniform {
+	glm::vec3 direction;
+	float pad0;
+	glm::vec3 ambient;
+	float pad1;
+	glm::vec3 diffuse;
+	float pad2;
+	glm::vec3 specular;
+	float pad3;
+};
+
+struct SpotlightUniform {
+	glm::vec3 position;
+	float pad0;
+	glm::vec3 direction;
+	float cutoff;
+	float outerCutoff;
+
+	// Attenuation function coeffs
+	float constant;
+	float linear;
+	float quadratic;
+
+	glm::vec3 ambient;
+	float pad1;
+	glm::vec3 diffuse;
+	float pad2;
+	glm::vec3 specular;
+	float pad3;
+};
+
+// LightData block, point lights live in a LightSet storage buffer
+struct LightUniforms {
+	DirLightUniform dirLight;
+	SpotlightUniform spotlight;
+	unsigned int numPointLights;
+
+	// Clustered shading, see LightClusters
+	unsigned int clusteredShading; // 0 loops over every point light
+	glm::vec2 screenSize;
+	glm::uvec3 clusterGrid;        // Tiles x, tiles y, depth slices
+	float clusterNear;
+	float clusterFar;
+	float pad0[3];
+};
+
+// std140 offsets
+static_assert(offsetof(FrameUniforms, projection) == 0, "FrameData layout mismatch");
+static_assert(offsetof(FrameUniforms, view) == 64, "FrameData layout mismatch");
+static_assert(offsetof(FrameUniforms, viewPos) == 128, "FrameData layout mismatch");
+static_assert(sizeof(FrameUniforms) == 144, "FrameData layout mismatch");
+
+static_assert(offsetof(DirLightUniform, ambient) == 16, "DirLight layout mismatch");
+static_assert(offsetof(DirLightUniform, diffuse) == 32, "DirLight layout mismatch");
+static_assert(offsetof(DirLightUniform, specular) == 48, "DirLight layout mismatch");
+static_assert(sizeof(DirLightUniform) == 64, "DirLight layout mismatch");
+
+static_assert(offsetof(SpotlightUniform, direction) == 16, "Spotlight layout mismatch");
+static_assert(offsetof(SpotlightUniform, cutoff) == 28, "Spotlight layout mismatch");
+static_assert(offsetof(SpotlightUniform, outerCutoff) == 32, "Spotlight layout mismatch");
+static_assert(offsetof(SpotlightUniform, constant) == 36, "Spotlight layout mismatch");
+static_assert(offsetof(SpotlightUniform, linear) == 40, "Spotlight layout mismatch");
+static_assert(offsetof(SpotlightUniform, quadratic) == 44, "Spotlight layout mismatch");
+static_assert(offsetof(SpotlightUniform, ambient) == 48, "Spotlight layout mismatch");
+static_assert(offsetof(SpotlightUniform, diffuse) == 64, "Spotlight layout mismatch");
+static_assert(offsetof(SpotlightUniform, specular) == 80, "Spotlight layout mismatch");
+static_assert(sizeof(SpotlightUniform) == 96, "Spotlight layout mismatch");
+
+static_assert(offsetof(LightUniforms, spotlight) == 64, "LightData layout mismatch");
+static_assert(offsetof(LightUniforms, numPointLights) == 160, "LightData layout mismatch");
+static_assert(offsetof(LightUniforms, clusteredShading) == 164, "LightData layout mismatch");
+static_assert(offsetof(LightUniforms, screenSize) == 168, "LightData layout mismatch");
+static_assert(offsetof(LightUniforms, clusterGrid) == 176, "LightData layout mismatch");
+static_assert(offsetof(LightUniforms, clusterNear) == 188, "LightData layout mismatch");
+static_assert(offsetof(LightUniforms, clusterFar) == 192, "LightData layout mismatch");
+static_assert(sizeof(LightUniforms) == 208, "LightData layout mismatch");
+
+// Uniform buffer permanently attached to one binding point
+template <typename Block>
+class UniformBuffer {
+	public:
+		GLBuffer ID;
+
+		UniformBuffer(unsigned int binding) {
+			ID = GLBuffer::create();
+			glNamedBufferStorage(ID, sizeof(Block), NULL, GL_DYNAMIC_STORAGE_BIT);
+			glBindBufferBase(GL_UNIFORM_BUFFER, binding, ID);
+		}
+
+		// Replace the whole block, once per frame
+		void update(const Block &data) {
+			glNamedBufferSubData(ID, 0, sizeof(Block), &data);
+		}
+};
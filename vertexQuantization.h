@@ -0,0 +1,119 @@
+#pragma once
+
+#include "mesh.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+using namespace std;
+
+// Worst and average deviation of decoded packed vertices from the float originals
+struct QuantizationError {
+	float maxPosition = 0.0f;      // Model units
+	double sumSquaredPosition = 0.0;
+	float maxNormalDegrees = 0.0f;
+	float maxTexCoord = 0.0f;
+	size_t numVertices = 0;
+
+	float rmsPosition() const {
+		return numVertices ? (float)sqrt(sumSquaredPosition / numVertices) : 0.0f;
+	}
+
+	void merge(const QuantizationError &other) {
+		maxPosition = max(maxPosition, other.maxPosition);
+		sumSquaredPosition += other.sumSquaredPosition;
+		maxNormalDegrees = max(maxNormalDegrees, other.maxNormalDegrees);
+		maxTexCoord = max(maxTexCoord, other.maxTexCoord);
+		numVertices += other.numVertices;
+	}
+};
+
+// Unit vector onto the octahedron, folded into [-1, 1]^2
+glm::vec2 octEncode(const glm::vec3 &normal) {
+	glm::vec3 n = normal / max(abs(normal.x) + abs(normal.y) + abs(normal.z), 1e-20f);
+	glm::vec2 encoded(n.x, n.y);
+	if (n.z < 0.0f) {
+		encoded.x = (1.0f - abs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+		encoded.y = (1.0f - abs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+	}
+	return encoded;
+}
+
+// Same as octDecode in lightingShader.vs
+glm::vec3 octDecode(const glm::vec2 &encoded) {
+	glm::vec3 n(encoded.x, encoded.y, 1.0f - abs(encoded.x) - abs(encoded.y));
+	float t = max(-n.z, 0.0f);
+	n.x += n.x >= 0.0f ? -t : t;
+	n.y += n.y >= 0.0f ? -t : t;
+	return glm::normalize(n);
+}
+
+int16_t packSnorm16(float value) {
+	return (int16_t)lround(glm::clamp(value, -1.0f, 1.0f) * 32767.0f);
+}
+
+uint16_t packUnorm16(float value) {
+	return (uint16_t)lround(glm::clamp(value, 0.0f, 1.0f) * 65535.0f);
+}
+
+// Pack one mesh's vertices against its own bounds. Fills the mesh's dequantization transform and measures the error.
+QuantizationError quantizeVertices(const Vertex *vertices, size_t numVertices, PackedVertex *packed, Mesh &mesh) {
+	QuantizationError error;
+	error.numVertices = numVertices;
+
+	glm::vec3 minPos(INFINITY), maxPos(-INFINITY);
+	for (size_t i = 0; i < numVertices; i++) {
+		minPos = glm::min(minPos, vertices[i].position);
+		maxPos = glm::max(maxPos, vertices[i].position);
+	}
+	if (numVertices == 0) {
+		minPos = maxPos = glm::vec3(0.0f);
+	}
+
+	// Flat axes keep a non-zero scale so the shader transform stays well defined
+	glm::vec3 extent = glm::max(maxPos - minPos, glm::vec3(1e-20f));
+	mesh.packedVertices = true;
+	mesh.positionOffset = minPos;
+	mesh.positionScale = extent;
+
+	for (size_t i = 0; i < numVertices; i++) {
+		const Vertex &vertex = vertices[i];
+		PackedVertex &out = packed[i];
+
+		glm::vec3 relative = (vertex.position - minPos) / extent;
+		out.position[0] = packUnorm16(relative.x);
+		out.position[1] = packUnorm16(relative.y);
+		out.position[2] = packUnorm16(relative.z);
+		out.position[3] = 0;
+
+		glm::vec2 encoded = octEncode(vertex.normal);
+		out.normal[0] = packSnorm16(encoded.x);
+		out.normal[1] = packSnorm16(encoded.y);
+
+		out.texCoords[0] = glm::packHalf1x16(vertex.texCoords.x);
+		out.texCoords[1] = glm::packHalf1x16(vertex.texCoords.y);
+
+		// Decode exactly like the shader to measure the error
+		glm::vec3 position = minPos + extent * glm::vec3(out.position[0], out.position[1], out.position[2]) / 65535.0f;
+		float positionError = glm::length(position - vertex.position);
+		error.maxPosition = max(error.maxPosition, positionError);
+		error.sumSquaredPosition += (double)positionError * positionError;
+
+		float normalLength = glm::length(vertex.normal);
+		if (normalLength > 0.0f) {
+			glm::vec3 normal = octDecode(glm::vec2(out.normal[0], out.normal[1]) / 32767.0f);
+			float cosine = glm::clamp(glm::dot(normal, vertex.normal / normalLength), -1.0f, 1.0f);
+			error.maxNormalDegrees = max(error.maxNormalDegrees, glm::degrees(acos(cosine)));
+		}
+
+		glm::vec2 texCoords(glm::unpackHalf1x16(out.texCoords[0]), glm::unpackHalf1x16(out.texCoords[1]));
+		glm::vec2 texCoordError = glm::abs(texCoords - vertex.texCoords);
+		error.maxTexCoord = max(error.maxTexCoord, max(texCoordError.x, texCoordError.y));
+	}
+
+	return error;
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include "mesh.h"
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+// Grid steps attributes are snapped to before comparing, vertices landing in the same cell are merged.
+// Position is relative to the mesh's largest extent so it works at any scale.
+struct WeldTolerance {
+	float position = 1e-6f;
+	float normal = 1e-4f;
+	float texCoord = 1e-6f;
+};
+
+struct WeldReport {
+	size_t verticesBefore = 0;
+	size_t verticesAfter = 0;
+	size_t indices = 0;
+
+	size_t vertexBytesBefore() const {
+		return verticesBefore * sizeof(Vertex);
+	}
+
+	size_t vertexBytesAfter() const {
+		return verticesAfter * sizeof(Vertex);
+	}
+
+	// Every index fits in 16 bits
+	bool fitsShortIndices() const {
+		return verticesAfter < 65536;
+	}
+
+	// What 16-bit indices would save on top, 0 if the mesh is too big for them
+	size_t shortIndexSavings() const {
+		return fitsShortIndices() ? indices * (sizeof(unsigned int) - sizeof(uint16_t)) : 0;
+	}
+};
+
+// Snapped attributes, the identity of a welded vertex
+struct WeldKey {
+	int64_t value[8];
+
+	bool operator==(const WeldKey &other) const {
+		for (int i = 0; i < 8; i++) {
+			if (value[i] != other.value[i]) {
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+uint64_t hashWeldKey(const WeldKey &key) {
+	// 64-bit FNV-1a over the components, then a final mix so low bits are usable as a table index
+	uint64_t hash = 14695981039346656037ull;
+	for (int i = 0; i < 8; i++) {
+		hash = (hash ^ (uint64_t)key.value[i]) * 1099511628211ull;
+	}
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdull;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+// Merge vertices whose snapped position, normal and texcoords match, and remap the indices.
+// Open addressing with linear probing, sized to at most half full so probes stay short.
+WeldReport weldVertices(Mesh &mesh, const WeldTolerance &tolerance = WeldTolerance()) {
+	WeldReport report;
+	report.verticesBefore = mesh.vertices.size();
+	report.indices = mesh.indices.size();
+	if (mesh.vertices.empty()) {
+		return report;
+	}
+
+	glm::vec3 minimum = mesh.vertices[0].position, maximum = minimum;
+	for (const Vertex &vertex : mesh.vertices) {
+		minimum = glm::min(minimum, vertex.position);
+		maximum = glm::max(maximum, vertex.position);
+	}
+	glm::vec3 size = maximum - minimum;
+	float positionStep = fmax(fmax(size.x, fmax(size.y, size.z)) * tolerance.position, 1e-30f);
+
+	auto makeKey = [&](const Vertex &vertex) {
+		WeldKey key;
+		for (int i = 0; i < 3; i++) {
+			key.value[i] = llround(vertex.position[i] / positionStep);
+			key.value[3 + i] = llround(vertex.normal[i] / tolerance.normal);
+		}
+		key.value[6] = llround(vertex.texCoords.x / tolerance.texCoord);
+		key.value[7] = llround(vertex.texCoords.y / tolerance.texCoord);
+		return key;
+	};
+
+	size_t capacity = 1;
+	while (capacity < mesh.vertices.size() * 2) {
+		capacity *= 2;
+	}
+	vector<int> table(capacity, -1); // Welded vertex index per slot
+	vector<WeldKey> keys;
+	keys.reserve(mesh.vertices.size());
+
+	// First occurrence of each vertex survives unchanged, later ones point at it
+	vector<unsigned int> remap(mesh.vertices.size());
+	vector<Vertex> welded;
+	welded.reserve(mesh.vertices.size());
+	for (size_t i = 0; i < mesh.vertices.size(); i++) {
+		WeldKey key = makeKey(mesh.vertices[i]);
+		size_t slot = hashWeldKey(key) & (capacity - 1);
+		while (table[slot] >= 0 && !(keys[table[slot]] == key)) {
+			slot = (slot + 1) & (capacity - 1);
+		}
+
+		if (table[slot] < 0) {
+			table[slot] = (int)welded.size();
+			keys.push_back(key);
+			welded.push_back(mesh.vertices[i]);
+		}
+		remap[i] = (unsigned int)table[slot];
+	}
+
+	for (unsigned int &index : mesh.indices) {
+		index = remap[index];
+	}
+	mesh.vertices = move(welded);
+	mesh.vertexCount = (unsigned int)mesh.vertices.size();
+
+	report.verticesAfter = mesh.vertices.size();
+	return report;
+}